@@ -5,6 +5,10 @@ attribute vec4 a_color;
 
 uniform vec3 u_camera_pos;
 
+//quantized meshes store the vertices in [0,1] inside their box (see Mesh::quantize)
+uniform vec3 u_vertex_offset;
+uniform vec3 u_vertex_scale;
+
 uniform mat4 u_model;
 uniform mat4 u_viewprojection;
 
@@ -21,7 +25,7 @@ void main()
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
+	v_position = u_vertex_offset + a_vertex * u_vertex_scale;
 	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
@@ -7,6 +7,10 @@ attribute mat4 u_model;
 
 uniform vec3 u_camera_pos;
 
+//quantized meshes store the vertices in [0,1] inside their box (see Mesh::quantize)
+uniform vec3 u_vertex_offset;
+uniform vec3 u_vertex_scale;
+
 uniform mat4 u_viewprojection;
 
 //this will store the color for the pixel shader
@@ -21,8 +25,8 @@ void main()
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_position = u_vertex_offset + a_vertex * u_vertex_scale;
+	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the texture coordinates
 	v_uv = a_uv;
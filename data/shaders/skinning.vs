@@ -8,6 +8,10 @@ attribute vec4 a_weights;
 
 uniform vec3 u_camera_pos;
 
+//quantized meshes store the vertices in [0,1] inside their box (see Mesh::quantize)
+uniform vec3 u_vertex_offset;
+uniform vec3 u_vertex_scale;
+
 uniform mat4 u_model;
 uniform mat4 u_viewprojection;
 
@@ -23,7 +27,7 @@ varying vec4 v_color;
 void main()
 {	
 	//apply skinning
-	vec4 v = vec4(a_vertex,1.0);
+	vec4 v = vec4(u_vertex_offset + a_vertex * u_vertex_scale, 1.0);
 	v_position =	(u_bones[(int)a_bones.x] * a_weights.x * v + 
 			u_bones[(int)a_bones.y] * a_weights.y * v + 
 			u_bones[(int)a_bones.z] * a_weights.z * v + 
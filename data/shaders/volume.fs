@@ -0,0 +1,118 @@
+#define MAX_STEPS 2048
+
+uniform vec4 u_color;
+uniform vec3 u_local_camera_position;
+
+uniform sampler3D u_volume_texture;
+uniform vec3 u_volume_dims;
+uniform float u_step_length;
+uniform float u_brightness;
+uniform float u_density_threshold;
+uniform float u_value_scale; // quantized volumes: original density = texture value * scale + bias
+uniform float u_value_bias;
+
+// Empty space skipping
+uniform bool u_use_macrocells;
+uniform sampler3D u_macrocells_texture; // R: min, G: max
+uniform vec3 u_macrocells_dims;
+uniform float u_macrocell_size;
+
+// Precomputed gradients (RGB or octahedral encoded)
+uniform bool u_use_gradients;
+uniform sampler3D u_gradients_texture;
+uniform int u_gradients_octahedral;
+
+varying vec3 v_position;
+
+vec3 decodeGradient(vec3 uvw)
+{
+	vec4 encoded = texture3D(u_gradients_texture, uvw);
+	if (u_gradients_octahedral == 0)
+		return encoded.xyz * 2.0 - 1.0;
+
+	vec2 f = encoded.xy * 2.0 - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return n;
+}
+
+// Distance along the ray (in texture space) to leave the current macrocell, -1.0 if the cell is not empty
+float emptyCellExit(vec3 uvw, vec3 dir)
+{
+	// cells cover the voxel centers [c * size, (c + 1) * size]
+	vec3 voxel = uvw * u_volume_dims - 0.5;
+	vec3 cell = clamp(floor(voxel / u_macrocell_size), vec3(0.0), u_macrocells_dims - 1.0);
+	if (texture3D(u_macrocells_texture, (cell + 0.5) / u_macrocells_dims).g * u_value_scale + u_value_bias >= u_density_threshold)
+		return -1.0;
+
+	// the first and last cells extend to the border of the texture
+	vec3 cell_min = mix(cell * u_macrocell_size, vec3(-1.0), vec3(equal(cell, vec3(0.0))));
+	vec3 cell_max = mix((cell + 1.0) * u_macrocell_size, u_volume_dims + 1.0, vec3(equal(cell, u_macrocells_dims - 1.0)));
+
+	vec3 voxel_dir = dir * u_volume_dims;
+	vec3 bound = mix(cell_min, cell_max, step(0.0, voxel_dir));
+	vec3 t = (bound - voxel) / voxel_dir; // infinite in the axes the ray does not move
+	return min(t.x, min(t.y, t.z));
+}
+
+void main()
+{
+	// ray in the [-1,1] cube, intersected with its faces
+	vec3 origin = u_local_camera_position;
+	vec3 dir = normalize(v_position - origin);
+	vec3 t0 = (vec3(-1.0) - origin) / dir;
+	vec3 t1 = (vec3(1.0) - origin) / dir;
+	vec3 tmin = min(t0, t1);
+	vec3 tmax = max(t0, t1);
+	float t_near = max(max(tmin.x, tmin.y), max(tmin.z, 0.0));
+	float t_far = min(min(tmax.x, tmax.y), tmax.z);
+
+	// march in texture space, where the cube is [0,1]
+	vec3 start = (origin + dir * t_near) * 0.5 + 0.5;
+	float ray_length = (t_far - t_near) * 0.5;
+
+	vec4 result = vec4(0.0);
+	float t = 0.0;
+	for (int i = 0; i < MAX_STEPS; ++i)
+	{
+		if (t >= ray_length || result.a > 0.99)
+			break;
+
+		vec3 uvw = start + dir * t;
+
+		if (u_use_macrocells)
+		{
+			float cell_exit = emptyCellExit(uvw, dir);
+			if (cell_exit >= 0.0)
+			{
+				// land on the step grid past the cell so the sampling pattern does not change
+				t += max(ceil(cell_exit / u_step_length), 1.0) * u_step_length;
+				continue;
+			}
+		}
+
+		float density = texture3D(u_volume_texture, uvw).r * u_value_scale + u_value_bias;
+		if (density >= u_density_threshold)
+		{
+			// emission-absorption, front to back with premultiplied alpha
+			float alpha = clamp(density * u_brightness * u_step_length * 100.0, 0.0, 1.0);
+			vec3 sample_rgb = u_color.rgb * density * u_brightness;
+			if (u_use_gradients)
+			{
+				// two sided headlight, the gradient points to higher densities
+				vec3 n = decodeGradient(uvw);
+				float n_length = length(n);
+				float diffuse = n_length > 0.01 ? abs(dot(n / n_length, dir)) : 1.0;
+				sample_rgb *= 0.3 + 0.7 * diffuse;
+			}
+			vec4 sample_color = vec4(sample_rgb, 1.0) * alpha;
+			result += (1.0 - result.a) * sample_color;
+		}
+
+		t += u_step_length;
+	}
+
+	gl_FragColor = result;
+}
@@ -7,6 +7,7 @@
 #include "shader.h"
 #include "input.h"
 #include "animation.h"
+#include "resourcemanager.h"
 #include "extra/hdre.h"
 #include "extra/imgui/imgui.h"
 #include "extra/imgui/imgui_impl_sdl.h"
@@ -49,29 +50,21 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	{
 		// HDRE textures
 		char* folder_name_hdre = "data/environments/pisa.hdre";
-		HDRE* hdre = HDRE::Get(folder_name_hdre);
+		// resources are loaded in the background, white until they are uploaded
+		ResourceManager* resources = ResourceManager::getInstance();
 
-		// create an array to store all the hdre versions 
-		std::vector<Texture*> hdre_versions;
-
-		// There are 5 levels: the original + 5 blurred versions
-		for (unsigned int LEVEL = 0; LEVEL < 6; LEVEL = LEVEL + 1) {
-			Texture* texture = new Texture();
-
-			texture->cubemapFromHDRE(hdre, LEVEL); // store this version to the array created before. 
-
-			hdre_versions.push_back(texture);
-		}
+		// There are 6 levels: the original + 5 blurred versions
+		std::vector<Texture*> hdre_versions = resources->getHDRECubemaps(folder_name_hdre, 6);
 
 		// LUT
-		Texture* brdfLUT_texture = Texture::Get("data/brdfLUT.png");
+		Texture* brdfLUT_texture = resources->getTexture("data/brdfLUT.png");
 
 		// SPHERE______________
 		// Texture loading
-		Texture* roughness_texture = Texture::Get("data/models/ball/roughness.png");
-		Texture* metalness_texture = Texture::Get("data/models/ball/metalness.png");
-		Texture* albedo_texture = Texture::Get("data/models/ball/albedo.png");
-		Texture* normal_texture = Texture::Get("data/models/ball/normal.png");
+		Texture* roughness_texture = resources->getTexture("data/models/ball/roughness.png");
+		Texture* metalness_texture = resources->getTexture("data/models/ball/metalness.png");
+		Texture* albedo_texture = resources->getTexture("data/models/ball/albedo.png");
+		Texture* normal_texture = resources->getTexture("data/models/ball/normal.png");
 
 		// Material 
 		PBRMaterial* ball_mat = new PBRMaterial(1.0f, 1.0f);
@@ -84,7 +77,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 
 
 		// Mesh Loading
-		Mesh* ball_mesh = Mesh::Get("data/meshes/sphere.obj.mbin");
+		Mesh* ball_mesh = resources->getMesh("data/meshes/sphere.obj.mbin");
 
 		SceneNode* ball_node = new PBRNode("Ball");
 
@@ -95,12 +88,12 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 
 		// Lantern______________
 		// Texture loading
-		Texture* roughness_texture_lantern = Texture::Get("data/models/lantern/roughness.png");
-		Texture* metalness_texture_lantern = Texture::Get("data/models/lantern/metalness.png");
-		Texture* albedo_texture_lantern = Texture::Get("data/models/lantern/albedo.png");
-		Texture* normal_texture_lantern = Texture::Get("data/models/lantern/normal.png");
-		Texture* ao_texture_lantern = Texture::Get("data/models/lantern/ao.png");
-		Texture* oppacity_texture_lantern = Texture::Get("data/models/lantern/opacity.png");
+		Texture* roughness_texture_lantern = resources->getTexture("data/models/lantern/roughness.png");
+		Texture* metalness_texture_lantern = resources->getTexture("data/models/lantern/metalness.png");
+		Texture* albedo_texture_lantern = resources->getTexture("data/models/lantern/albedo.png");
+		Texture* normal_texture_lantern = resources->getTexture("data/models/lantern/normal.png");
+		Texture* ao_texture_lantern = resources->getTexture("data/models/lantern/ao.png");
+		Texture* oppacity_texture_lantern = resources->getTexture("data/models/lantern/opacity.png");
 
 		// Material 
 		PBRMaterial* lantern_mat = new PBRMaterial(1.0f, 1.0f);
@@ -117,7 +110,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 
 
 		// Mesh Loading
-		Mesh* lantern_mesh = Mesh::Get("data/models/lantern/lantern.obj.mbin");
+		Mesh* lantern_mesh = resources->getMesh("data/models/lantern/lantern.obj.mbin");
 
 		SceneNode* lantern_node = new PBRNode("Lantern");
 
@@ -133,7 +126,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 		StandardMaterial* skybox_mat = new SkyboxMaterial(folder_name_hdre, hdre_versions, hdre_versions[0]);
 
 		SceneNode* node_skybox = new SkyboxNode("skybox");
-		node_skybox->mesh = Mesh::Get("data/meshes/box.ASE.mbin");
+		node_skybox->mesh = resources->getMesh("data/meshes/box.ASE.mbin");
 		node_skybox->material = skybox_mat;
 		node_skybox->model.setTranslation(camera->eye.x, camera->eye.y, camera->eye.z);
 
@@ -150,6 +143,9 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 //what to do when the image has to be draw
 void Application::render(void)
 {
+	//finish the uploads of the resources loaded in the background
+	ResourceManager::getInstance()->update();
+
 	//set the clear color (the background color)
 	glClearColor(.1,.1,.1, 1.0);
 
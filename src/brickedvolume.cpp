@@ -0,0 +1,387 @@
+#include "brickedvolume.h"
+#include "volume.h"
+#include "texture.h"
+#include "utils.h"
+
+#include <cassert>
+#include <algorithm>
+
+#ifdef WIN32
+	#define fseek64 _fseeki64
+#else
+	#define fseek64 fseeko
+#endif
+
+#define BRICKED_VOLUME_VERSION 1
+
+typedef struct
+{
+	char magic[4]; //BVOL
+	int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	float spacing[3];
+	unsigned int voxelChannels;
+	unsigned int voxelBytes;
+	unsigned int voxelType;
+	unsigned int brickSize;
+	unsigned int brickBorder;
+} sBrickedVolumeHeader;
+
+static inline int clampIndex(int v, int size) { return v < 0 ? 0 : (v >= size ? size - 1 : v); }
+
+BrickedVolume::BrickedVolume()
+{
+	width = height = depth = 0;
+	widthSpacing = heightSpacing = depthSpacing = 1.0f;
+	voxelBytes = voxelChannels = 1;
+	voxelType = 0;
+	brickSize = 64;
+	brickBorder = 1;
+	bricksX = bricksY = bricksZ = 0;
+	atlas = NULL;
+	pageTable = NULL;
+	file = NULL;
+	header_size = sizeof(sBrickedVolumeHeader);
+	max_cached_bricks = 1;
+	atlasSlotsPerSide = 0;
+	page_table_dirty = false;
+}
+
+BrickedVolume::~BrickedVolume()
+{
+	close();
+}
+
+size_t BrickedVolume::getBrickBytes()
+{
+	size_t side = getBrickSideWithBorder();
+	return side * side * side * voxelChannels * voxelBytes;
+}
+
+bool BrickedVolume::build(Volume* volume, const char* filename, unsigned int brick_size, unsigned int border)
+{
+	long time = getTime();
+	std::cout << " + Bricking volume: " << filename << " ... ";
+	if (!volume || !volume->data || !brick_size)
+	{
+		std::cout << "[ERROR]: empty volume or brick size" << std::endl;
+		return false;
+	}
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR]: cannot write file" << std::endl;
+		return false;
+	}
+
+	sBrickedVolumeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "BVOL", 4);
+	header.version = BRICKED_VOLUME_VERSION;
+	header.width = volume->width;
+	header.height = volume->height;
+	header.depth = volume->depth;
+	header.spacing[0] = volume->widthSpacing;
+	header.spacing[1] = volume->heightSpacing;
+	header.spacing[2] = volume->depthSpacing;
+	header.voxelChannels = volume->voxelChannels;
+	header.voxelBytes = volume->voxelBytes;
+	header.voxelType = volume->voxelType;
+	header.brickSize = brick_size;
+	header.brickBorder = border;
+	bool written = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	const size_t voxel_size = volume->voxelChannels * volume->voxelBytes;
+	const size_t row = (size_t)volume->width * voxel_size;
+	const size_t slice = row * volume->height;
+	const int side = brick_size + 2 * border;
+	const unsigned int bricks_x = (volume->width + brick_size - 1) / brick_size;
+	const unsigned int bricks_y = (volume->height + brick_size - 1) / brick_size;
+	const unsigned int bricks_z = (volume->depth + brick_size - 1) / brick_size;
+
+	std::vector<Uint8> brick((size_t)side * side * side * voxel_size);
+
+	//bricks are stored in x, y, z order so the source volume is read in slabs
+	for (unsigned int bz = 0; bz < bricks_z && written; ++bz)
+		for (unsigned int by = 0; by < bricks_y && written; ++by)
+			for (unsigned int bx = 0; bx < bricks_x && written; ++bx)
+			{
+				Uint8* dst = &brick[0];
+				for (int k = 0; k < side; ++k)
+				{
+					int z = clampIndex((int)(bz * brick_size) + k - (int)border, volume->depth);
+					for (int j = 0; j < side; ++j)
+					{
+						int y = clampIndex((int)(by * brick_size) + j - (int)border, volume->height);
+						const Uint8* src = volume->data + (size_t)z * slice + (size_t)y * row;
+						for (int i = 0; i < side; ++i, dst += voxel_size)
+						{
+							int x = clampIndex((int)(bx * brick_size) + i - (int)border, volume->width);
+							memcpy(dst, src + x * voxel_size, voxel_size);
+						}
+					}
+				}
+				written = fwrite(&brick[0], brick.size(), 1, f) == 1;
+			}
+
+	//the last bricks are written when the buffer is flushed
+	written = (fclose(f) == 0) && written;
+	if (!written)
+	{
+		std::cout << "[ERROR]: cannot write file (disk full?)" << std::endl;
+		remove(filename);
+		return false;
+	}
+	std::cout << "[OK] Bricks: " << bricks_x << "x" << bricks_y << "x" << bricks_z << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+bool BrickedVolume::open(const char* filename, size_t memory_budget)
+{
+	close();
+
+	file = fopen(filename, "rb");
+	if (file == NULL)
+	{
+		std::cout << "[ERROR]: Bricked volume not found: " << filename << std::endl;
+		return false;
+	}
+
+	sBrickedVolumeHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "BVOL", 4) != 0 || header.version != BRICKED_VOLUME_VERSION)
+	{
+		std::cout << "[ERROR]: invalid bricked volume: " << filename << std::endl;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	//the brick counts divide by the brick size
+	if (!header.width || !header.height || !header.depth || !header.brickSize || !header.voxelChannels || !header.voxelBytes)
+	{
+		std::cout << "[ERROR]: invalid bricked volume size: " << filename << std::endl;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	width = header.width;
+	height = header.height;
+	depth = header.depth;
+	widthSpacing = header.spacing[0];
+	heightSpacing = header.spacing[1];
+	depthSpacing = header.spacing[2];
+	voxelChannels = header.voxelChannels;
+	voxelBytes = header.voxelBytes;
+	voxelType = header.voxelType;
+	brickSize = header.brickSize;
+	brickBorder = header.brickBorder;
+	bricksX = (width + brickSize - 1) / brickSize;
+	bricksY = (height + brickSize - 1) / brickSize;
+	bricksZ = (depth + brickSize - 1) / brickSize;
+	header_size = sizeof(header);
+
+	setMemoryBudget(memory_budget);
+	brick_atlas_slot.assign(getNumBricks(), -1);
+	return true;
+}
+
+void BrickedVolume::close()
+{
+	evictBricks(0);
+	if (file)
+		fclose(file);
+	file = NULL;
+
+	if (atlas)
+		delete atlas;
+	if (pageTable)
+		delete pageTable;
+	atlas = pageTable = NULL;
+	atlasSlotsPerSide = 0;
+	atlas_lru.clear();
+	atlas_lru_pos.clear();
+	atlas_slot_brick.clear();
+	brick_atlas_slot.clear();
+}
+
+void BrickedVolume::setMemoryBudget(size_t bytes)
+{
+	max_cached_bricks = std::max((size_t)1, bytes / getBrickBytes());
+	evictBricks(max_cached_bricks);
+}
+
+void BrickedVolume::evictBricks(size_t max_bricks)
+{
+	while (lru.size() > max_bricks)
+	{
+		unsigned int index = lru.back();
+		lru.pop_back();
+		auto it = cache.find(index);
+		delete it->second.volume;
+		cache.erase(it);
+	}
+}
+
+Volume* BrickedVolume::loadBrick(unsigned int index)
+{
+	int side = getBrickSideWithBorder();
+	size_t bytes = getBrickBytes();
+
+	Volume* brick = new Volume();
+	brick->voxelType = voxelType;
+	brick->resize(side, side, side, voxelChannels, voxelBytes);
+	brick->widthSpacing = widthSpacing;
+	brick->heightSpacing = heightSpacing;
+	brick->depthSpacing = depthSpacing;
+
+	fseek64(file, header_size + (long long)index * bytes, SEEK_SET);
+	if (fread(brick->data, 1, bytes, file) != bytes)
+		std::cout << "[ERROR]: bricked volume truncated, brick " << index << std::endl;
+	return brick;
+}
+
+//the returned brick is valid until the cache evicts it (next calls to getBrick may do it)
+Volume* BrickedVolume::getBrick(unsigned int bx, unsigned int by, unsigned int bz)
+{
+	assert(file && bx < bricksX && by < bricksY && bz < bricksZ);
+	unsigned int index = bx + by * bricksX + bz * bricksX * bricksY;
+
+	auto it = cache.find(index);
+	if (it != cache.end())
+	{
+		//move to the front of the LRU
+		lru.splice(lru.begin(), lru, it->second.lru_pos);
+		return it->second.volume;
+	}
+
+	evictBricks(max_cached_bricks - 1);
+
+	sCachedBrick cached;
+	cached.volume = loadBrick(index);
+	lru.push_front(index);
+	cached.lru_pos = lru.begin();
+	cache[index] = cached;
+	return cached.volume;
+}
+
+float BrickedVolume::sample(float x, float y, float z, unsigned int channel)
+{
+	assert(channel < voxelChannels);
+	x = clamp(x, 0.0f, width - 1.0f);
+	y = clamp(y, 0.0f, height - 1.0f);
+	z = clamp(z, 0.0f, depth - 1.0f);
+
+	unsigned int bx = std::min((unsigned int)x / brickSize, bricksX - 1);
+	unsigned int by = std::min((unsigned int)y / brickSize, bricksY - 1);
+	unsigned int bz = std::min((unsigned int)z / brickSize, bricksZ - 1);
+	Volume* brick = getBrick(bx, by, bz);
+
+	//position inside the brick, the border has the neighbours needed to interpolate
+	float lx = x - bx * brickSize + brickBorder;
+	float ly = y - by * brickSize + brickBorder;
+	float lz = z - bz * brickSize + brickBorder;
+	return brick->sample(lx, ly, lz, channel);
+}
+
+void BrickedVolume::createAtlas(unsigned int atlas_slots_per_side)
+{
+	assert(file && atlas_slots_per_side);
+	atlasSlotsPerSide = atlas_slots_per_side;
+	unsigned int size = atlas_slots_per_side * getBrickSideWithBorder();
+	unsigned int num_slots = atlas_slots_per_side * atlas_slots_per_side * atlas_slots_per_side;
+
+	//empty volume just to know the texture formats
+	Volume format;
+	format.voxelChannels = voxelChannels;
+	format.voxelBytes = voxelBytes;
+	format.voxelType = voxelType;
+
+	if (!atlas)
+		atlas = new Texture();
+	atlas->create3D(size, size, size, format.getTextureFormat(), format.getTextureType(), false, NULL, format.getTextureInternalFormat());
+	atlas->upload3D(format.getTextureFormat(), format.getTextureType(), false, NULL, format.getTextureInternalFormat()); //allocates VRAM
+
+	if (!pageTable)
+		pageTable = new Texture();
+	pageTable->create3D(bricksX, bricksY, bricksZ, GL_RGBA, GL_UNSIGNED_BYTE, false);
+	glBindTexture(GL_TEXTURE_3D, pageTable->texture_id);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	atlas_lru.clear();
+	atlas_lru_pos.resize(num_slots);
+	for (unsigned int i = 0; i < num_slots; ++i)
+	{
+		atlas_lru.push_back(i);
+		atlas_lru_pos[i] = std::prev(atlas_lru.end());
+	}
+	atlas_slot_brick.assign(num_slots, -1);
+	brick_atlas_slot.assign(getNumBricks(), -1);
+	page_table_dirty = true;
+	uploadPageTable();
+}
+
+Vector3u BrickedVolume::getAtlasSlotOffset(int slot)
+{
+	unsigned int side = getBrickSideWithBorder();
+	return Vector3u((slot % atlasSlotsPerSide) * side, ((slot / atlasSlotsPerSide) % atlasSlotsPerSide) * side, (slot / (atlasSlotsPerSide * atlasSlotsPerSide)) * side);
+}
+
+int BrickedVolume::requestBrickInAtlas(unsigned int bx, unsigned int by, unsigned int bz)
+{
+	assert(atlas && "call createAtlas first");
+	unsigned int index = bx + by * bricksX + bz * bricksX * bricksY;
+
+	int slot = brick_atlas_slot[index];
+	if (slot == -1)
+	{
+		//reuse the least recently used slot
+		slot = atlas_lru.back();
+		if (atlas_slot_brick[slot] != -1)
+			brick_atlas_slot[atlas_slot_brick[slot]] = -1;
+		atlas_slot_brick[slot] = index;
+		brick_atlas_slot[index] = slot;
+
+		Volume* brick = getBrick(bx, by, bz);
+		Vector3u offset = getAtlasSlotOffset(slot);
+		unsigned int side = getBrickSideWithBorder();
+		glBindTexture(GL_TEXTURE_3D, atlas->texture_id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, offset.x, offset.y, offset.z, side, side, side, brick->getTextureFormat(), brick->getTextureType(), brick->data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_3D, 0);
+		page_table_dirty = true;
+	}
+
+	atlas_lru.splice(atlas_lru.begin(), atlas_lru, atlas_lru_pos[slot]);
+	return slot;
+}
+
+void BrickedVolume::uploadPageTable()
+{
+	if (!pageTable || !page_table_dirty)
+		return;
+
+	std::vector<Uint8> table(getNumBricks() * 4, 0);
+	for (unsigned int i = 0; i < getNumBricks(); ++i)
+	{
+		int slot = brick_atlas_slot[i];
+		if (slot == -1)
+			continue;
+		table[i * 4 + 0] = slot % atlasSlotsPerSide;
+		table[i * 4 + 1] = (slot / atlasSlotsPerSide) % atlasSlotsPerSide;
+		table[i * 4 + 2] = slot / (atlasSlotsPerSide * atlasSlotsPerSide);
+		table[i * 4 + 3] = 255;
+	}
+
+	glBindTexture(GL_TEXTURE_3D, pageTable->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, bricksX, bricksY, bricksZ, 0, GL_RGBA, GL_UNSIGNED_BYTE, &table[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	page_table_dirty = false;
+}
@@ -0,0 +1,90 @@
+#ifndef BRICKEDVOLUME_H
+#define BRICKEDVOLUME_H
+
+#include "includes.h"
+#include "framework.h"
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+
+class Volume;
+class Texture;
+
+//Volume split in bricks (with a ghost border so they can be interpolated on their own) stored in a file.
+//Only the bricks in use are kept in memory (LRU cache with a memory budget) and in VRAM (3D texture atlas).
+class BrickedVolume
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+
+	float widthSpacing;
+	float heightSpacing;
+	float depthSpacing;
+
+	unsigned int voxelBytes;
+	unsigned int voxelChannels;
+	unsigned int voxelType;
+
+	unsigned int brickSize;		//voxels per side of a brick without the border
+	unsigned int brickBorder;	//ghost voxels on every side
+	unsigned int bricksX;
+	unsigned int bricksY;
+	unsigned int bricksZ;
+
+	//GPU atlas with the resident bricks and a page table (one texel per brick: xyz slot, w resident)
+	Texture* atlas;
+	Texture* pageTable;
+
+	BrickedVolume();
+	~BrickedVolume();
+
+	//writes a brick file from a volume (the volume can be a mapped one to convert files larger than RAM)
+	static bool build(Volume* volume, const char* filename, unsigned int brick_size = 64, unsigned int border = 1);
+
+	bool open(const char* filename, size_t memory_budget = 512 * 1024 * 1024);
+	void close();
+
+	void setMemoryBudget(size_t bytes);
+	unsigned int getNumBricks() { return bricksX * bricksY * bricksZ; }
+	unsigned int getBrickSideWithBorder() { return brickSize + 2 * brickBorder; }
+	size_t getBrickBytes();
+
+	//CPU access, loads the brick from disk if it is not in the cache
+	Volume* getBrick(unsigned int bx, unsigned int by, unsigned int bz);
+	float sample(float x, float y, float z, unsigned int channel = 0); //voxel coordinates, trilinear, value as stored (not normalized)
+
+	//GPU access: atlas_slots_per_side^3 bricks fit in VRAM
+	void createAtlas(unsigned int atlas_slots_per_side = 8);
+	int requestBrickInAtlas(unsigned int bx, unsigned int by, unsigned int bz); //returns the atlas slot, uploading it if needed
+	Vector3u getAtlasSlotOffset(int slot); //in voxels
+	void uploadPageTable();
+
+private:
+	struct sCachedBrick {
+		Volume* volume;
+		std::list<unsigned int>::iterator lru_pos;
+	};
+
+	FILE* file;
+	size_t header_size;
+	size_t max_cached_bricks;
+
+	std::list<unsigned int> lru; //front is the most recently used
+	std::unordered_map<unsigned int, sCachedBrick> cache;
+
+	unsigned int atlasSlotsPerSide;
+	std::list<int> atlas_lru;	//slots, front is the most recently used
+	std::vector<std::list<int>::iterator> atlas_lru_pos;
+	std::vector<int> atlas_slot_brick; //brick stored in every slot, -1 if empty
+	std::vector<int> brick_atlas_slot; //slot of every brick, -1 if not resident
+	bool page_table_dirty;
+
+	Volume* loadBrick(unsigned int index);
+	void evictBricks(size_t max_bricks);
+};
+
+#endif
@@ -215,5 +215,59 @@ namespace siv
 		{
 			return octaveNoise(x, y, z, octaves) * 0.5 + 0.5;
 		}
+
+		// Batched version: evaluates count points sharing y and z (a row of a volume).
+		// The y/z part of every octave is computed once and the inner loop only depends on x.
+		void octaveNoise0_1(const double* xs, std::size_t count, double y, double z, std::int32_t octaves, double* results) const
+		{
+			for (std::size_t n = 0; n < count; ++n)
+			{
+				results[n] = 0.0;
+			}
+
+			double freq = 1.0;
+			double amp = 1.0;
+			for (std::int32_t i = 0; i < octaves; ++i)
+			{
+				const double oy = y * freq;
+				const double oz = z * freq;
+				const std::int32_t Y = static_cast<std::int32_t>(std::floor(oy)) & 255;
+				const std::int32_t Z = static_cast<std::int32_t>(std::floor(oz)) & 255;
+				const double fy = oy - std::floor(oy);
+				const double fz = oz - std::floor(oz);
+				const double v = Fade(fy);
+				const double w = Fade(fz);
+
+				for (std::size_t n = 0; n < count; ++n)
+				{
+					const double ox = xs[n] * freq;
+					const std::int32_t X = static_cast<std::int32_t>(std::floor(ox)) & 255;
+					const double fx = ox - std::floor(ox);
+					const double u = Fade(fx);
+
+					const std::int32_t A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+					const std::int32_t B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+					const double value = Lerp(w, Lerp(v, Lerp(u, Grad(p[AA], fx, fy, fz),
+						Grad(p[BA], fx - 1, fy, fz)),
+						Lerp(u, Grad(p[AB], fx, fy - 1, fz),
+						Grad(p[BB], fx - 1, fy - 1, fz))),
+						Lerp(v, Lerp(u, Grad(p[AA + 1], fx, fy, fz - 1),
+						Grad(p[BA + 1], fx - 1, fy, fz - 1)),
+						Lerp(u, Grad(p[AB + 1], fx, fy - 1, fz - 1),
+						Grad(p[BB + 1], fx - 1, fy - 1, fz - 1))));
+
+					results[n] += value * amp;
+				}
+
+				freq *= 2.0;
+				amp *= 0.5;
+			}
+
+			for (std::size_t n = 0; n < count; ++n)
+			{
+				results[n] = results[n] * 0.5 + 0.5;
+			}
+		}
 	};
 }
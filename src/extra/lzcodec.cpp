@@ -0,0 +1,180 @@
+#include "lzcodec.h"
+
+#include <cstring>
+#include <cstdint>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 //the end of a block is always literals, like LZ4
+
+static inline uint32_t readU32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t hashU32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//lengths over 15 continue in bytes of 255
+static inline unsigned char* writeLength(unsigned char* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+size_t lzCompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+static unsigned char* writeSequence(unsigned char* op, const unsigned char* literals, size_t num_literals, size_t offset, size_t match_length)
+{
+	unsigned char* token = op++;
+	*token = (unsigned char)((num_literals >= 15 ? 15 : num_literals) << 4);
+	if (num_literals >= 15)
+		op = writeLength(op, num_literals - 15);
+	memcpy(op, literals, num_literals);
+	op += num_literals;
+
+	if (match_length == 0)
+		return op; //last sequence, only literals
+
+	*op++ = (unsigned char)(offset & 0xFF);
+	*op++ = (unsigned char)(offset >> 8);
+	size_t length = match_length - LZ_MIN_MATCH;
+	*token |= (unsigned char)(length >= 15 ? 15 : length);
+	if (length >= 15)
+		op = writeLength(op, length - 15);
+	return op;
+}
+
+size_t lzCompress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity)
+{
+	if (capacity < lzCompressBound(size))
+		return 0;
+
+	unsigned char* op = dst;
+	const unsigned char* anchor = src; //first literal not written yet
+	const unsigned char* ip = src;
+	const unsigned char* end = src + size;
+
+	if (size > LZ_LAST_LITERALS + LZ_MIN_MATCH)
+	{
+		const unsigned char* match_limit = end - LZ_LAST_LITERALS;
+		uint32_t table[1 << LZ_HASH_BITS];
+		memset(table, 0, sizeof(table));
+
+		ip++;
+		while (ip + LZ_MIN_MATCH <= match_limit)
+		{
+			uint32_t sequence = readU32(ip);
+			uint32_t h = hashU32(sequence);
+			const unsigned char* candidate = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+
+			if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || readU32(candidate) != sequence)
+			{
+				//skip faster in data that doesn't compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			//extend backwards over the pending literals and forwards up to the limit
+			while (ip > anchor && candidate > src && ip[-1] == candidate[-1])
+			{
+				ip--;
+				candidate--;
+			}
+			const unsigned char* match_end = ip + LZ_MIN_MATCH;
+			const unsigned char* candidate_end = candidate + LZ_MIN_MATCH;
+			while (match_end < match_limit && *match_end == *candidate_end)
+			{
+				match_end++;
+				candidate_end++;
+			}
+
+			op = writeSequence(op, anchor, ip - anchor, ip - candidate, match_end - ip);
+			ip = anchor = match_end;
+
+			if (ip + LZ_MIN_MATCH <= match_limit)
+				table[hashU32(readU32(ip - 2))] = (uint32_t)(ip - 2 - src);
+		}
+	}
+
+	op = writeSequence(op, anchor, end - anchor, 0, 0);
+	return op - dst;
+}
+
+size_t lzDecompress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity)
+{
+	const unsigned char* ip = src;
+	const unsigned char* end = src + size;
+	unsigned char* op = dst;
+	unsigned char* op_end = dst + capacity;
+
+	while (ip < end)
+	{
+		unsigned int token = *ip++;
+
+		size_t num_literals = token >> 4;
+		if (num_literals == 15)
+		{
+			unsigned char b;
+			do {
+				if (ip >= end) return 0;
+				b = *ip++;
+				num_literals += b;
+			} while (b == 255);
+		}
+		if (num_literals > (size_t)(end - ip) || num_literals > (size_t)(op_end - op))
+			return 0;
+		memcpy(op, ip, num_literals);
+		ip += num_literals;
+		op += num_literals;
+
+		if (ip == end)
+			break; //last sequence has no match
+
+		if (end - ip < 2)
+			return 0;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return 0;
+
+		size_t match_length = (token & 15);
+		if (match_length == 15)
+		{
+			unsigned char b;
+			do {
+				if (ip >= end) return 0;
+				b = *ip++;
+				match_length += b;
+			} while (b == 255);
+		}
+		match_length += LZ_MIN_MATCH;
+		if (match_length > (size_t)(op_end - op))
+			return 0;
+
+		//byte by byte when the match overlaps what it is writing
+		const unsigned char* match = op - offset;
+		if (offset >= match_length)
+			memcpy(op, match, match_length);
+		else
+			for (size_t i = 0; i < match_length; i++)
+				op[i] = match[i];
+		op += match_length;
+	}
+
+	return op - dst;
+}
@@ -0,0 +1,20 @@
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+/*
+Small LZ77 block compressor with the LZ4 block layout (token, literals, 16 bit offset, match length).
+Fast to decode, meant for chunks of volumes; there is no frame nor checksum, sizes are stored by the caller.
+*/
+
+#include <cstddef>
+
+//worst case size of the compressed data (incompressible input)
+size_t lzCompressBound(size_t size);
+
+//returns the compressed size, 0 if dst is too small
+size_t lzCompress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity);
+
+//returns the decompressed size, 0 if the data is corrupted or doesn't fit in capacity
+size_t lzDecompress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity);
+
+#endif
@@ -0,0 +1,152 @@
+#include "mappedfile.h"
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#define ADVICE_SEQUENTIAL 0
+#define ADVICE_WILLNEED 1
+#define ADVICE_DONTNEED 2
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+#ifdef WIN32
+	file_handle = NULL;
+	mapping_handle = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	//PAGE_WRITECOPY + FILE_MAP_COPY gives private pages when written
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (view == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	data = (unsigned char*)view;
+	size = (size_t)file_size.QuadPart;
+#else
+	int file = ::open(filename, O_RDONLY);
+	if (file == -1)
+		return false;
+
+	struct stat stbuffer;
+	if (fstat(file, &stbuffer) != 0 || stbuffer.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	//MAP_PRIVATE + PROT_WRITE gives private pages when written
+	void* view = mmap(NULL, (size_t)stbuffer.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(file);
+		return false;
+	}
+
+	fd = file;
+	data = (unsigned char*)view;
+	size = (size_t)stbuffer.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+	mapping_handle = file_handle = NULL;
+#else
+	munmap(data, size);
+	::close(fd);
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+}
+
+void MappedFile::adviseSequential(size_t offset, size_t length)
+{
+	advise(offset, length, ADVICE_SEQUENTIAL);
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t length)
+{
+	advise(offset, length, ADVICE_WILLNEED);
+}
+
+void MappedFile::adviseDontNeed(size_t offset, size_t length)
+{
+	advise(offset, length, ADVICE_DONTNEED);
+}
+
+void MappedFile::advise(size_t offset, size_t length, int advice)
+{
+	if (!data || offset >= size)
+		return;
+	if (length == 0 || offset + length > size)
+		length = size - offset;
+
+#ifdef WIN32
+	//windows only has the hint given when opening the file (FILE_FLAG_SEQUENTIAL_SCAN)
+#else
+	//madvise needs a page aligned address
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = offset - (offset % page);
+	length += offset - start;
+
+	int flag = MADV_SEQUENTIAL;
+	if (advice == ADVICE_WILLNEED)
+		flag = MADV_WILLNEED;
+	else if (advice == ADVICE_DONTNEED)
+		flag = MADV_DONTNEED;
+	madvise(data + start, length, flag);
+#endif
+}
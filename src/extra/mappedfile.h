@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+/*
+Maps a whole file in memory (mmap in linux/mac, MapViewOfFile in windows) so the
+OS pages the content on demand instead of reading it all with fread.
+The mapping is private (copy on write): writing to the pages never touches the file.
+*/
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	unsigned char* data;	//start of the mapping, NULL if not mapped
+	size_t size;			//bytes of the file
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return data != NULL; }
+
+	//hints for the OS, offsets are relative to the start of the file
+	void adviseSequential(size_t offset = 0, size_t length = 0);
+	void adviseWillNeed(size_t offset = 0, size_t length = 0);
+	void adviseDontNeed(size_t offset = 0, size_t length = 0);
+
+private:
+#ifdef WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int fd;
+#endif
+	void advise(size_t offset, size_t length, int advice);
+};
+
+#endif
@@ -0,0 +1,346 @@
+#include "objparser.h"
+#include "mappedfile.h"
+#include "../threadpool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <atomic>
+#include <algorithm>
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#define OBJ_CHUNK_SIZE (1 << 20)
+
+//face corner as written in the file, before knowing how many elements the previous chunks have
+struct sOBJCorner {
+	int index[3];			//position, uv, normal (0 based). Relative to the start of the chunk for negative indices
+	unsigned char flags;	//bit i: index[i] is present, bit i + 3: index[i] is relative
+};
+
+struct sOBJChunk {
+	const char* begin;
+	const char* end;
+	std::vector<float> positions;
+	std::vector<float> uvs;
+	std::vector<float> normals;
+	std::vector<sOBJCorner> corners; //3 per triangle
+};
+
+//global 0 based indices of a corner, -1 if missing
+struct sOBJIndices {
+	int position;
+	int uv;
+	int normal;
+};
+
+static inline const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static inline const char* skipToken(const char* p, const char* end)
+{
+	while (p < end && *p > ' ')
+		p++;
+	return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end)
+{
+	while (p < end && *p != '\n')
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+static inline const char* parseFloat(const char* p, const char* end, float& value)
+{
+	p = skipSpaces(p, end);
+	if (p < end && *p == '+')
+		p++;
+#if defined(__cpp_lib_to_chars)
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+	{
+		value = 0.0f;
+		return skipToken(p, end);
+	}
+	return result.ptr;
+#else
+	//the text is not null terminated (it may be the end of a mapping)
+	char buffer[64];
+	int count = 0;
+	while (p < end && count < 63 && *p > ' ')
+		buffer[count++] = *p++;
+	buffer[count] = 0;
+	value = (float)strtod(buffer, NULL);
+	return skipToken(p, end);
+#endif
+}
+
+static inline const char* parseInt(const char* p, const char* end, int& value, bool& valid)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	long long v = 0;
+	valid = false;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		v = std::min(v * 10 + (*p++ - '0'), (long long)INT_MAX);
+		valid = true;
+	}
+	value = negative ? -(int)v : (int)v;
+	return p;
+}
+
+static void parseChunk(sOBJChunk& chunk)
+{
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	std::vector<sOBJCorner> polygon;
+	float x, y, z;
+
+	while (p < end)
+	{
+		p = skipSpaces(p, end);
+		size_t left = end - p;
+		if (left > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p = parseFloat(p + 1, end, x);
+			p = parseFloat(p, end, y);
+			p = parseFloat(p, end, z);
+			chunk.positions.push_back(x);
+			chunk.positions.push_back(y);
+			chunk.positions.push_back(z);
+		}
+		else if (left > 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			p = parseFloat(p + 2, end, x);
+			p = parseFloat(p, end, y);
+			chunk.uvs.push_back(x);
+			chunk.uvs.push_back(y);
+		}
+		else if (left > 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+		{
+			p = parseFloat(p + 2, end, x);
+			p = parseFloat(p, end, y);
+			p = parseFloat(p, end, z);
+			chunk.normals.push_back(x);
+			chunk.normals.push_back(y);
+			chunk.normals.push_back(z);
+		}
+		else if (left > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			//corners: v, v/vt, v//vn or v/vt/vn, any number of them
+			polygon.clear();
+			p++;
+			while (true)
+			{
+				p = skipSpaces(p, end);
+				if (p >= end || *p == '\n' || *p == '\r' || *p == '#')
+					break;
+
+				sOBJCorner corner;
+				memset(&corner, 0, sizeof(corner));
+				for (int k = 0; k < 3; k++)
+				{
+					if (k > 0)
+					{
+						if (p < end && *p == '/')
+							p++;
+						else
+							break;
+					}
+					int value;
+					bool valid;
+					p = parseInt(p, end, value, valid);
+					if (!valid || value == 0)
+						continue;
+					if (value > 0)
+					{
+						corner.index[k] = value - 1;
+						corner.flags |= 1 << k;
+					}
+					else
+					{
+						//-1 is the last element defined before this line
+						size_t count = k == 0 ? chunk.positions.size() / 3 : (k == 1 ? chunk.uvs.size() / 2 : chunk.normals.size() / 3);
+						corner.index[k] = (int)count + value;
+						corner.flags |= (1 << k) | (8 << k);
+					}
+				}
+				p = skipToken(p, end);
+				if (corner.flags & 1)
+					polygon.push_back(corner);
+			}
+
+			for (size_t i = 2; i < polygon.size(); ++i)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i - 1]);
+				chunk.corners.push_back(polygon[i]);
+			}
+		}
+		p = skipLine(p, end);
+	}
+}
+
+bool parseOBJ(const char* filename, sOBJMesh* mesh)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		mesh->error = "cannot open the file";
+		return false;
+	}
+	file.adviseSequential();
+	return parseOBJ((const char*)file.data, file.size, mesh);
+}
+
+bool parseOBJ(const char* text, size_t size, sOBJMesh* mesh)
+{
+	mesh->positions.clear();
+	mesh->uvs.clear();
+	mesh->normals.clear();
+	mesh->indices.clear();
+	mesh->error.clear();
+
+	//chunks end after a line break so no line is split
+	std::vector<sOBJChunk> chunks;
+	const char* end = text + size;
+	const char* p = text;
+	while (p < end)
+	{
+		sOBJChunk chunk;
+		chunk.begin = p;
+		chunk.end = (size_t)(end - p) > OBJ_CHUNK_SIZE ? skipLine(p + OBJ_CHUNK_SIZE, end) : end;
+		chunks.push_back(chunk);
+		p = chunk.end;
+	}
+
+	parallelFor(0, (int)chunks.size(), [&](int c0, int c1) {
+		for (int c = c0; c < c1; c++)
+			parseChunk(chunks[c]);
+	});
+
+	//where the elements of every chunk start in the whole file
+	std::vector<size_t> position_offset(chunks.size()), uv_offset(chunks.size()), normal_offset(chunks.size()), corner_offset(chunks.size());
+	size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_corners = 0;
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		position_offset[c] = num_positions;
+		uv_offset[c] = num_uvs;
+		normal_offset[c] = num_normals;
+		corner_offset[c] = num_corners;
+		num_positions += chunks[c].positions.size() / 3;
+		num_uvs += chunks[c].uvs.size() / 2;
+		num_normals += chunks[c].normals.size() / 3;
+		num_corners += chunks[c].corners.size();
+	}
+	if (!num_corners)
+	{
+		mesh->error = "no faces";
+		return false;
+	}
+
+	//merge the chunks and make all the indices absolute
+	std::vector<float> positions(num_positions * 3), uvs(num_uvs * 2), normals(num_normals * 3);
+	std::vector<sOBJIndices> corners(num_corners);
+	std::atomic<bool> out_of_range(false), has_uvs(false), has_normals(false);
+	parallelFor(0, (int)chunks.size(), [&](int c0, int c1) {
+		for (int c = c0; c < c1; c++) {
+			sOBJChunk& chunk = chunks[c];
+			if (chunk.positions.size())
+				memcpy(&positions[position_offset[c] * 3], &chunk.positions[0], chunk.positions.size() * sizeof(float));
+			if (chunk.uvs.size())
+				memcpy(&uvs[uv_offset[c] * 2], &chunk.uvs[0], chunk.uvs.size() * sizeof(float));
+			if (chunk.normals.size())
+				memcpy(&normals[normal_offset[c] * 3], &chunk.normals[0], chunk.normals.size() * sizeof(float));
+
+			const size_t offsets[3] = { position_offset[c], uv_offset[c], normal_offset[c] };
+			const size_t counts[3] = { num_positions, num_uvs, num_normals };
+			bool uses_uvs = false, uses_normals = false;
+			for (size_t i = 0; i < chunk.corners.size(); ++i) {
+				const sOBJCorner& corner = chunk.corners[i];
+				int resolved[3];
+				for (int k = 0; k < 3; k++) {
+					resolved[k] = -1;
+					if (!(corner.flags & (1 << k)))
+						continue;
+					long long index = corner.index[k] + ((corner.flags & (8 << k)) ? (long long)offsets[k] : 0);
+					if (index < 0 || index >= (long long)counts[k])
+						out_of_range = true;
+					else
+						resolved[k] = (int)index;
+				}
+				sOBJIndices& dst = corners[corner_offset[c] + i];
+				dst.position = resolved[0];
+				dst.uv = resolved[1];
+				dst.normal = resolved[2];
+				uses_uvs |= resolved[1] != -1;
+				uses_normals |= resolved[2] != -1;
+			}
+			if (uses_uvs)
+				has_uvs = true;
+			if (uses_normals)
+				has_normals = true;
+			std::vector<float>().swap(chunk.positions);
+			std::vector<float>().swap(chunk.uvs);
+			std::vector<float>().swap(chunk.normals);
+			std::vector<sOBJCorner>().swap(chunk.corners);
+		}
+	});
+	if (out_of_range)
+	{
+		mesh->error = "face index out of range";
+		return false;
+	}
+
+	//one vertex per different position/uv/normal, the vertices of every position are chained (usually one or two)
+	std::vector<int> first_vertex(num_positions, -1);
+	std::vector<int> next_vertex;
+	std::vector<sOBJIndices> vertices;
+	vertices.reserve(num_positions);
+	next_vertex.reserve(num_positions);
+	mesh->indices.resize(num_corners);
+	for (size_t i = 0; i < num_corners; ++i)
+	{
+		const sOBJIndices& corner = corners[i];
+		int v = first_vertex[corner.position];
+		while (v != -1 && (vertices[v].uv != corner.uv || vertices[v].normal != corner.normal))
+			v = next_vertex[v];
+		if (v == -1)
+		{
+			v = (int)vertices.size();
+			vertices.push_back(corner);
+			next_vertex.push_back(first_vertex[corner.position]);
+			first_vertex[corner.position] = v;
+		}
+		mesh->indices[i] = v;
+	}
+
+	size_t num_vertices = vertices.size();
+	const bool with_uvs = has_uvs, with_normals = has_normals;
+	mesh->positions.resize(num_vertices * 3);
+	if (with_uvs)
+		mesh->uvs.resize(num_vertices * 2, 0.0f);
+	if (with_normals)
+		mesh->normals.resize(num_vertices * 3, 0.0f);
+	parallelFor(0, (int)num_vertices, [&](int v0, int v1) {
+		for (int v = v0; v < v1; v++) {
+			const sOBJIndices& vertex = vertices[v];
+			memcpy(&mesh->positions[v * 3], &positions[vertex.position * 3], 3 * sizeof(float));
+			if (with_uvs && vertex.uv != -1)
+				memcpy(&mesh->uvs[v * 2], &uvs[vertex.uv * 2], 2 * sizeof(float));
+			if (with_normals && vertex.normal != -1)
+				memcpy(&mesh->normals[v * 3], &normals[vertex.normal * 3], 3 * sizeof(float));
+		}
+	}, 4096);
+	return true;
+}
@@ -0,0 +1,22 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <string>
+#include <vector>
+
+//Indexed content of an OBJ: one vertex per different position/uv/normal combination used by the faces, polygons become triangle fans.
+//uvs and normals are empty when no face references them (and zero for the vertices without them)
+struct sOBJMesh {
+	std::vector<float> positions;		//xyz per vertex
+	std::vector<float> uvs;				//uv per vertex
+	std::vector<float> normals;			//xyz per vertex
+	std::vector<unsigned int> indices;	//3 per triangle
+	std::string error;					//why the parse failed
+};
+
+//The text is split in chunks on line boundaries that are parsed in the thread pool, negative (relative) indices are supported.
+//Elements other than v, vt, vn and f are ignored
+bool parseOBJ(const char* filename, sOBJMesh* mesh); //the file is mapped, not read
+bool parseOBJ(const char* text, size_t size, sOBJMesh* mesh);
+
+#endif
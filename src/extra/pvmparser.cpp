@@ -1,7 +1,14 @@
 
 #include "pvmparser.h"
+#include "../threadpool.h"
 
 #include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #define DDS_MAXSTR (256)
 
@@ -12,7 +19,10 @@
 
 #define DDS_ISINTEL (*((unsigned char *)(&DDS_INTEL)+1)==0)
 
-// read from a RAW file
+// the DDS bit reader reads whole words, buffers get zeros up to a multiple of 4 plus one word
+#define DDS_PADDED(size) (4 * (((size) + 3) / 4) + 4)
+
+// read from a RAW file, in blocks when the size can't be known. The buffer is padded with zeros (DDS_PADDED)
 unsigned char *readfiled(FILE *file, long long *bytes, const long long blocksize = 1 << 20)
 {
 	unsigned char *data, *data2;
@@ -21,6 +31,29 @@ unsigned char *readfiled(FILE *file, long long *bytes, const long long blocksize
 	data = NULL;
 	*bytes = cnt = 0;
 
+	// preallocate the remaining size of the file in a single read
+#ifdef _WIN32
+	long long start = _ftelli64(file);
+	if (start >= 0 && _fseeki64(file, 0, SEEK_END) == 0)
+	{
+		long long end = _ftelli64(file);
+		_fseeki64(file, start, SEEK_SET);
+#else
+	long long start = ftello(file);
+	if (start >= 0 && fseeko(file, 0, SEEK_END) == 0)
+	{
+		long long end = ftello(file);
+		fseeko(file, start, SEEK_SET);
+#endif
+		if (end <= start) return(NULL);
+		if ((data = (unsigned char *)malloc(DDS_PADDED(end - start))) == NULL) return(NULL);
+		cnt = fread(data, 1, end - start, file);
+		if (cnt != end - start) { free(data); return(NULL); }
+		memset(data + cnt, 0, DDS_PADDED(cnt) - cnt);
+		*bytes = cnt;
+		return(data);
+	}
+
 	do
 	{
 		if (data == NULL)
@@ -43,21 +76,26 @@ unsigned char *readfiled(FILE *file, long long *bytes, const long long blocksize
 		return(NULL);
 	}
 
-	if ((data2 = (unsigned char *)realloc(data, cnt)) == NULL) { free(data); return(NULL); }
+	if ((data2 = (unsigned char *)realloc(data, DDS_PADDED(cnt))) == NULL) { free(data); return(NULL); }
 	else data = data2;
+	memset(data + cnt, 0, DDS_PADDED(cnt) - cnt);
 
 	*bytes = cnt;
 
 	return(data);
 }
 
-unsigned char *DDS_cache;
-unsigned int DDS_cachepos, DDS_cachesize;
+// bit reader state, one per decode so several streams can be decoded at the same time
+struct DDS_state
+{
+	unsigned char *cache;
+	unsigned int cachepos, cachesize;
 
-unsigned int DDS_buffer;
-unsigned int DDS_bufsize;
+	unsigned int buffer;
+	unsigned int bufsize;
+};
 
-unsigned short int DDS_INTEL = 1;
+static const unsigned short int DDS_INTEL = 1;
 
 
 unsigned int DDS_shiftl(const unsigned int value, const unsigned int bits)
@@ -83,63 +121,52 @@ void DDS_swap4(char *x)
 	x[3] = a;
 }
 
-void DDS_initbuffer()
+void DDS_initbuffer(DDS_state *state)
 {
-	DDS_buffer = 0;
-	DDS_bufsize = 0;
+	state->buffer = 0;
+	state->bufsize = 0;
 }
 
-void DDS_clearbits()
+void DDS_clearbits(DDS_state *state)
 {
-	DDS_cache = NULL;
-	DDS_cachepos = 0;
-	DDS_cachesize = 0;
+	state->cache = NULL;
+	state->cachepos = 0;
+	state->cachesize = 0;
 }
 
-void DDS_savebits(unsigned char **data, unsigned int *size)
+// the chunk is read in place, padded with zeros up to a multiple of 4 (the caller keeps it alive)
+void DDS_loadbits(DDS_state *state, unsigned char *data, unsigned int size)
 {
-	*data = DDS_cache;
-	*size = DDS_cachepos;
-}
-
-void DDS_loadbits(unsigned char *data, unsigned int size)
-{
-	DDS_cache = data;
-	DDS_cachesize = size;
-
-	if ((DDS_cache = (unsigned char *)realloc(DDS_cache, DDS_cachesize + 4)) == NULL) return;
-	*((unsigned int *)&DDS_cache[DDS_cachesize]) = 0;
-
-	DDS_cachesize = 4 * ((DDS_cachesize + 3) / 4);
-	if ((DDS_cache = (unsigned char *)realloc(DDS_cache, DDS_cachesize)) == NULL) return;
+	state->cache = data;
+	state->cachesize = size;
 }
 
-unsigned int DDS_readbits(unsigned int bits)
+unsigned int DDS_readbits(DDS_state *state, unsigned int bits)
 {
 	unsigned int value;
 
-	if (bits < DDS_bufsize)
+	if (bits < state->bufsize)
 	{
-		DDS_bufsize -= bits;
-		value = DDS_shiftr(DDS_buffer, DDS_bufsize);
+		state->bufsize -= bits;
+		value = DDS_shiftr(state->buffer, state->bufsize);
 	}
 	else
 	{
-		value = DDS_shiftl(DDS_buffer, bits - DDS_bufsize);
+		value = DDS_shiftl(state->buffer, bits - state->bufsize);
 
-		if (DDS_cachepos >= DDS_cachesize) DDS_buffer = 0;
+		if (state->cachepos >= state->cachesize) state->buffer = 0;
 		else
 		{
-			DDS_buffer = *((unsigned int *)&DDS_cache[DDS_cachepos]);
-			if (DDS_ISINTEL) DDS_swap4((char *)&DDS_buffer);
-			DDS_cachepos += 4;
+			memcpy(&state->buffer, &state->cache[state->cachepos], 4);
+			if (DDS_ISINTEL) DDS_swap4((char *)&state->buffer);
+			state->cachepos += 4;
 		}
 
-		DDS_bufsize += 32 - bits;
-		value |= DDS_shiftr(DDS_buffer, DDS_bufsize);
+		state->bufsize += 32 - bits;
+		value |= DDS_shiftr(state->buffer, state->bufsize);
 	}
 
-	DDS_buffer &= DDS_shiftl(1, DDS_bufsize) - 1;
+	state->buffer &= DDS_shiftl(1, state->bufsize) - 1;
 
 	return(value);
 }
@@ -154,14 +181,30 @@ int DDS_decode(int bits)
 	return(bits >= 1 ? bits + 1 : bits);
 }
 
-// deinterleave a byte stream
+// (de)interleave bytes [begin, end) of a stream of skip interleaved streams, src and dst can't overlap
+static void DDS_deinterleaverange(const unsigned char *src, unsigned char *dst, unsigned int bytes,
+	unsigned int skip, bool restore, unsigned int begin, unsigned int end)
+{
+	// stream i starts after the elements of the previous streams
+	unsigned int offsets[8];
+	for (unsigned int i = 0, offset = 0; i < skip; i++)
+	{
+		offsets[i] = offset;
+		offset += (bytes - i + skip - 1) / skip;
+	}
+
+	if (!restore)
+		for (unsigned int j = begin; j < end; j++) dst[offsets[j % skip] + j / skip] = src[j];
+	else
+		for (unsigned int j = begin; j < end; j++) dst[j] = src[offsets[j % skip] + j / skip];
+}
+
+// deinterleave a byte stream, blocks (or ranges of the single block) are processed in parallel
 void DDS_deinterleave(unsigned char *data, unsigned int bytes,
 	unsigned int skip, unsigned int block = 0,
 	bool restore = false)
 {
-	unsigned int i, j, k;
-
-	unsigned char *data2, *ptr;
+	unsigned char *data2;
 
 	if (skip <= 1) return;
 
@@ -169,52 +212,36 @@ void DDS_deinterleave(unsigned char *data, unsigned int bytes,
 	{
 		if ((data2 = (unsigned char *)malloc(bytes)) == NULL) return;
 
-		if (!restore)
-			for (ptr = data2, i = 0; i < skip; i++)
-				for (j = i; j < bytes; j += skip) *ptr++ = data[j];
-		else
-			for (ptr = data, i = 0; i < skip; i++)
-				for (j = i; j < bytes; j += skip) data2[j] = *ptr++;
+		parallelFor(0, (bytes + DDS_BLOCKSIZE - 1) / DDS_BLOCKSIZE, [&](int first, int last) {
+			unsigned int begin = first * DDS_BLOCKSIZE;
+			unsigned int end = (unsigned int)last * DDS_BLOCKSIZE < bytes ? last * DDS_BLOCKSIZE : bytes;
+			DDS_deinterleaverange(data, data2, bytes, skip, restore, begin, end);
+		});
 
 		memcpy(data, data2, bytes);
+		free(data2);
 	}
 	else
 	{
-		if ((data2 = (unsigned char *)malloc((bytes < skip*block) ? bytes : skip * block)) == NULL) return;
-
-		if (!restore)
-		{
-			for (k = 0; k < bytes / skip / block; k++)
-			{
-				for (ptr = data2, i = 0; i < skip; i++)
-					for (j = i; j < skip*block; j += skip) *ptr++ = data[k*skip*block + j];
-
-				memcpy(data + k * skip*block, data2, skip*block);
-			}
+		// every block of skip*block bytes (and the remainder) is independent
+		unsigned int blocksize = skip * block;
+		unsigned int numblocks = (bytes + blocksize - 1) / blocksize;
 
-			for (ptr = data2, i = 0; i < skip; i++)
-				for (j = i; j < bytes - k * skip*block; j += skip) *ptr++ = data[k*skip*block + j];
+		parallelFor(0, numblocks, [&](int first, int last) {
+			unsigned char *tmp = (unsigned char *)malloc((bytes < blocksize) ? bytes : blocksize);
+			if (tmp == NULL) return;
 
-			memcpy(data + k * skip*block, data2, bytes - k * skip*block);
-		}
-		else
-		{
-			for (k = 0; k < bytes / skip / block; k++)
+			for (int k = first; k < last; k++)
 			{
-				for (ptr = data + k * skip*block, i = 0; i < skip; i++)
-					for (j = i; j < skip*block; j += skip) data2[j] = *ptr++;
-
-				memcpy(data + k * skip*block, data2, skip*block);
+				unsigned char *ptr = data + (size_t)k * blocksize;
+				unsigned int size = (bytes - (size_t)k * blocksize < blocksize) ? bytes - k * blocksize : blocksize;
+				DDS_deinterleaverange(ptr, tmp, size, skip, restore, 0, size);
+				memcpy(ptr, tmp, size);
 			}
 
-			for (ptr = data + k * skip*block, i = 0; i < skip; i++)
-				for (j = i; j < bytes - k * skip*block; j += skip) data2[j] = *ptr++;
-
-			memcpy(data + k * skip*block, data2, bytes - k * skip*block);
-		}
+			free(tmp);
+		});
 	}
-
-	free(data2);
 }
 
 // interleave a byte stream
@@ -234,51 +261,53 @@ void DDS_decode(unsigned char *chunk, unsigned int size,
 
 	unsigned char *ptr1, *ptr2;
 
-	unsigned int cnt, cnt1, cnt2;
+	unsigned int cnt, cnt1, cnt2, capacity;
 	int bits, act;
 
-	DDS_initbuffer();
+	DDS_state state;
+	DDS_initbuffer(&state);
+	DDS_clearbits(&state);
+	DDS_loadbits(&state, chunk, size);
 
-	DDS_clearbits();
-	DDS_loadbits(chunk, size);
+	*data = NULL;
+	*bytes = 0;
 
-	skip = DDS_readbits(2) + 1;
-	strip = DDS_readbits(16) + 1;
+	skip = DDS_readbits(&state, 2) + 1;
+	strip = DDS_readbits(&state, 16) + 1;
 
-	ptr1 = ptr2 = NULL;
+	// volumes compress a few times, start with a guess and grow geometrically
+	capacity = size < (1u << 29) ? 4 * size + DDS_BLOCKSIZE : size;
+	if ((ptr1 = (unsigned char *)malloc(capacity)) == NULL) return;
+	ptr2 = ptr1;
 	cnt = act = 0;
 
-	while ((cnt1 = DDS_readbits(DDS_RL)) != 0)
+	while ((cnt1 = DDS_readbits(&state, DDS_RL)) != 0)
 	{
-		bits = DDS_decode(DDS_readbits(3));
+		bits = DDS_decode(DDS_readbits(&state, 3));
+
+		if (cnt + cnt1 > capacity)
+		{
+			unsigned char *grown;
+			capacity = (capacity > (1u << 31)) ? 0xFFFFFFFFu : 2 * capacity;
+			if ((grown = (unsigned char *)realloc(ptr1, capacity)) == NULL) { free(ptr1); return; }
+			ptr1 = grown;
+			ptr2 = &ptr1[cnt];
+		}
 
 		for (cnt2 = 0; cnt2 < cnt1; cnt2++)
 		{
-			if (strip == 1 || cnt <= strip) act += DDS_readbits(bits) - (1 << bits) / 2;
-			else act += *(ptr2 - strip) - *(ptr2 - strip - 1) + DDS_readbits(bits) - (1 << bits) / 2;
+			if (strip == 1 || cnt <= strip) act += DDS_readbits(&state, bits) - (1 << bits) / 2;
+			else act += *(ptr2 - strip) - *(ptr2 - strip - 1) + DDS_readbits(&state, bits) - (1 << bits) / 2;
 
 			while (act < 0) act += 256;
 			while (act > 255) act -= 256;
 
-			if ((cnt&(DDS_BLOCKSIZE - 1)) == 0)
-				if (ptr1 == NULL)
-				{
-					if ((ptr1 = (unsigned char *)malloc(DDS_BLOCKSIZE)) == NULL) return;
-					ptr2 = ptr1;
-				}
-				else
-				{
-					if ((ptr1 = (unsigned char *)realloc(ptr1, cnt + DDS_BLOCKSIZE)) == NULL) return;
-					ptr2 = &ptr1[cnt];
-				}
-
 			*ptr2++ = act;
 			cnt++;
 		}
 	}
 
-	if (ptr1 != NULL)
-		if ((ptr1 = (unsigned char *)realloc(ptr1, cnt)) == NULL) return;
+	if (cnt == 0) { free(ptr1); return; }
 
 	DDS_interleave(ptr1, cnt, skip, block);
 
@@ -287,60 +316,67 @@ void DDS_decode(unsigned char *chunk, unsigned int size,
 }
 
 
-unsigned char *parsePVM(const char *filename, unsigned int *width, unsigned int *height, unsigned int *depth, unsigned int *components, float *scalex, float *scaley, float *scalez) {
-	unsigned int version = 1;
-
+unsigned char *readPVMFile(const char *filename, long long *size)
+{
 	FILE* file;
+	unsigned char *data;
+
 	if ((file = fopen(filename, "rb")) == NULL) return(NULL);
+	data = readfiled(file, size);
+	fclose(file);
 
-	char type[4];
-	unsigned char *volume, *chunk, *data, *ptr;
-	long long size;
-	unsigned int bytes, numc;
+	return(data);
+}
 
+bool decodePVM(unsigned char *file_data, long long size, sPVMVolume *volume)
+{
+	unsigned int version = 1;
+	unsigned char *data, *ptr;
+	unsigned int bytes, numc;
+	unsigned int width, height, depth;
 	float sx = 1.0f, sy = 1.0f, sz = 1.0f;
-	unsigned int len1 = 0, len2 = 0, len3 = 0, len4 = 0;
 
-	type[3] = '\0';
-	fread(type, 1, 3, file);
+	volume->data = NULL;
+	if (file_data == NULL) return false;
 
-	if (strcmp(type, "PVM") == 0) {
-		rewind(file);
-		data = readfiled(file, &size);
-		fclose(file);
+	if (size >= 3 && strncmp((char *)file_data, "PVM", 3) == 0)
+	{
+		data = file_data;
+		bytes = (unsigned int)size;
 	}
-	else if(strcmp(type, "DDS") == 0) {
-		fgetc(file); //skip space
-		fread(type, 1, 3, file);
-		if (strcmp(type, "v3d") == 0) version = 0;
-		else if (strcmp(type, "v3e") == 0) version = DDS_INTERLEAVE;
-		else {
-			fclose(file);
-			return NULL;
-		}
-		fgetc(file); //skip \n
-		chunk = readfiled(file, &size);
-		fclose(file);
-		DDS_decode(chunk, (unsigned int)size, &data, &bytes, version);
-		free(chunk);
+	else if (size >= 8 && (strncmp((char *)file_data, "DDS v3d\n", 8) == 0 || strncmp((char *)file_data, "DDS v3e\n", 8) == 0))
+	{
+		if (file_data[6] == 'e') version = DDS_INTERLEAVE;
+		else version = 0;
+
+		// decoded in place, readPVMFile already padded the file with zeros for the word reads
+		long long chunk_size = size - 8;
+		DDS_decode(file_data + 8, 4 * (unsigned int)((chunk_size + 3) / 4), &data, &bytes, version);
+		free(file_data);
+		if (data == NULL) return false;
 	}
-	else {
-		fclose(file);
-		return NULL;
+	else
+	{
+		free(file_data);
+		return false;
 	}
 
-	if ((data = (unsigned char *)realloc(data, bytes + 1)) == NULL) return NULL;
+	if ((ptr = (unsigned char *)realloc(data, bytes + 1)) == NULL) { free(data); return false; }
+	data = ptr;
 	data[bytes] = '\0';
 
 	if (strncmp((char *)data, "PVM\n", 4) != 0)
 	{
 		if (strncmp((char *)data, "PVM2\n", 5) == 0) version = 2;
 		else if (strncmp((char *)data, "PVM3\n", 5) == 0) version = 3;
-		else return(NULL);
+		else { free(data); return false; }
 
 		ptr = &data[5];
-		if (sscanf((char *)ptr, "%d %d %d\n%g %g %g\n", width, height, depth, &sx, &sy, &sz) != 6) return NULL;
-		if (*width < 1 || *height < 1 || *depth < 1 || sx <= 0.0f || sy <= 0.0f || sz <= 0.0f) return NULL;
+		if (sscanf((char *)ptr, "%d %d %d\n%g %g %g\n", &width, &height, &depth, &sx, &sy, &sz) != 6 ||
+			width < 1 || height < 1 || depth < 1 || sx <= 0.0f || sy <= 0.0f || sz <= 0.0f) {
+			free(data);
+			return false;
+		}
 		ptr = (unsigned char *)strchr((char *)ptr, '\n') + 1;
 	}
 	else
@@ -349,34 +385,95 @@ unsigned char *parsePVM(const char *filename, unsigned int *width, unsigned int
 		while (*ptr == '#')
 			while (*ptr++ != '\n');
 
-		if (sscanf((char *)ptr, "%d %d %d\n", width, height, depth) != 3) return NULL;
-		if (*width < 1 || *height < 1 || *depth < 1) return NULL;
+		if (sscanf((char *)ptr, "%d %d %d\n", &width, &height, &depth) != 3 || width < 1 || height < 1 || depth < 1) {
+			free(data);
+			return false;
+		}
 	}
 
+	ptr = (unsigned char *)strchr((char *)ptr, '\n') + 1;
+	if (sscanf((char *)ptr, "%d\n", &numc) != 1 || numc < 1) { free(data); return false; }
+
+	// voxels are followed by the description strings in version 3, they are not kept
+	ptr = (unsigned char *)strchr((char *)ptr, '\n') + 1;
+	size_t voxels_size = (size_t)width * height * depth * numc;
+	if (ptr + voxels_size > data + bytes) { free(data); return false; }
+
+	volume->data = new unsigned char[voxels_size];
+	memcpy(volume->data, ptr, voxels_size);
+	free(data);
+
+	volume->width = width;
+	volume->height = height;
+	volume->depth = depth;
+	volume->components = numc;
+	volume->scalex = sx;
+	volume->scaley = sy;
+	volume->scalez = sz;
+	return true;
+}
+
+unsigned char *parsePVM(const char *filename, unsigned int *width, unsigned int *height, unsigned int *depth, unsigned int *components, float *scalex, float *scaley, float *scalez) {
+	long long size;
+	sPVMVolume volume;
+
+	unsigned char *file_data = readPVMFile(filename, &size);
+	if (!decodePVM(file_data, size, &volume)) return NULL;
+	if (components == NULL && volume.components != 1) { delete[] volume.data; return NULL; }
+
+	*width = volume.width;
+	*height = volume.height;
+	*depth = volume.depth;
+	if (components != NULL) *components = volume.components;
 	if (scalex != NULL && scaley != NULL && scalez != NULL)
 	{
-		*scalex = sx;
-		*scaley = sy;
-		*scalez = sz;
+		*scalex = volume.scalex;
+		*scaley = volume.scaley;
+		*scalez = volume.scalez;
 	}
+	return volume.data;
+}
 
-	ptr = (unsigned char *)strchr((char *)ptr, '\n') + 1;
-	if (sscanf((char *)ptr, "%d\n", &numc) != 1) return NULL;
-	if (numc < 1) return NULL;
+void parsePVMs(const std::vector<std::string>& filenames, std::vector<sPVMVolume>& volumes)
+{
+	volumes.assign(filenames.size(), sPVMVolume());
+	ThreadPool* pool = ThreadPool::getGlobal();
 
-	if (components != NULL) *components = numc;
-	else if (numc != 1) return NULL;
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t pending = 0;
 
-	ptr = (unsigned char *)strchr((char *)ptr, '\n') + 1;
-	if (version == 3) len1 = strlen((char *)(ptr + (*width)*(*height)*(*depth)*numc)) + 1;
-	if (version == 3) len2 = strlen((char *)(ptr + (*width)*(*height)*(*depth)*numc + len1)) + 1;
-	if (version == 3) len3 = strlen((char *)(ptr + (*width)*(*height)*(*depth)*numc + len1 + len2)) + 1;
-	if (version == 3) len4 = strlen((char *)(ptr + (*width)*(*height)*(*depth)*numc + len1 + len2 + len3)) + 1;
-	if ((volume = (unsigned char *)malloc((*width)*(*height)*(*depth)*numc + len1 + len2 + len3 + len4)) == NULL) return NULL;
-	if (data + bytes != ptr + (*width)*(*height)*(*depth)*numc + len1 + len2 + len3 + len4) return NULL;
-
-	memcpy(volume, ptr, (*width)*(*height)*(*depth)*numc + len1 + len2 + len3 + len4);
-	free(data);
+	for (size_t i = 0; i < filenames.size(); i++)
+	{
+		volumes[i].data = NULL;
 
-	return(volume);
-}
\ No newline at end of file
+		// the disk is read serially, decoding happens in the pool meanwhile
+		long long size = 0;
+		unsigned char *file_data = readPVMFile(filenames[i].c_str(), &size);
+		if (file_data == NULL) continue;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending++;
+		}
+		sPVMVolume* volume = &volumes[i];
+		pool->enqueue([file_data, size, volume, &mutex, &finished, &pending]() {
+			decodePVM(file_data, size, volume);
+			std::lock_guard<std::mutex> lock(mutex);
+			pending--;
+			finished.notify_all();
+		});
+	}
+
+	// help with the queue (the decodes also use parallelFor) until all of them are done
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (pending == 0) break;
+		}
+		if (pool->runPendingTask()) continue;
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait_for(lock, std::chrono::milliseconds(1), [&pending] { return pending == 0; });
+	}
+}
@@ -5,6 +5,29 @@
 Format and parse code by Stefan Roettger
 */
 
+#include <string>
+#include <vector>
+
+//Decoded PVM, data is allocated with new[] (the caller owns it) and components is the number of bytes per voxel (2 is 16 bits MSB first)
+struct sPVMVolume {
+	unsigned char* data;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int components;
+	float scalex;
+	float scaley;
+	float scalez;
+};
+
+//All of them are reentrant, several volumes can be parsed at the same time from different threads
 unsigned char* parsePVM(const char *filename, unsigned int *width, unsigned int *height, unsigned int *depth, unsigned int *components, float *scalex, float *scaley, float *scalez);
 
-#endif
\ No newline at end of file
+unsigned char* readPVMFile(const char* filename, long long* size); //raw file bytes (malloc, zero padded for decodePVM), NULL if it can't be read
+bool decodePVM(unsigned char* file_data, long long size, sPVMVolume* volume); //file_data as readPVMFile returns it (padded), it is freed
+
+//Reads the files one after the other while the ones already read are decoded in the thread pool.
+//volumes[i].data is NULL for the files that failed
+void parsePVMs(const std::vector<std::string>& filenames, std::vector<sPVMVolume>& volumes);
+
+#endif
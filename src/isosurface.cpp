@@ -0,0 +1,262 @@
+//Mesh::createIsosurface: marching tetrahedra over the voxel grid.
+//Every cube is split in the 6 tetrahedra around its main diagonal (same split in all cubes, so faces match),
+//z-slabs are processed in parallel and vertices on shared edges are merged into an indexed mesh.
+
+#include "mesh.h"
+#include "volume.h"
+#include "volumeview.h"
+#include "utils.h"
+#include "threadpool.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+//the 6 tetrahedra of a cube, corners as bits (1: +x, 2: +y, 4: +z)
+static const int tetrahedra[6][4] = {
+	{ 0, 1, 3, 7 }, { 0, 1, 5, 7 }, { 0, 2, 3, 7 },
+	{ 0, 2, 6, 7 }, { 0, 4, 5, 7 }, { 0, 4, 6, 7 }
+};
+
+//vertices and triangles of a slab of cubes, vertices are indexed by the grid edge they lie on
+struct sIsosurfaceSlab {
+	int z0, z1; //cube layers
+	std::unordered_map<unsigned long long, unsigned int> edge_vertex;
+	std::vector<unsigned long long> edges;
+	std::vector<Vector3> positions; //voxel space
+	std::vector<Vector3> normals;
+	std::vector<unsigned int> triangles; //local vertices
+	std::vector<int> owned_rank; //-1 for the vertices of the previous slab (bottom plane)
+	unsigned int owned_count;
+	unsigned int first_vertex;
+	unsigned int first_triangle;
+};
+
+template <typename T, int Channels>
+class IsosurfaceExtractor
+{
+public:
+	VolumeView<T, Channels> volume;
+	float isovalue;
+	Volume* cells;
+	unsigned int cell_size;
+	int w, h, d;
+
+	IsosurfaceExtractor(VolumeView<T, Channels> volume, float isovalue, Volume* cells, unsigned int cell_size) : volume(volume) {
+		this->isovalue = isovalue;
+		this->cells = cells;
+		this->cell_size = cell_size;
+		w = volume.width;
+		h = volume.height;
+		d = volume.depth;
+	}
+
+	inline float value(int x, int y, int z) const {
+		return volume.getClamped(x, y, z);
+	}
+
+	Vector3 gradient(int x, int y, int z) const {
+		return Vector3(value(x + 1, y, z) - value(x - 1, y, z), value(x, y + 1, z) - value(x, y - 1, z), value(x, y, z + 1) - value(x, y, z - 1));
+	}
+
+	//false if the macrocell of the cube can't contain the surface
+	bool cellMayCross(int x, int y, int z) const {
+		if (!cells)
+			return true;
+		const T* cell = (const T*)cells->data + ((x / cell_size) + (y / cell_size) * (size_t)cells->width + (z / cell_size) * (size_t)cells->width * cells->height) * 2;
+		return VoxelTraits<T>::toFloat(cell[0]) <= isovalue && VoxelTraits<T>::toFloat(cell[1]) >= isovalue;
+	}
+
+	unsigned int edgeVertex(sIsosurfaceSlab& slab, const int* pa, const int* pb, float va, float vb) {
+		//edges always go to +x, +y, +z (or their combinations) from the first corner
+		int code = (pb[0] - pa[0]) | ((pb[1] - pa[1]) << 1) | ((pb[2] - pa[2]) << 2);
+		unsigned long long key = ((unsigned long long)pa[0] + (unsigned long long)pa[1] * w + (unsigned long long)pa[2] * w * h) * 8 + code;
+
+		auto it = slab.edge_vertex.find(key);
+		if (it != slab.edge_vertex.end())
+			return it->second;
+
+		float t = (isovalue - va) / (vb - va);
+		Vector3 a((float)pa[0], (float)pa[1], (float)pa[2]);
+		Vector3 b((float)pb[0], (float)pb[1], (float)pb[2]);
+		Vector3 ga = gradient(pa[0], pa[1], pa[2]);
+		Vector3 gb = gradient(pb[0], pb[1], pb[2]);
+
+		unsigned int id = (unsigned int)slab.positions.size();
+		slab.positions.push_back(a + (b - a) * t);
+		slab.normals.push_back(ga + (gb - ga) * t);
+		slab.edges.push_back(key);
+		slab.edge_vertex[key] = id;
+		return id;
+	}
+
+	void addTriangle(sIsosurfaceSlab& slab, unsigned int a, unsigned int b, unsigned int c, const Vector3& outside) {
+		//winding so the face looks to the lower values
+		Vector3 n = (slab.positions[b] - slab.positions[a]).cross(slab.positions[c] - slab.positions[a]);
+		if (n.dot(outside) < 0.0f)
+			std::swap(b, c);
+		slab.triangles.push_back(a);
+		slab.triangles.push_back(b);
+		slab.triangles.push_back(c);
+	}
+
+	void polygonizeSlab(sIsosurfaceSlab& slab) {
+		int corners[8][3];
+		float values[8];
+
+		for (int z = slab.z0; z < slab.z1; z++)
+			for (int y = 0; y < h - 1; y++)
+				for (int x = 0; x < w - 1; x++) {
+					if (!cellMayCross(x, y, z))
+						continue;
+
+					int inside = 0;
+					for (int c = 0; c < 8; c++) {
+						corners[c][0] = x + (c & 1);
+						corners[c][1] = y + ((c >> 1) & 1);
+						corners[c][2] = z + ((c >> 2) & 1);
+						values[c] = value(corners[c][0], corners[c][1], corners[c][2]);
+						inside += values[c] >= isovalue;
+					}
+					if (inside == 0 || inside == 8)
+						continue;
+
+					for (int t = 0; t < 6; t++)
+						polygonizeTetrahedron(slab, tetrahedra[t], corners, values);
+				}
+	}
+
+	void polygonizeTetrahedron(sIsosurfaceSlab& slab, const int* tet, int corners[8][3], float* values) {
+		int in[4], out[4];
+		int num_in = 0, num_out = 0;
+		for (int i = 0; i < 4; i++) {
+			if (values[tet[i]] >= isovalue)
+				in[num_in++] = tet[i];
+			else
+				out[num_out++] = tet[i];
+		}
+		if (num_in == 0 || num_out == 0)
+			return;
+
+		//corners are in increasing order in the tetrahedron, so (min, max) is the edge direction
+		auto vertex = [&](int a, int b) {
+			if (a > b)
+				std::swap(a, b);
+			return edgeVertex(slab, corners[a], corners[b], values[a], values[b]);
+		};
+		Vector3 outside((float)(corners[out[0]][0] - corners[in[0]][0]), (float)(corners[out[0]][1] - corners[in[0]][1]), (float)(corners[out[0]][2] - corners[in[0]][2]));
+
+		if (num_in == 1)
+			addTriangle(slab, vertex(in[0], out[0]), vertex(in[0], out[1]), vertex(in[0], out[2]), outside);
+		else if (num_in == 3)
+			addTriangle(slab, vertex(out[0], in[0]), vertex(out[0], in[1]), vertex(out[0], in[2]), outside);
+		else {
+			//quad between the two pairs
+			unsigned int v0 = vertex(in[0], out[0]);
+			unsigned int v1 = vertex(in[0], out[1]);
+			unsigned int v2 = vertex(in[1], out[1]);
+			unsigned int v3 = vertex(in[1], out[0]);
+			addTriangle(slab, v0, v1, v2, outside);
+			addTriangle(slab, v0, v2, v3, outside);
+		}
+	}
+
+	void extract(Mesh* mesh) {
+		int layers = d - 1;
+		int num_slabs = std::min(layers, (int)(ThreadPool::getGlobal()->getNumThreads() + 1) * 4);
+		std::vector<sIsosurfaceSlab> slabs(num_slabs);
+		for (int s = 0; s < num_slabs; s++) {
+			slabs[s].z0 = (int)((long long)layers * s / num_slabs);
+			slabs[s].z1 = (int)((long long)layers * (s + 1) / num_slabs);
+		}
+
+		//1: triangles of every slab with its own vertices
+		parallelFor(0, num_slabs, [&](int s0, int s1) {
+			for (int s = s0; s < s1; s++) {
+				sIsosurfaceSlab& slab = slabs[s];
+				polygonizeSlab(slab);
+
+				//vertices on the edges of the bottom plane were also created by the previous slab
+				slab.owned_rank.resize(slab.positions.size());
+				slab.owned_count = 0;
+				for (size_t i = 0; i < slab.positions.size(); i++) {
+					unsigned long long key = slab.edges[i];
+					bool in_plane = (key & 4) == 0 && (key >> 3) / ((unsigned long long)w * h) == (unsigned long long)slab.z0;
+					slab.owned_rank[i] = (s > 0 && in_plane) ? -1 : (int)slab.owned_count++;
+				}
+			}
+		});
+
+		unsigned int num_vertices = 0, num_triangles = 0;
+		for (int s = 0; s < num_slabs; s++) {
+			slabs[s].first_vertex = num_vertices;
+			slabs[s].first_triangle = num_triangles;
+			num_vertices += slabs[s].owned_count;
+			num_triangles += (unsigned int)slabs[s].triangles.size() / 3;
+		}
+
+		mesh->clear();
+		mesh->interleaved.resize(num_vertices);
+		mesh->indices.resize(num_triangles);
+		Vector3 dims((float)w, (float)h, (float)d);
+
+		//2: write the vertices and remap the triangles to global ids
+		parallelFor(0, num_slabs, [&](int s0, int s1) {
+			for (int s = s0; s < s1; s++) {
+				sIsosurfaceSlab& slab = slabs[s];
+				std::vector<unsigned int> global(slab.positions.size());
+				for (size_t i = 0; i < slab.positions.size(); i++) {
+					if (slab.owned_rank[i] >= 0) {
+						global[i] = slab.first_vertex + slab.owned_rank[i];
+						Mesh::tInterleaved& v = mesh->interleaved[global[i]];
+						Vector3 uvw = (slab.positions[i] + Vector3(0.5f, 0.5f, 0.5f)) * Vector3(1.0f / dims.x, 1.0f / dims.y, 1.0f / dims.z);
+						v.vertex = uvw * 2.0f - Vector3(1.0f, 1.0f, 1.0f);
+						//normals point to the lower values, scaled to the cube space
+						Vector3 n = slab.normals[i] * dims * -1.0f;
+						float length = (float)n.length();
+						v.normal = length > 0.0f ? n * (1.0f / length) : Vector3(0.0f, 1.0f, 0.0f);
+						v.uv.set(uvw.x, uvw.y);
+					}
+					else {
+						sIsosurfaceSlab& previous = slabs[s - 1];
+						unsigned int local = previous.edge_vertex.find(slab.edges[i])->second;
+						global[i] = previous.first_vertex + previous.owned_rank[local];
+					}
+				}
+				for (size_t t = 0; t < slab.triangles.size(); t += 3)
+					mesh->indices[slab.first_triangle + t / 3] = Vector3u(global[slab.triangles[t]], global[slab.triangles[t + 1]], global[slab.triangles[t + 2]]);
+			}
+		});
+	}
+};
+
+template <typename T, int Channels>
+struct IsosurfaceKernel {
+	static void run(VolumeView<T, Channels> view, Mesh* mesh, Volume* volume, float isovalue, unsigned int macrocell_size) {
+		Volume* cells = macrocell_size ? volume->createMacrocells(macrocell_size) : NULL;
+		IsosurfaceExtractor<T, Channels> extractor(view, isovalue, cells, macrocell_size);
+		extractor.extract(mesh);
+		if (cells)
+			delete cells;
+	}
+};
+
+bool Mesh::createIsosurface(Volume* volume, float isovalue, unsigned int macrocell_size)
+{
+	if (!volume || !volume->data || volume->width < 2 || volume->height < 2 || volume->depth < 2)
+		return false;
+	long time = getTime();
+	if (!dispatchVolume<IsosurfaceKernel>(volume, this, volume, isovalue, macrocell_size)) {
+		std::cout << "[ERROR]: Isosurface: unsupported voxel format" << std::endl;
+		return false;
+	}
+
+	//the whole cube, the surface is inside it
+	aabb_min.set(-1, -1, -1);
+	aabb_max.set(1, 1, 1);
+	box.center.set(0, 0, 0);
+	box.halfsize.set(1, 1, 1);
+	radius = (float)box.halfsize.length();
+
+	std::cout << " + Isosurface: " << interleaved.size() << " vertices, " << indices.size() << " triangles in " << (getTime() - time) << "ms" << std::endl;
+	return true;
+}
@@ -3,6 +3,7 @@
 #include "application.h"
 #include "extra/hdre.h"
 #include "utils.h"
+#include "volume.h"
 SkyboxMaterial* ReflectionMaterial::skybox = NULL;
 
 StandardMaterial::StandardMaterial()
@@ -286,4 +287,182 @@ void PBRMaterial::render(Mesh* mesh, Matrix44 model, Camera* camera) {
 	StandardMaterial::render(mesh, model, camera);
 	
 	glDisable(GL_CULL_FACE);
-}
\ No newline at end of file
+}
+
+VolumeMaterial::VolumeMaterial(Volume* volume, unsigned int macrocell_size, unsigned int num_levels) {
+	shader = Shader::Get("data/shaders/basic.vs", "data/shaders/volume.fs");
+	color = vec4(1.f, 1.f, 1.f, 1.f);
+	this->volume = NULL;
+	this->macrocell_size = macrocell_size;
+	current_level = 0;
+	gradients_texture = NULL;
+	gradients_encoding = GradientEncoding::RGB8;
+
+	step_length = 0.005f;
+	brightness = 1.0f;
+	density_threshold = 0.1f;
+	use_macrocells = true;
+	use_lighting = false;
+	auto_level = true;
+	lod_bias = 1.0f;
+
+	if (volume)
+		setVolume(volume, macrocell_size, num_levels);
+}
+
+VolumeMaterial::~VolumeMaterial() {
+	clearLevels();
+}
+
+void VolumeMaterial::clearLevels() {
+	for (size_t i = 0; i < levels.size(); i++) {
+		delete levels[i].texture;
+		if (levels[i].macrocells_texture)
+			delete levels[i].macrocells_texture;
+	}
+	levels.clear();
+	texture = NULL;
+	if (gradients_texture)
+		delete gradients_texture;
+	gradients_texture = NULL;
+	use_lighting = false;
+}
+
+void VolumeMaterial::setVolume(Volume* volume, unsigned int macrocell_size, unsigned int num_levels, bool max_pyramid) {
+	clearLevels();
+	this->volume = volume;
+	this->macrocell_size = macrocell_size;
+	current_level = 0;
+
+	std::vector<Volume*> volumes = volume->createPyramid(num_levels, max_pyramid);
+	volumes.insert(volumes.begin(), volume);
+
+	for (size_t i = 0; i < volumes.size(); i++) {
+		Volume* level_volume = volumes[i];
+		sVolumeLevel level;
+		level.texture = new Texture();
+		level.texture->create3DFromVolume(level_volume, GL_CLAMP_TO_EDGE);
+		level.dims.set((float)level_volume->width, (float)level_volume->height, (float)level_volume->depth);
+		level.macrocells_texture = NULL;
+
+		Volume* cells = level_volume->createMacrocells(macrocell_size);
+		if (cells) {
+			level.macrocells_texture = new Texture();
+			level.macrocells_texture->create3DFromVolume(cells, GL_CLAMP_TO_EDGE);
+			level.macrocells_dims.set((float)cells->width, (float)cells->height, (float)cells->depth);
+			delete cells;
+
+			//every texel is a whole cell, they must not be interpolated
+			glBindTexture(GL_TEXTURE_3D, level.macrocells_texture->texture_id);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindTexture(GL_TEXTURE_3D, 0);
+		}
+
+		levels.push_back(level);
+		if (level_volume != volume)
+			delete level_volume; //only the textures are kept
+	}
+	texture = levels[0].texture;
+}
+
+void VolumeMaterial::setGradients(GradientMethod method, GradientEncoding encoding) {
+	if (!volume)
+		return;
+	Volume* gradients = volume->createGradients(method, encoding);
+	if (!gradients)
+		return;
+
+	//same texture coordinates as the density in every level
+	if (!gradients_texture)
+		gradients_texture = new Texture();
+	gradients_texture->create3DFromVolume(gradients, GL_CLAMP_TO_EDGE);
+	gradients_encoding = encoding;
+	use_lighting = true;
+	delete gradients;
+}
+
+int VolumeMaterial::chooseLevel(Matrix44 model, Camera* camera) {
+	if (!auto_level)
+		return std::min(std::max(current_level, 0), (int)levels.size() - 1);
+
+	//voxels along the diagonal of the cube against the pixels it covers
+	Vector3 center = model * Vector3(0.f, 0.f, 0.f);
+	float radius = (model * Vector3(1.f, 1.f, 1.f) - center).length();
+	float pixels = 2.0f * camera->getProjectedScale(center, radius);
+	float voxels = levels[0].dims.length();
+	if (pixels <= 0.0f || camera->eye.distance(center) < radius)
+		return 0; //the camera is inside the volume
+
+	int level = (int)std::floor(std::log2(std::max(voxels / (pixels * lod_bias), 1.0f)));
+	return std::min(level, (int)levels.size() - 1);
+}
+
+void VolumeMaterial::setUniforms(Camera* camera, Matrix44 model) {
+	StandardMaterial::setUniforms(camera, model);
+	sVolumeLevel& level = levels[current_level];
+
+	//rays are traced in the local space of the cube
+	Matrix44 inv_model = model;
+	inv_model.inverse();
+	shader->setUniform("u_local_camera_position", inv_model * camera->eye);
+
+	shader->setUniform("u_volume_texture", level.texture, (int)TextureSlots::VOLUME);
+	shader->setUniform("u_volume_dims", level.dims);
+	shader->setUniform("u_step_length", step_length * (float)(1 << current_level));
+	shader->setUniform("u_brightness", brightness);
+	shader->setUniform("u_density_threshold", density_threshold);
+	shader->setUniform("u_value_scale", volume->quantizationScale[0]);
+	shader->setUniform("u_value_bias", volume->quantizationBias[0]);
+
+	shader->setUniform("u_use_gradients", use_lighting && gradients_texture != NULL);
+	if (gradients_texture) {
+		shader->setUniform("u_gradients_texture", gradients_texture, (int)TextureSlots::GRADIENTS);
+		shader->setUniform1("u_gradients_octahedral", gradients_encoding == GradientEncoding::OCTAHEDRAL ? 1 : 0);
+	}
+
+	shader->setUniform("u_use_macrocells", use_macrocells && level.macrocells_texture != NULL);
+	if (level.macrocells_texture) {
+		shader->setUniform("u_macrocells_texture", level.macrocells_texture, (int)TextureSlots::MACROCELLS);
+		shader->setUniform("u_macrocells_dims", level.macrocells_dims);
+		shader->setUniform("u_macrocell_size", (float)macrocell_size);
+	}
+}
+
+void VolumeMaterial::render(Mesh* mesh, Matrix44 model, Camera* camera) {
+	if (!mesh || !shader || levels.empty())
+		return;
+
+	current_level = chooseLevel(model, camera);
+	texture = levels[current_level].texture;
+
+	//back faces, so the volume is still visible with the camera inside the cube
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	shader->enable();
+	setUniforms(camera, model);
+	mesh->render(GL_TRIANGLES);
+	shader->disable();
+
+	glCullFace(GL_BACK);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+}
+
+void VolumeMaterial::renderInMenu() {
+	ImGui::ColorEdit3("Color", (float*)&color);
+	ImGui::SliderFloat("Step length", &step_length, 0.001f, 0.05f);
+	ImGui::SliderFloat("Brightness", &brightness, 0.0f, 10.0f);
+	ImGui::SliderFloat("Density threshold", &density_threshold, 0.0f, 1.0f);
+	ImGui::Checkbox("Skip empty macrocells", &use_macrocells);
+	if (gradients_texture)
+		ImGui::Checkbox("Lighting", &use_lighting);
+	ImGui::Checkbox("Automatic level", &auto_level);
+	if (auto_level)
+		ImGui::SliderFloat("Voxels per pixel", &lod_bias, 0.25f, 4.0f);
+	else
+		ImGui::SliderInt("Level", &current_level, 0, (int)levels.size() - 1);
+}
@@ -6,6 +6,7 @@
 #include "camera.h"
 #include "mesh.h"
 #include "extra/hdre.h"
+#include "volume.h"
 
 class Material {
 public:
@@ -110,7 +111,44 @@ public:
 	void renderInMenu();
 };
 
-
-
+//Raymarches a volume inside the [-1,1] cube of the mesh (use Mesh::createCube).
+//Macrocells whose max value is below the transfer function threshold are leaped over.
+//The volume is uploaded as a pyramid and every frame the level is chosen from its projected size.
+class VolumeMaterial : public StandardMaterial {
+public:
+	struct sVolumeLevel {
+		Texture* texture;
+		Texture* macrocells_texture;
+		Vector3 dims;
+		Vector3 macrocells_dims;
+	};
+
+	Volume* volume;
+	std::vector<sVolumeLevel> levels;
+	Texture* gradients_texture;			//optional, used to light the samples
+	GradientEncoding gradients_encoding;
+	unsigned int macrocell_size;
+	int current_level;
+
+	float step_length;			//in texture coordinates, doubled in every level
+	float brightness;
+	float density_threshold;	//transfer function: densities below it are transparent
+	bool use_macrocells;
+	bool use_lighting;
+	bool auto_level;			//choose the level from the screen size, otherwise current_level is used
+	float lod_bias;				//voxels per pixel allowed before switching to the next level
+
+	VolumeMaterial(Volume* volume = NULL, unsigned int macrocell_size = 8, unsigned int num_levels = 0);
+	~VolumeMaterial();
+
+	//uploads the volume, its pyramid (num_levels coarser levels, 0 all of them) and the macrocells of every level
+	void setVolume(Volume* volume, unsigned int macrocell_size = 8, unsigned int num_levels = 0, bool max_pyramid = false);
+	void clearLevels();
+	void setGradients(GradientMethod method = GradientMethod::CENTRAL_DIFFERENCES, GradientEncoding encoding = GradientEncoding::RGB8); //computes and uploads them
+	int chooseLevel(Matrix44 model, Camera* camera);
+	void setUniforms(Camera* camera, Matrix44 model);
+	void render(Mesh* mesh, Matrix44 model, Camera* camera);
+	void renderInMenu();
+};
 
 #endif
\ No newline at end of file
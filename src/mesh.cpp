@@ -1,5 +1,6 @@
 #include "mesh.h"
 #include "extra/textparser.h"
+#include "extra/objparser.h"
 #include "utils.h"
 #include "shader.h"
 #include "includes.h"
@@ -9,16 +10,23 @@
 #include <iostream>
 #include <limits>
 #include <sys/stat.h>
+#include <mutex>
 
 #include "camera.h"
 #include "texture.h"
 #include "animation.h"
-#include "extra/coldet/coldet.h"
+#include "meshbvh.h"
+#include "extra/mappedfile.h"
+#include "volumeview.h" //half floats
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 bool Mesh::use_binary = true;
 bool Mesh::auto_upload_to_vram = true;
 bool Mesh::interleave_meshes = true;
+bool Mesh::optimize_meshes = true;
+bool Mesh::generate_lods = true;
+bool Mesh::quantize_meshes = false;
+bool Mesh::build_clusters = true;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 
@@ -30,8 +38,14 @@ long Mesh::num_triangles_rendered = 0;
 Mesh::Mesh()
 {
 	radius = 0;
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = lod_indices_vbo_id = 0;
+	render_lod = 0;
+	render_clusters = false;
+	vram_quantized = false;
+	loading = false;
+	load_failed = false;
 	collision_model = NULL;
+	mapping = NULL;
 	clear();
 }
 
@@ -60,9 +74,11 @@ void Mesh::clear()
 		glDeleteBuffersARB(1, &bones_vbo_id);
 	if (weights_vbo_id)
 		glDeleteBuffersARB(1, &weights_vbo_id);
+	if (lod_indices_vbo_id)
+		glDeleteBuffersARB(1, &lod_indices_vbo_id);
 
 	//VBOs ids
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = lod_indices_vbo_id = 0;
 
 	//buffers
 	vertices.clear();
@@ -73,9 +89,24 @@ void Mesh::clear()
 	indices.clear();
 	bones.clear();
 	weights.clear();
-
-	if (collision_model)
-		delete collision_model;
+	lods.clear();
+	lod_indices.clear();
+	clusters.clear();
+	visible_ranges.clear();
+	quantized.clear();
+	quantized_weights.clear();
+	quantization_offset.set(0, 0, 0);
+	quantization_scale.set(1, 1, 1);
+	vram_quantized = false;
+
+	if (mapping)
+		delete mapping;
+	mapping = NULL;
+	memset(mapped_streams, 0, sizeof(mapped_streams));
+	mapped_interleaved = mapped_quantized = false;
+	mapped_size = mapped_num_indices = mapped_num_lod_indices = 0;
+
+	delete collision_model.exchange(NULL);
 }
 
 int vertex_location = 1;
@@ -93,29 +124,50 @@ void Mesh::enableBuffers(Shader* sh)
 	if (vertex_location == -1)
 		return;
 
+	//client side arrays need the CPU copy
+	if (mapping && !vertices_vbo_id && !interleaved_vbo_id)
+		loadCPUData();
+
 	int spacing = 0;
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	//quantized VBO: unorm positions in the quantization box, snorm 10:10:10:2 normals and half float uvs
+	bool quantized_layout = interleaved_vbo_id && vram_quantized;
+	GLenum vertex_type = quantized_layout ? GL_UNSIGNED_SHORT : GL_FLOAT;
+	GLenum normal_type = quantized_layout ? GL_INT_2_10_10_10_REV : GL_FLOAT;
+	GLenum uv_type = quantized_layout ? GL_HALF_FLOAT : GL_FLOAT;
+	int normal_size = quantized_layout ? 4 : 3;
+
+	if (quantized_layout)
+	{
+		spacing = sizeof(tQuantized);
+		offset_normal = sizeof(Uint16) * 4;
+		offset_uv = sizeof(Uint16) * 4 + sizeof(Uint32);
+	}
+	else if (isInterleaved())
 	{
 		spacing = sizeof(tInterleaved);
 		offset_normal = sizeof(Vector3);
 		offset_uv = sizeof(Vector3) + sizeof(Vector3);
 	}
 
+	//the shaders undo the quantization of the positions, identity for the float ones
+	sh->setUniform("u_vertex_offset", quantized_layout ? quantization_offset : Vector3(0, 0, 0));
+	sh->setUniform("u_vertex_scale", quantized_layout ? quantization_scale : Vector3(1, 1, 1));
+
 	glEnableVertexAttribArray(vertex_location);
 
 	if (vertices_vbo_id || interleaved_vbo_id)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+		glVertexAttribPointer(vertex_location, 3, vertex_type, quantized_layout, spacing, 0);
 	}
 	else
 		glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
 
 	normal_location = -1;
-	if (normals.size() || spacing)
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -124,7 +176,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				glVertexAttribPointer(normal_location, normal_size, normal_type, quantized_layout, spacing, (void*)offset_normal);
 			}
 			else
 				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
@@ -132,7 +184,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv_location = -1;
-	if (uvs.size() || spacing)
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = sh->getAttribLocation("a_uv");
 		if (uv_location != -1)
@@ -141,7 +193,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glVertexAttribPointer(uv_location, 2, uv_type, GL_FALSE, spacing, (void*)offset_uv);
 			}
 			else
 				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
@@ -149,7 +201,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -166,7 +218,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -182,7 +234,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -191,7 +243,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (weights_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				if (vram_quantized) //unorm bytes
+					glVertexAttribPointer(weights_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+				else
+					glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
@@ -210,7 +265,7 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
@@ -224,41 +279,77 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 {
+	//the levels of detail only change the triangles
+	sLOD* lod = (render_lod > 0 && render_lod <= (int)lods.size()) ? &lods[render_lod - 1] : NULL;
 	int start = 0;
-	int size = vertices.size();
-	if (indices.size())
-		size = indices.size();
-	else if (interleaved.size())
-		size = interleaved.size();
+	int num_indices = lod ? lod->count : getNumIndices();
+	int size = num_indices ? num_indices : getNumVertices();
 
 	if (submesh_id > 0)
 	{
+		//material_range counts triangles, indices are stored per triangle too
+		int scale = num_indices ? 1 : 3;
+		const unsigned int* range = lod ? lod->material_range : (material_range.empty() ? NULL : &material_range[0]);
 		submesh_id -= 1;
-		start = submesh_id == 0 ? 0 : material_range[submesh_id - 1] * 3;
-		if (!material_range.empty())
-			size = material_range[submesh_id] * 3 - start;
+		start = submesh_id == 0 ? 0 : range[submesh_id - 1] * scale;
+		if (range)
+			size = range[submesh_id] * scale - start;
 	}
 
 	//DRAW
-	if (indices.size())
+	if (num_indices && render_clusters && !lod && clusters.size())
+	{
+		//only the clusters that passed cullClusters, in one call, clipped to the triangles of the submesh
+		static std::vector<GLsizei> counts;
+		static std::vector<const void*> offsets;
+		counts.clear();
+		offsets.clear();
+		int end = start + size;
+		size = 0;
+		for (size_t i = 0; i < visible_ranges.size(); i += 2)
+		{
+			int range_start = std::max((int)visible_ranges[i], start);
+			int range_end = std::min((int)(visible_ranges[i] + visible_ranges[i + 1]), end);
+			if (range_start >= range_end)
+				continue;
+			counts.push_back((range_end - range_start) * 3);
+			offsets.push_back(indices_vbo_id ? (const void*)(range_start * sizeof(Vector3u)) : (const void*)(&indices[0] + range_start));
+			size += range_end - range_start;
+		}
+		if (counts.size())
+		{
+			if (indices_vbo_id)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			if (num_instances > 0)
+				for (size_t i = 0; i < counts.size(); ++i)
+					glDrawElementsInstanced(primitive, counts[i], GL_UNSIGNED_INT, offsets[i], num_instances);
+			else
+				glMultiDrawElements(primitive, &counts[0], GL_UNSIGNED_INT, (const void**)&offsets[0], (GLsizei)counts.size());
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+	else if (num_indices)
 	{
+		unsigned int vbo_id = lod ? lod_indices_vbo_id : indices_vbo_id;
+		if (lod)
+			start += lod->start;
 		if (num_instances > 0)
 		{
-			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3)), num_instances);
+			assert(vbo_id && "indices must be uploaded to the GPU");
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_id);
+			glDrawElementsInstanced(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3u)), num_instances);
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
 		{
-			if (indices_vbo_id)
+			if (vbo_id)
 			{
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3)));
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_id);
+				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(start * sizeof(Vector3u)));
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			}
 			else
-				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)(&indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size * 3, GL_UNSIGNED_INT, (void*)((lod ? &lod_indices[0] : &indices[0]) + start)); //no multiply, its a vector3u pointer)
 		}
 	}
 	else
@@ -271,10 +362,51 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 
 	assert(glGetError() == GL_NO_ERROR);
 
-	num_triangles_rendered += (size / 3) * (num_instances ? num_instances : 1);
+	num_triangles_rendered += (num_indices ? size : size / 3) * (num_instances ? num_instances : 1);
 	num_meshes_rendered++;
 }
 
+unsigned int Mesh::cullClusters(Camera* camera, const Matrix44& model, bool backfaces)
+{
+	visible_ranges.clear();
+	if (clusters.empty())
+		return 0;
+
+	//the cones are tested in object space, the spheres against the frustum in world space
+	Matrix44 inverse_model = model;
+	inverse_model.inverse();
+	Vector3 eye = inverse_model * camera->eye;
+	Matrix44 m = model;
+	float scale = (float)std::max(m.rightVector().length(), std::max(m.topVector().length(), m.frontVector().length()));
+	backfaces = backfaces && camera->type == Camera::PERSPECTIVE;
+
+	unsigned int num_triangles = 0;
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		const sCluster& cluster = clusters[i];
+		if (camera->testSphereInFrustum(model * cluster.center, cluster.radius * scale) == CLIP_OUTSIDE)
+			continue;
+		if (backfaces && cluster.cone_cutoff < 1.0f)
+		{
+			Vector3 to_cluster = cluster.center - eye;
+			if (to_cluster.dot(cluster.cone_axis) >= cluster.cone_cutoff * to_cluster.length() + cluster.radius)
+				continue;
+		}
+
+		//neighbour clusters go in the same range
+		size_t last = visible_ranges.size();
+		if (last && visible_ranges[last - 2] + visible_ranges[last - 1] == cluster.start)
+			visible_ranges[last - 1] += cluster.count;
+		else
+		{
+			visible_ranges.push_back(cluster.start);
+			visible_ranges.push_back(cluster.count);
+		}
+		num_triangles += cluster.count;
+	}
+	return num_triangles;
+}
+
 void Mesh::disableBuffers(Shader* shader)
 {
 	glDisableVertexAttribArray(vertex_location);
@@ -332,7 +464,9 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 //super obsolete rendering method, do not use
 void Mesh::renderFixedPipeline(int primitive)
 {
+	loadCPUData(); //client side arrays
 	assert((vertices.size() || interleaved.size()) && "No vertices in this mesh");
+	assert(!vram_quantized && "quantized VBOs need a shader to undo the quantization");
 
 	int interleave_offset = interleaved.size() ? sizeof(tInterleaved) : 0;
 	int offset_normal = sizeof(Vector3);
@@ -403,7 +537,7 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 {
 	Shader* shader = Shader::current;
 	std::vector<Matrix44> bone_matrices;
-	assert(bones.size());
+	assert(bones.size() || bones_vbo_id);
 	int bones_loc = shader->getUniformLocation("u_bones");
 	if (bones_loc != -1)
 	{
@@ -416,7 +550,7 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() || interleaved.size());
+	assert(getNumVertices());
 
 	if (glGenBuffersARB == 0)
 	{
@@ -424,13 +558,27 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	//streams come from the vectors or straight from the file mapping
+	unsigned int num_vertices = getNumVertices();
+	unsigned int num_indices = getNumIndices();
+	bool quantized_data = isQuantized();
+	const void* vertices_data = mapping ? mapped_streams[0] : (quantized_data ? (const void*)&quantized[0] : (interleaved.size() ? (const void*)&interleaved[0] : (const void*)&vertices[0]));
+	const void* normals_data = mapping ? mapped_streams[1] : (normals.size() ? &normals[0] : NULL);
+	const void* uvs_data = mapping ? mapped_streams[2] : (uvs.size() ? &uvs[0] : NULL);
+	const void* colors_data = mapping ? mapped_streams[3] : (colors.size() ? &colors[0] : NULL);
+	const void* indices_data = mapping ? mapped_streams[4] : (indices.size() ? &indices[0] : NULL);
+	const void* bones_data = mapping ? mapped_streams[5] : (bones.size() ? &bones[0] : NULL);
+	const void* weights_data = mapping ? mapped_streams[6] : (quantized_data ? (quantized_weights.size() ? (const void*)&quantized_weights[0] : NULL) : (weights.size() ? (const void*)&weights[0] : NULL));
+	const void* lod_indices_data = mapping ? mapped_streams[7] : (lod_indices.size() ? &lod_indices[0] : NULL);
+	unsigned int num_lod_indices = mapping ? mapped_num_lod_indices : lod_indices.size();
+
+	if (isInterleaved())
 	{
 		// Vertex,Normal,UV
 		if (interleaved_vbo_id == 0)
 			glGenBuffersARB(1, &interleaved_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * (quantized_data ? sizeof(tQuantized) : sizeof(tInterleaved)), vertices_data, GL_STATIC_DRAW_ARB);
 	}
 	else
 	{
@@ -438,191 +586,164 @@ void Mesh::uploadToVRAM()
 		if (vertices_vbo_id == 0)
 			glGenBuffersARB(1, &vertices_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3), vertices_data, GL_STATIC_DRAW_ARB);
 
 		// UVs
-		if (uvs.size())
+		if (uvs_data)
 		{
 			if (uvs_vbo_id == 0)
 				glGenBuffersARB(1, &uvs_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector2), uvs_data, GL_STATIC_DRAW_ARB);
 		}
 
 		// Normals
-		if (normals.size())
+		if (normals_data)
 		{
 			if (normals_vbo_id == 0)
 				glGenBuffersARB(1, &normals_vbo_id);
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector3), normals_data, GL_STATIC_DRAW_ARB);
 		}
 	}
 
 	// Colors
-	if (colors.size())
+	if (colors_data)
 	{
 		if (colors_vbo_id == 0)
 			glGenBuffersARB(1, &colors_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4), colors_data, GL_STATIC_DRAW_ARB);
 	}
 
-	if (bones.size())
+	if (bones_data)
 	{
 		if (bones_vbo_id == 0)
 			glGenBuffersARB(1, &bones_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * sizeof(Vector4ub), bones_data, GL_STATIC_DRAW_ARB);
 	}
-	if (weights.size())
+	if (weights_data)
 	{
 		if (weights_vbo_id == 0)
 			glGenBuffersARB(1, &weights_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_vertices * (quantized_data ? sizeof(Vector4ub) : sizeof(Vector4)), weights_data, GL_STATIC_DRAW_ARB);
 	}
+	vram_quantized = quantized_data;
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
 	// Indices
-	if (indices.size())
+	if (indices_data)
 	{
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Vector3u), &indices[0], GL_STATIC_DRAW_ARB);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(Vector3u), indices_data, GL_STATIC_DRAW_ARB);
+	}
+	if (lod_indices_data)
+	{
+		if (lod_indices_vbo_id == 0)
+			glGenBuffersARB(1, &lod_indices_vbo_id);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, lod_indices_vbo_id);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, num_lod_indices * sizeof(Vector3u), lod_indices_data, GL_STATIC_DRAW_ARB);
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-
-
 	checkGLErrors();
 
-	//clear buffers to save memory
+	//the pages of the file are not needed until someone asks for the CPU copy
+	if (mapping)
+		mapping->adviseDontNeed();
 }
 
-bool Mesh::createCollisionModel(bool is_static)
+bool Mesh::createCollisionModel()
 {
-	if (collision_model)
+	//several threads may query the same mesh for the first time
+	if (collision_model.load(std::memory_order_acquire))
+		return true;
+	static std::mutex collision_mutex;
+	std::lock_guard<std::mutex> lock(collision_mutex);
+	if (collision_model.load(std::memory_order_relaxed))
 		return true;
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
-
-	if (indices.size()) //indexed
-	{
-		collision_model->setTriangleNumber(indices.size());
-
-		if (interleaved.size())
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = interleaved[indices[i].x];
-				auto v2 = interleaved[indices[i].y];
-				auto v3 = interleaved[indices[i].z];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-			for (unsigned int i = 0; i < indices.size(); ++i)
-			{
-				auto v1 = vertices[indices[i].x];
-				auto v2 = vertices[indices[i].y];
-				auto v3 = vertices[indices[i].z];
-				collision_model->addTriangle(v1.v, v2.v, v3.v);
-			}
-	}
-	else if (interleaved.size()) //is interleaved
-	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
-		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-		}
-	}
-	else if (vertices.size()) //non interleaved
-	{
-		collision_model->setTriangleNumber(vertices.size() / 3);
-		for (unsigned int i = 0; i < vertices.size(); i+=3)
-		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else
+	MeshBVH* bvh = new MeshBVH();
+	if (!bvh->build(this))
 	{
+		delete bvh;
 		assert(0 && "mesh without vertices, cannot create collision model");
 		return false;
 	}
-	collision_model->finalize();
-	this->collision_model = collision_model;
+	collision_model.store(bvh, std::memory_order_release); //readers see the whole tree built
 	return true;
 }
 
+//normal of the world from one of the object, inv is the inverse of the model
+static Vector3 normalToWorld(const Matrix44& inv, const Vector3& normal)
+{
+	Matrix44 inv_transposed = inv;
+	inv_transposed.transpose();
+	Vector3 n = inv_transposed.rotateVector(normal);
+	float length = (float)n.length();
+	return length > 0.0f ? n * (1.0f / length) : n;
+}
+
 //help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
 bool Mesh::testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal, float max_ray_dist, bool in_object_space )
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
-
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
-
-	collision_model->setTransform( model.m );
-	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
+	if (!createCollisionModel())
 		return false;
+	const MeshBVH* bvh = collision_model.load(std::memory_order_acquire);
 
-	collision_model->getCollisionPoint( collision.v, in_object_space);
-
-	float t1[9],t2[9];
-	collision_model->getCollidingTriangles(t1,t2, in_object_space);
+	//the ray goes to object space, the distances along it stay the same while the direction is not normalized again
+	Matrix44 inv = model;
+	if (!inv.inverse())
+		return false;
+	Vector3 origin = inv * start;
+	Vector3 direction = inv.rotateVector(front);
+	float front_length = (float)front.length();
+	float max_t = max_ray_dist < 3.4e+38F && front_length > 0.0f ? max_ray_dist / front_length : 3.4e+38F;
 
-	Vector3 v1;
-	Vector3 v2;
-	v1=Vector3(t1[3]-t1[0],t1[4]-t1[1],t1[5]-t1[2]);
-	v2=Vector3(t1[6]-t1[0],t1[7]-t1[1],t1[8]-t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	float t;
+	if (!bvh->rayCast(origin, direction, t, max_t, NULL, &normal))
+		return false;
 
+	if (in_object_space)
+		collision = origin + direction * t;
+	else
+	{
+		collision = start + front * t;
+		normal = normalToWorld(inv, normal);
+	}
 	return true;
 }
 
 bool Mesh::testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal)
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
-
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
-
-	collision_model->setTransform(model.m);
-	if (collision_model->sphereCollision(center.v, radius) == false)
+	if (!createCollisionModel())
 		return false;
+	const MeshBVH* bvh = collision_model.load(std::memory_order_acquire);
 
-	collision_model->getCollisionPoint(collision.v, false);
-
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
+	Matrix44 inv = model;
+	if (!inv.inverse())
+		return false;
 
-	Vector3 v1;
-	Vector3 v2;
-	v1 = Vector3(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	//the sphere goes to object space, only a uniform scale keeps it a sphere (see mesh.h)
+	float scale = (float)inv.rotateVector(Vector3(1, 0, 0)).length();
+	Vector3 closest;
+	float distance;
+	if (!bvh->closestPoint(inv * center, closest, distance, radius * scale, NULL, &normal))
+		return false;
 
+	collision = model * closest;
+	normal = normalToWorld(inv, normal);
 	return true;
 }
 
 bool Mesh::interleaveBuffers()
 {
+	loadCPUData();
 	if (!vertices.size() || !normals.size() || !uvs.size())
 		return false;
 
@@ -644,6 +765,87 @@ bool Mesh::interleaveBuffers()
 	return true;
 }
 
+//snorm 10 bits, two's complement
+static inline Uint32 packSnorm10(float value)
+{
+	int i = (int)floorf(clamp(value, -1.0f, 1.0f) * 511.0f + 0.5f);
+	return (Uint32)i & 0x3FF;
+}
+
+static inline float unpackSnorm10(Uint32 packed, int shift)
+{
+	int i = (int)(packed << (22 - shift)) >> 22; //sign extension
+	return std::max(i / 511.0f, -1.0f);
+}
+
+static void dequantizeVertex(const Mesh::tQuantized& q, const Vector3& offset, const Vector3& scale, Mesh::tInterleaved& v)
+{
+	for (int k = 0; k < 3; k++)
+		v.vertex.v[k] = offset.v[k] + q.vertex[k] / 65535.0f * scale.v[k];
+	v.normal.set(unpackSnorm10(q.normal, 0), unpackSnorm10(q.normal, 10), unpackSnorm10(q.normal, 20));
+	v.uv.set(halfToFloat(q.uv[0]), halfToFloat(q.uv[1]));
+}
+
+bool Mesh::quantize()
+{
+	loadCPUData();
+	if (!interleaved.size() && !interleaveBuffers())
+		return false;
+
+	//box of the vertices themselves, so no precision is spent outside of them
+	unsigned int num_vertices = interleaved.size();
+	Vector3 min_pos = interleaved[0].vertex;
+	Vector3 max_pos = min_pos;
+	for (unsigned int i = 1; i < num_vertices; ++i)
+	{
+		min_pos.setMin(interleaved[i].vertex);
+		max_pos.setMax(interleaved[i].vertex);
+	}
+	quantization_offset = min_pos;
+	quantization_scale = max_pos - min_pos;
+
+	quantized.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		const tInterleaved& v = interleaved[i];
+		tQuantized& q = quantized[i];
+		for (int k = 0; k < 3; k++)
+		{
+			float t = quantization_scale.v[k] > 0.0f ? (v.vertex.v[k] - quantization_offset.v[k]) / quantization_scale.v[k] : 0.0f;
+			q.vertex[k] = (Uint16)(clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f);
+		}
+		q.vertex[3] = 0;
+		Vector3 n = v.normal;
+		float length = (float)n.length();
+		if (length > 0.0f)
+			n = n * (1.0f / length);
+		q.normal = packSnorm10(n.x) | (packSnorm10(n.y) << 10) | (packSnorm10(n.z) << 20);
+		q.uv[0] = floatToHalf(v.uv.x);
+		q.uv[1] = floatToHalf(v.uv.y);
+	}
+
+	//weights rounded to bytes, the rounding error goes to the biggest one so they still add up to 1
+	quantized_weights.resize(weights.size());
+	for (unsigned int i = 0; i < weights.size(); ++i)
+	{
+		const Vector4& w = weights[i];
+		const float values[4] = { w.x, w.y, w.z, w.w };
+		int bytes[4];
+		int sum = 0, biggest = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			bytes[k] = (int)floorf(clamp(values[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+			sum += bytes[k];
+			if (values[k] > values[biggest])
+				biggest = k;
+		}
+		if (sum)
+			bytes[biggest] = std::min(std::max(bytes[biggest] + 255 - sum, 0), 255);
+		quantized_weights[i] = Vector4ub(bytes[0], bytes[1], bytes[2], bytes[3]);
+	}
+	return true;
+}
+
 typedef struct 
 {
 	int version;
@@ -658,35 +860,36 @@ typedef struct
 	int num_bones;
 	int material_range[4];
 	Matrix44 bind_matrix;
-	char streams[8]; //Normal|Uvs|Color|Indices|Bones|Weights|Extra
+	char streams[8]; //Vertices|Normal|Uvs|Color|Indices|Bones|Weights|Lod indices
+	int num_lods; //sLOD records after the bones info
+	int num_lod_indices;
+	Vector3 quantization_offset; //of the 'Q' vertices
+	Vector3 quantization_scale;
+	int num_clusters; //sCluster records after the sLOD ones
 	char extra[32]; //unused
 } sMeshInfo;
 
 bool Mesh::readBin(const char* filename)
 {
-	FILE *f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+	//the streams are not copied, they are used from the mapping (see loadCPUData)
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
 		return false;
-
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	}
 
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if (file->size < 4 + sizeof(sMeshInfo) || memcmp(file->data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	char* pos = data + 4;
+	const Uint8* pos = file->data + 4;
 	sMeshInfo info;
 	memcpy(&info,pos,sizeof(sMeshInfo));
 	pos += sizeof(sMeshInfo);
@@ -694,71 +897,85 @@ bool Mesh::readBin(const char* filename)
 	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
 	{
 		std::cout << "[WARN] loading BIN: old version: " << filename << std::endl;
+		delete file;
 		return false;
 	}
 
-	if (info.streams[0] == 'I')
-	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
-	}
-
-	if (info.streams[0] == 'V')
-	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[1] == 'N')
-	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
-	}
-
-	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
-
-	if (info.streams[4] == 'I')
-	{
-		indices.resize(info.num_indices);
-		memcpy((void*)&indices[0], pos, sizeof(Vector3u) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+	//bytes per element of every stream, the order they are written
+	//quantized meshes ('Q') have unorm weights ('w')
+	bool quantized_file = info.streams[0] == 'Q';
+	const size_t stream_bytes[8] = { quantized_file ? sizeof(tQuantized) : (info.streams[0] == 'I' ? sizeof(tInterleaved) : sizeof(Vector3)), sizeof(Vector3), sizeof(Vector2), sizeof(Vector4), sizeof(Vector3u), sizeof(Vector4ub), quantized_file ? sizeof(Vector4ub) : sizeof(Vector4), sizeof(Vector3u) };
+	const char stream_tags[8] = { info.streams[0], 'N', 'U', 'C', 'I', 'B', quantized_file ? 'w' : 'W', 'L' };
+	const Uint8* end = file->data + file->size;
+	const void* streams[8];
+	for (int i = 0; i < 8; i++)
+	{
+		streams[i] = NULL;
+		if (info.streams[i] != stream_tags[i] || (i == 0 && info.streams[0] != 'I' && info.streams[0] != 'V' && info.streams[0] != 'Q'))
+			continue;
+		size_t bytes = stream_bytes[i] * (i == 4 ? info.num_indices : (i == 7 ? info.num_lod_indices : info.size));
+		if ((size_t)(end - pos) < bytes)
+		{
+			std::cout << "[ERROR] loading BIN: truncated file: " << filename << std::endl;
+			delete file;
+			return false;
+		}
+		streams[i] = pos;
+		pos += bytes;
 	}
-
-	if (info.streams[5] == 'B')
+	if ((size_t)(end - pos) < info.num_bones * sizeof(BoneInfo) + info.num_lods * sizeof(sLOD) + info.num_clusters * sizeof(sCluster))
 	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
+		std::cout << "[ERROR] loading BIN: truncated file: " << filename << std::endl;
+		delete file;
+		return false;
 	}
 
-	if (info.streams[6] == 'W')
-	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
+	if (mapping)
+		delete mapping;
+	mapping = file;
+	memcpy(mapped_streams, streams, sizeof(streams));
+	mapped_interleaved = info.streams[0] == 'I' || quantized_file;
+	mapped_quantized = quantized_file;
+	quantization_offset = info.quantization_offset;
+	quantization_scale = info.quantization_scale;
+	mapped_size = info.size;
+	mapped_num_indices = streams[4] ? info.num_indices : 0;
+	mapped_num_lod_indices = streams[7] ? info.num_lod_indices : 0;
 
+	//small, copied now
 	if (info.num_bones)
 	{
 		bones_info.resize(info.num_bones);
 		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
 		pos += sizeof(BoneInfo) * info.num_bones;
 	}
+	lods.clear();
+	if (info.num_lods && streams[7])
+	{
+		lods.resize(info.num_lods);
+		memcpy((void*)&lods[0], pos, sizeof(sLOD) * info.num_lods);
+		for (size_t i = 0; i < lods.size(); i++)
+			if ((size_t)lods[i].start + lods[i].count > mapped_num_lod_indices)
+			{
+				std::cout << "[WARN] loading BIN: wrong LODs ignored: " << filename << std::endl;
+				lods.clear();
+				break;
+			}
+	}
+	pos += sizeof(sLOD) * info.num_lods;
+	clusters.clear();
+	if (info.num_clusters && streams[4])
+	{
+		clusters.resize(info.num_clusters);
+		memcpy((void*)&clusters[0], pos, sizeof(sCluster) * info.num_clusters);
+		for (size_t i = 0; i < clusters.size(); i++)
+			if ((size_t)clusters[i].start + clusters[i].count > mapped_num_indices)
+			{
+				std::cout << "[WARN] loading BIN: wrong clusters ignored: " << filename << std::endl;
+				clusters.clear();
+				break;
+			}
+	}
 
 	aabb_max = info.aabb_max;
 	aabb_min = info.aabb_min;
@@ -773,14 +990,93 @@ bool Mesh::readBin(const char* filename)
 		else
 			break;
 
-	delete[] data;
+	return true;
+}
+
+bool Mesh::loadCPUData()
+{
+	if (!mapping)
+		return false;
+
+	unsigned int size = mapped_size;
+	if (mapped_quantized)
+	{
+		//both: the floats for the CPU, the quantized ones to upload or write again
+		quantized.resize(size);
+		memcpy((void*)&quantized[0], mapped_streams[0], sizeof(tQuantized) * size);
+		interleaved.resize(size);
+		for (unsigned int i = 0; i < size; ++i)
+			dequantizeVertex(quantized[i], quantization_offset, quantization_scale, interleaved[i]);
+	}
+	else if (mapped_interleaved)
+	{
+		interleaved.resize(size);
+		memcpy((void*)&interleaved[0], mapped_streams[0], sizeof(tInterleaved) * size);
+	}
+	else
+	{
+		vertices.resize(size);
+		memcpy((void*)&vertices[0], mapped_streams[0], sizeof(Vector3) * size);
+	}
+	if (mapped_streams[1])
+	{
+		normals.resize(size);
+		memcpy((void*)&normals[0], mapped_streams[1], sizeof(Vector3) * size);
+	}
+	if (mapped_streams[2])
+	{
+		uvs.resize(size);
+		memcpy((void*)&uvs[0], mapped_streams[2], sizeof(Vector2) * size);
+	}
+	if (mapped_streams[3])
+	{
+		colors.resize(size);
+		memcpy((void*)&colors[0], mapped_streams[3], sizeof(Vector4) * size);
+	}
+	if (mapped_streams[4])
+	{
+		indices.resize(mapped_num_indices);
+		memcpy((void*)&indices[0], mapped_streams[4], sizeof(Vector3u) * mapped_num_indices);
+	}
+	if (mapped_streams[5])
+	{
+		bones.resize(size);
+		memcpy((void*)&bones[0], mapped_streams[5], sizeof(Vector4ub) * size);
+	}
+	if (mapped_streams[6] && mapped_quantized)
+	{
+		quantized_weights.resize(size);
+		memcpy((void*)&quantized_weights[0], mapped_streams[6], sizeof(Vector4ub) * size);
+		weights.resize(size);
+		for (unsigned int i = 0; i < size; ++i)
+		{
+			const Vector4ub& w = quantized_weights[i];
+			weights[i].set(w.x / 255.0f, w.y / 255.0f, w.z / 255.0f, w.w / 255.0f);
+		}
+	}
+	else if (mapped_streams[6])
+	{
+		weights.resize(size);
+		memcpy((void*)&weights[0], mapped_streams[6], sizeof(Vector4) * size);
+	}
+	if (mapped_streams[7])
+	{
+		lod_indices.resize(mapped_num_lod_indices);
+		memcpy((void*)&lod_indices[0], mapped_streams[7], sizeof(Vector3u) * mapped_num_lod_indices);
+	}
 
-	createCollisionModel();
+	//from now on the vectors are the mesh
+	delete mapping;
+	mapping = NULL;
+	memset(mapped_streams, 0, sizeof(mapped_streams));
+	mapped_interleaved = mapped_quantized = false;
+	mapped_size = mapped_num_indices = mapped_num_lod_indices = 0;
 	return true;
 }
 
 bool Mesh::writeBin(const char* filename)
 {
+	loadCPUData();
 	assert( vertices.size() || interleaved.size() );
 	std::string s_filename = filename;
 	s_filename += ".mbin";
@@ -809,13 +1105,19 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
+	info.streams[0] = quantized.size() ? 'Q' : (interleaved.size() ? 'I' : 'V');
 	info.streams[1] = normals.size() ? 'N' : ' ';
 	info.streams[2] = uvs.size() ? 'U' : ' ';
 	info.streams[3] = colors.size() ? 'C' : ' ';
 	info.streams[4] = indices.size() ? 'I' : ' ';
 	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
+	info.streams[6] = weights.size() ? (quantized.size() ? 'w' : 'W') : ' ';
+	info.streams[7] = lod_indices.size() ? 'L' : ' ';
+	info.num_lods = lod_indices.size() ? lods.size() : 0;
+	info.num_lod_indices = lod_indices.size();
+	info.quantization_offset = quantization_offset;
+	info.quantization_scale = quantization_scale;
+	info.num_clusters = indices.size() ? clusters.size() : 0;
 
 	for (unsigned int i = 0; i < 4; i++)
 		info.material_range[i] = material_range.size() > i ? material_range[i] : -1;
@@ -824,7 +1126,9 @@ bool Mesh::writeBin(const char* filename)
 	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
 
 	//write streams
-	if (interleaved.size())
+	if (quantized.size())
+		fwrite((void*)&quantized[0], quantized.size() * sizeof(tQuantized), 1, f);
+	else if (interleaved.size())
 		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
 	else
 	{
@@ -843,10 +1147,18 @@ bool Mesh::writeBin(const char* filename)
 
 	if (bones.size())
 		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
-	if (weights.size())
+	if (weights.size() && quantized.size())
+		fwrite((void*)&quantized_weights[0], quantized_weights.size() * sizeof(Vector4ub), 1, f);
+	else if (weights.size())
 		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
+	if (lod_indices.size())
+		fwrite((void*)&lod_indices[0], lod_indices.size() * sizeof(Vector3u), 1, f);
 	if (bones_info.size())
 		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
+	if (info.num_lods)
+		fwrite((void*)&lods[0], lods.size() * sizeof(sLOD), 1, f);
+	if (info.num_clusters)
+		fwrite((void*)&clusters[0], clusters.size() * sizeof(sCluster), 1, f);
 
 	fclose(f);
 	return true;
@@ -977,121 +1289,42 @@ bool Mesh::loadASE(const char* filename)
 
 bool Mesh::loadOBJ(const char* filename)
 {
-	struct stat stbuffer;
-
-	FILE* f = fopen(filename,"rb");
-	if (f == NULL)
+	sOBJMesh obj;
+	if (!parseOBJ(filename, &obj))
 	{
-		std::cerr << "File not found: " << filename << std::endl;
+		std::cerr << "[ERROR]: OBJ: " << obj.error << ": " << filename << std::endl;
 		return false;
 	}
 
-	stat(filename,&stbuffer);
-
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size+1];
-	fread(data,size,1,f);
-	fclose(f);
-	data[size] = 0;
-
-	char* pos = data;
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
-
-	unsigned int vertex_i = 0;
-
-	//parse file
-	while(*pos != 0)
+	//the parser output is already indexed and deduplicated
+	unsigned int num_vertices = (unsigned int)(obj.positions.size() / 3);
+	vertices.resize(num_vertices);
+	memcpy((void*)&vertices[0], &obj.positions[0], num_vertices * sizeof(Vector3));
+	if (obj.normals.size())
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() == 4)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh
-			if (uvs.size() == 0 && indexed_uvs.size() )
-				uvs.resize(1);
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
+		normals.resize(num_vertices);
+		memcpy((void*)&normals[0], &obj.normals[0], num_vertices * sizeof(Vector3));
+	}
+	if (obj.uvs.size())
+	{
+		uvs.resize(num_vertices);
+		memcpy((void*)&uvs[0], &obj.uvs[0], num_vertices * sizeof(Vector2));
+	}
+	indices.resize(obj.indices.size() / 3);
+	memcpy((void*)&indices[0], &obj.indices[0], indices.size() * sizeof(Vector3u));
 
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
-			}
-		}
+	aabb_min = aabb_max = vertices[0];
+	for (unsigned int i = 1; i < num_vertices; ++i)
+	{
+		aabb_min.setMin(vertices[i]);
+		aabb_max.setMax(vertices[i]);
 	}
 
 	box.center = (aabb_max + aabb_min) * 0.5;
 	box.halfsize = (aabb_max - box.center);
 	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
 
-	material_range.push_back( (unsigned int)(vertices.size() / 3.0) );
+	material_range.push_back( (unsigned int)indices.size() );
 	return true;
 }
 
@@ -1413,94 +1646,139 @@ Mesh* Mesh::Get(const char* filename)
 	if (it != sMeshesLoaded.end())
 		return it->second;
 
+	//stats
+	long time = getTime();
+	std::cout << " + Mesh loading: " << filename << " ... ";
+
 	Mesh* m = new Mesh();
-	std::string name = filename;
+	if (!m->load(filename))
+	{
+		delete m;
+		return NULL;
+	}
 
-	//detect format
-	char file_format = 0;
+	//and upload them to VRAM
+	if (auto_upload_to_vram)
+	{
+		std::cout << "[VRAM] ";
+		m->uploadToVRAM();
+	}
+
+	std::cout << "[OK]  Faces: " << (m->getNumIndices() ? m->getNumIndices() : m->getNumVertices() / 3) << " LODs: " << m->lods.size() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	m->registerMesh(filename);
+	return m;
+}
+
+static char getMeshFormat(const std::string& name)
+{
 	std::string ext = name.substr(name.find_last_of(".")+1);
 	if (ext == "ase" || ext == "ASE")
-		file_format = FORMAT_ASE;
-	else if (ext == "obj" || ext == "OBJ")
-		file_format = FORMAT_OBJ;
-	else if (ext == "mbin" || ext == "MBIN")
-		file_format = FORMAT_MBIN;
-	else if (ext == "mesh" || ext == "MESH")
-		file_format = FORMAT_MESH;
-	else
+		return FORMAT_ASE;
+	if (ext == "obj" || ext == "OBJ")
+		return FORMAT_OBJ;
+	if (ext == "mbin" || ext == "MBIN")
+		return FORMAT_MBIN;
+	if (ext == "mesh" || ext == "MESH")
+		return FORMAT_MESH;
+	return 0;
+}
+
+bool Mesh::load(const char* filename)
+{
+	std::string name = filename;
+
+	//detect format
+	char file_format = getMeshFormat(name);
+	if (!file_format)
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
-	//stats
-	long time = getTime();
-	std::cout << " + Mesh loading: " << filename << " ... ";
 	std::string binfilename = filename;
 
 	if (file_format != FORMAT_MBIN)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if ( m->readBin(binfilename.c_str()) && use_binary )
+	if ( readBin(binfilename.c_str()) && use_binary )
 	{
-		if(interleave_meshes && m->interleaved.size() == 0)
+		std::cout << "[BIN] ";
+		if(interleave_meshes && !isInterleaved())
 		{
 			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
-
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
+			interleaveBuffers();
 		}
+		return true;
+	}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+	//a .mbin of an old version (or missing) is rebuilt from the file it was generated from, next to it
+	if (file_format == FORMAT_MBIN)
+	{
+		name = name.substr(0, name.size() - 5);
+		file_format = getMeshFormat(name);
+		if (file_format == FORMAT_MBIN)
+			file_format = 0;
+		if (file_format)
+			std::cout << "[FROM SOURCE] ";
 	}
 
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(name.c_str());
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(name.c_str());
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(name.c_str());
 
 	if (!loaded)
 	{
-		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		return false;
+	}
+
+	//index and reorder, so the .mbin is written already optimized
+	if (optimize_meshes)
+	{
+		std::cout << "[OPTIM] ";
+		optimize();
+	}
+
+	//triangles grouped for culling
+	if (build_clusters)
+	{
+		std::cout << "[CLUSTERS] ";
+		buildClusters();
+	}
+
+	//simplified versions for the distance, stored in the .mbin too
+	if (generate_lods)
+	{
+		std::cout << "[LODS] ";
+		createLODs();
 	}
 
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
 		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		interleaveBuffers();
 	}
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
+	//smaller vertices, written to the .mbin and uploaded like that
+	if (quantize_meshes)
 	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
+		std::cout << "[QUANT] ";
+		quantize();
 	}
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
-		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
-		std::cout << "[OK]" << std::endl;
+		std::cout << "[WRITE BIN] ";
+		writeBin(name.c_str()); //the source name, writeBin adds the .mbin
 	}
-
-	m->registerMesh(name);
-	return m;
+	return true;
 }
 
 void Mesh::registerMesh( std::string name )
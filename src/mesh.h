@@ -2,16 +2,22 @@
 #define MESH_H
 
 #include <vector>
+#include "includes.h"
 #include "framework.h"
 
 #include <map>
 #include <string>
+#include <atomic>
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class Volume; //for isosurfaces
+class MappedFile; //for binary meshes
+class Camera; //for culling
+class MeshBVH; //for collisions
 
-#define MESH_BIN_VERSION 7 //this is used to regenerate bins if the format changes
+#define MESH_BIN_VERSION 10 //this is used to regenerate bins if the format changes
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -24,6 +30,10 @@ public:
 	static std::map<std::string, Mesh*> sMeshesLoaded;
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
+	static bool optimize_meshes; //loaded meshes will be indexed and reordered for the GPU caches (before writing the .mbin)
+	static bool generate_lods; //loaded meshes will get their levels of detail (before writing the .mbin)
+	static bool quantize_meshes; //loaded meshes will be stored quantized in the .mbin and the VRAM (half the size, lossy)
+	static bool build_clusters; //loaded meshes will be split in clusters for culling (before writing the .mbin)
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
@@ -46,8 +56,44 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
+	//compressed copy of interleaved (see quantize), 16 bytes instead of 32. The float vectors stay as the CPU copy
+	struct tQuantized {
+		Uint16 vertex[4]; //unorm in the quantization box, w unused
+		Uint32 normal; //snorm 10:10:10:2 (GL_INT_2_10_10_10_REV)
+		Uint16 uv[2]; //half floats
+	};
+	std::vector< tQuantized > quantized;
+	std::vector< Vector4ub > quantized_weights; //unorm weights, sum 255
+	Vector3 quantization_offset; //vertex = offset + unorm * scale, the shaders get them as u_vertex_offset and u_vertex_scale
+	Vector3 quantization_scale;
+	bool vram_quantized; //the uploaded interleaved and weights buffers hold the quantized data
+
 	std::vector< Vector3u > indices; //for indexed meshes
 
+	//levels of detail (see createLODs): the triangles of every level use the same vertices, level 0 is indices
+	struct sLOD {
+		unsigned int start; //first triangle in lod_indices
+		unsigned int count; //triangles
+		float error; //object space distance to the full mesh
+		unsigned int material_range[4]; //like material_range (4 max, like the MBIN), relative to start
+	};
+	std::vector< sLOD > lods;
+	std::vector< Vector3u > lod_indices; //triangles of all the levels
+	int render_lod; //level used by render and drawCall, set by whoever renders the mesh (see SceneNode::render)
+
+	//clusters of neighbour triangles of indices (see buildClusters), each one is a contiguous range of a submesh
+	struct sCluster {
+		Vector3 center; //bounding sphere
+		float radius;
+		Vector3 cone_axis; //normal cone: every triangle faces away from p when dot(center - p, cone_axis) >= cone_cutoff * |center - p| + radius
+		float cone_cutoff; //1 when the triangles face too many directions to be culled
+		unsigned int start; //first triangle
+		unsigned int count;
+	};
+	std::vector< sCluster > clusters;
+	std::vector< unsigned int > visible_ranges; //first triangle and count of the clusters that passed cullClusters (contiguous ones merged)
+	bool render_clusters; //drawCall only draws visible_ranges (level 0 only, clipped to the submesh drawn), set by whoever culls (see SceneNode::render)
+
 	//for animated meshes
 	std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
 	std::vector< Vector4 > weights; //tells how much affect every bone
@@ -69,6 +115,17 @@ public:
 	unsigned int interleaved_vbo_id;
 	unsigned int bones_vbo_id;
 	unsigned int weights_vbo_id;
+	unsigned int lod_indices_vbo_id;
+
+	//A .mbin stays mapped after readBin: uploadToVRAM reads the streams from the mapping and the vectors above stay empty
+	//until loadCPUData copies them (collision, editing, writing), so meshes that are only rendered have no CPU copy
+	MappedFile* mapping;
+	const void* mapped_streams[8]; //same order as the MBIN streams: vertices (or interleaved), normals, uvs, colors, indices, bones, weights, lod indices
+	bool mapped_interleaved;
+	bool mapped_quantized; //vertices and weights streams are quantized
+	unsigned int mapped_size; //vertices
+	unsigned int mapped_num_indices; //triangles
+	unsigned int mapped_num_lod_indices; //triangles of all the levels
 
 	Mesh();
 	~Mesh();
@@ -90,17 +147,26 @@ public:
 
 	unsigned int getNumSubmaterials() { return material_name.size(); }
 	unsigned int getNumSubmeshes() { return material_range.size(); }
-	unsigned int getNumVertices() { return interleaved.size() ? interleaved.size() : vertices.size(); }
+	unsigned int getNumVertices() { return mapping ? mapped_size : (interleaved.size() ? interleaved.size() : vertices.size()); }
+	unsigned int getNumIndices() { return mapping ? mapped_num_indices : indices.size(); } //indexed triangles
+	unsigned int getNumLODs() { return lods.size() + 1; } //level 0 included
+	bool isInterleaved() { return mapping ? mapped_interleaved : interleaved.size() != 0; }
+	bool isQuantized() { return mapping ? mapped_quantized : quantized.size() != 0; }
+	bool loadCPUData(); //copies the mapped streams to the vectors and closes the mapping, false if there was nothing mapped
 
 	//collision testing
-	void* collision_model;
-	bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
+	std::atomic<MeshBVH*> collision_model; //built by the first query (from any thread), published with release/acquire
+	bool createCollisionModel();
 	//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
 	bool testRayCollision( Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false );
+	//the closest point to the sphere is searched in object space, so it is only exact if the model has uniform scale
 	bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
 
 	//loader
 	static Mesh* Get(const char* filename);
+	bool load(const char* filename); //everything Get does but the upload, no GL calls (it can run in a worker thread)
+	bool loading; //being filled by a worker thread (see ResourceManager), nothing can use it until it is false
+	bool load_failed; //the worker could not load the file, it stays empty and it is not rendered
 	void registerMesh(std::string name);
 
 	//create help meshes
@@ -111,12 +177,30 @@ public:
 	void createWireBox();
 	void createGrid(float dist);
 	void displace(Image* heightmap, float altitude);
+	//indexed and interleaved surface where the first channel crosses isovalue (as stored), the volume fills the [-1,1] cube like in VolumeMaterial.
+	//macrocell_size > 0 skips the blocks the surface can't cross
+	bool createIsosurface(Volume* volume, float isovalue, unsigned int macrocell_size = 0);
 	static Mesh* getQuad(); //get global quad
 
 
 	//optimize meshes
 	void uploadToVRAM();
 	bool interleaveBuffers();
+	bool quantize(); //fills quantized (and quantized_weights) from interleaved, interleaving first if needed
+	//weldVertices + optimizeVertexCache + optimizeVertexFetch, the result is always indexed
+	bool optimize();
+	bool weldVertices(); //merges identical vertices (all the streams equal) and builds the indices
+	void optimizeVertexCache(unsigned int cache_size = 32); //reorders the triangles of every submesh for the post-transform cache
+	void optimizeVertexFetch(); //vertices in the order the triangles use them, unused ones are removed
+	//quadric simplification, every level has ratio times the triangles of the previous one. Seams (vertices sharing position) are
+	//collapsed along themselves, their corners, borders and submesh boundaries are kept. Stops earlier when a level can't be reduced enough.
+	//Meshes with more than 4 submeshes get no LODs (the MBIN only stores 4 material ranges)
+	bool createLODs(unsigned int max_levels = 4, float ratio = 0.5f);
+	//reorders the triangles of every submesh in clusters of up to max_triangles neighbours with similar normals, with their bounds.
+	//Vertices are reordered too (optimizeVertexFetch)
+	bool buildClusters(unsigned int max_triangles = 128);
+	//fills visible_ranges with the clusters inside the frustum and not backfacing the camera, returns the visible triangles
+	unsigned int cullClusters(Camera* camera, const Matrix44& model, bool backfaces = true);
 
 private:
 	bool loadASE(const char* filename);
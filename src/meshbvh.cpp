@@ -0,0 +1,577 @@
+#include "meshbvh.h"
+#include "mesh.h"
+#include "utils.h"
+#include "threadpool.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHBVH_SSE
+#include <xmmintrin.h>
+#endif
+
+//inlined here, the queries call them millions of times
+static inline float dot3(const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline Vector3 cross3(const Vector3& a, const Vector3& b) { return Vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+static inline Vector3 min3(const Vector3& a, const Vector3& b) { return Vector3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)); }
+static inline Vector3 max3(const Vector3& a, const Vector3& b) { return Vector3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)); }
+
+//squared distance from a point to a box, 0 inside
+static inline float boxDistance2(const Vector3& p, const Vector3& min, const Vector3& max)
+{
+	float dx = std::max(std::max(min.x - p.x, p.x - max.x), 0.0f);
+	float dy = std::max(std::max(min.y - p.y, p.y - max.y), 0.0f);
+	float dz = std::max(std::max(min.z - p.z, p.z - max.z), 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+#define BVH_BINS 16				//candidate split planes per axis are the bin boundaries
+#define BVH_PARALLEL_SIZE 16384	//bigger subtrees are built by the thread pool
+#define BVH_ALL_AXES_SIZE 1024	//smaller nodes are only split along their longest axis
+#define BVH_SAH_MAX_DEPTH 40	//deeper nodes are split by the median, so the depth (and the query stacks) stay bounded
+#define BVH_STACK_SIZE 96
+
+//a ray with everything the box and triangle tests need precomputed
+struct sBVHRay {
+	Vector3 origin;
+	Vector3 direction;
+	Vector3 inv_dir;
+	int kx, ky, kz;		//kz is the dominant axis of the direction
+	float sx, sy, sz;	//shear that aligns the direction with kz
+#ifdef MESHBVH_SSE
+	__m128 origin4;
+	__m128 inv_dir4;
+#endif
+
+	sBVHRay(const Vector3& origin, const Vector3& direction)
+	{
+		this->origin = origin;
+		this->direction = direction;
+		//no infinities, 0 * inf would give NaN in the slabs of the boxes touching the origin
+		for (int a = 0; a < 3; a++)
+			inv_dir.v[a] = 1.0f / (fabsf(direction.v[a]) > 1e-20f ? direction.v[a] : (direction.v[a] < 0.0f ? -1e-20f : 1e-20f));
+		kz = fabsf(direction.x) > fabsf(direction.y) ? (fabsf(direction.x) > fabsf(direction.z) ? 0 : 2) : (fabsf(direction.y) > fabsf(direction.z) ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (direction.v[kz] < 0.0f) //keeps the winding
+			std::swap(kx, ky);
+		sx = direction.v[kx] / direction.v[kz];
+		sy = direction.v[ky] / direction.v[kz];
+		sz = 1.0f / direction.v[kz];
+#ifdef MESHBVH_SSE
+		origin4 = _mm_setr_ps(origin.x, origin.y, origin.z, 0.0f);
+		inv_dir4 = _mm_setr_ps(inv_dir.x, inv_dir.y, inv_dir.z, 0.0f);
+#endif
+	}
+};
+
+//slab test, entry distance or -1 if the ray misses the box before max_t.
+//The exit distance is enlarged by the rounding error of the slabs (Ize 2013) so the boxes of flat triangles are never missed
+static inline float rayBox(const sBVHRay& ray, const MeshBVH::sNode& node, float max_t)
+{
+#ifdef MESHBVH_SSE
+	//the 4th lane reads the next field of the node, it is ignored
+	__m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min.v), ray.origin4), ray.inv_dir4);
+	__m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max.v), ray.origin4), ray.inv_dir4);
+	__m128 near4 = _mm_min_ps(ta, tb), far4 = _mm_max_ps(ta, tb);
+	__m128 t0 = _mm_max_ss(_mm_max_ss(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(2, 2, 2, 2)));
+	__m128 t1 = _mm_min_ss(_mm_min_ss(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(2, 2, 2, 2)));
+	float t_near = std::max(_mm_cvtss_f32(t0), 0.0f);
+	float t_far = std::min(_mm_cvtss_f32(t1) * 1.00000072f, max_t);
+#else
+	float t_near = 0.0f, t_far = 3.4e+38F;
+	for (int a = 0; a < 3; a++)
+	{
+		float ta = (node.min.v[a] - ray.origin.v[a]) * ray.inv_dir.v[a];
+		float tb = (node.max.v[a] - ray.origin.v[a]) * ray.inv_dir.v[a];
+		t_near = std::max(t_near, std::min(ta, tb));
+		t_far = std::min(t_far, std::max(ta, tb));
+	}
+	t_far = std::min(t_far * 1.00000072f, max_t);
+#endif
+	return t_near <= t_far ? t_near : -1.0f;
+}
+
+//watertight test (Woop, Benthin and Wald 2013): the edges are evaluated in a space where the ray is the z axis,
+//so a ray through a shared edge or vertex always hits one of the triangles. Distance along the ray or -1
+static inline float rayTriangle(const sBVHRay& ray, const Vector3* tri, float max_t)
+{
+	Vector3 a = tri[0] - ray.origin, b = tri[1] - ray.origin, c = tri[2] - ray.origin;
+	float ax = a.v[ray.kx] - ray.sx * a.v[ray.kz], ay = a.v[ray.ky] - ray.sy * a.v[ray.kz];
+	float bx = b.v[ray.kx] - ray.sx * b.v[ray.kz], by = b.v[ray.ky] - ray.sy * b.v[ray.kz];
+	float cx = c.v[ray.kx] - ray.sx * c.v[ray.kz], cy = c.v[ray.ky] - ray.sy * c.v[ray.kz];
+
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		return -1.0f;
+	float det = u + v + w;
+	if (det == 0.0f) //seen edge on
+		return -1.0f;
+
+	float t = (u * a.v[ray.kz] + v * b.v[ray.kz] + w * c.v[ray.kz]) * ray.sz / det;
+	return t > 0.0f && t < max_t ? t : -1.0f;
+}
+
+static inline Vector3 triangleNormal(const Vector3* tri)
+{
+	Vector3 n = cross3(tri[1] - tri[0], tri[2] - tri[0]);
+	float length = sqrtf(dot3(n, n));
+	return length > 0.0f ? n * (1.0f / length) : n;
+}
+
+//surface area heuristic, half of the area of the box (the constant does not change the decisions)
+static inline float halfArea(const Vector3& min, const Vector3& max)
+{
+	Vector3 e = max - min;
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+struct sBVHBin {
+	Vector3 min;
+	Vector3 max;
+	unsigned int count;
+	sBVHBin() { min.set(3.4e+38F, 3.4e+38F, 3.4e+38F); max.set(-3.4e+38F, -3.4e+38F, -3.4e+38F); count = 0; }
+	void add(const Vector3& bmin, const Vector3& bmax, unsigned int n) { min = min3(min, bmin); max = max3(max, bmax); count += n; }
+	void add(const sBVHBin& bin) { add(bin.min, bin.max, bin.count); }
+};
+
+//bounds of the triangles and of their centroids in a range
+struct sBVHRange {
+	sBVHBin bounds;
+	sBVHBin centroids;
+	void merge(const sBVHRange& other) { bounds.add(other.bounds); centroids.add(other.centroids); }
+};
+
+struct sBVHBins {
+	sBVHBin bins[3][BVH_BINS];
+	void merge(const sBVHBins& other) { for (int a = 0; a < 3; a++) for (int b = 0; b < BVH_BINS; b++) bins[a][b].add(other.bins[a][b]); }
+};
+
+struct sBVHBuild {
+	std::vector<Vector3> tri_min;
+	std::vector<Vector3> tri_max;
+	std::vector<Vector3> centroids;
+	std::vector<unsigned int> order;
+	unsigned int max_leaf_size;
+
+	int binIndex(unsigned int triangle, int axis, const Vector3& centroid_min, const Vector3& bin_scale) const
+	{
+		int bin = (int)((centroids[triangle].v[axis] - centroid_min.v[axis]) * bin_scale.v[axis]);
+		return std::min(std::max(bin, 0), BVH_BINS - 1);
+	}
+};
+
+//func(result, begin, end) over the range, the big ranges in chunks of the thread pool with their own result merged at the end
+template<class T, class F> static void reduceRange(unsigned int begin, unsigned int end, T& result, const F& func)
+{
+	unsigned int num_chunks = end - begin >= BVH_PARALLEL_SIZE * 4 ? 16 : 1;
+	if (num_chunks == 1)
+	{
+		func(result, begin, end);
+		return;
+	}
+	std::vector<T> partial(num_chunks);
+	unsigned int chunk = (end - begin + num_chunks - 1) / num_chunks;
+	parallelFor(0, (int)num_chunks, [&](int c0, int c1) {
+		for (int c = c0; c < c1; c++)
+			func(partial[c], std::min(end, begin + c * chunk), std::min(end, begin + (c + 1) * chunk));
+	});
+	for (unsigned int c = 0; c < num_chunks; ++c)
+		result.merge(partial[c]);
+}
+
+//appends the subtree of [begin, end) to nodes, the indices of the inner nodes are relative to the start of the vector
+static unsigned int buildNode(sBVHBuild& build, unsigned int begin, unsigned int end, unsigned int depth, std::vector<MeshBVH::sNode>& nodes)
+{
+	unsigned int node_index = (unsigned int)nodes.size();
+	nodes.push_back(MeshBVH::sNode());
+
+	sBVHRange range;
+	reduceRange(begin, end, range, [&](sBVHRange& r, unsigned int b, unsigned int e) {
+		for (unsigned int i = b; i < e; ++i)
+		{
+			unsigned int t = build.order[i];
+			r.bounds.add(build.tri_min[t], build.tri_max[t], 1);
+			r.centroids.add(build.centroids[t], build.centroids[t], 0);
+		}
+	});
+	nodes[node_index].min = range.bounds.min;
+	nodes[node_index].max = range.bounds.max;
+
+	Vector3 extent = range.centroids.max - range.centroids.min;
+	int longest = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	unsigned int count = end - begin;
+	if (count <= build.max_leaf_size || extent.v[longest] <= 0.0f)
+	{
+		nodes[node_index].index = begin;
+		nodes[node_index].count = count;
+		return node_index;
+	}
+
+	//binned SAH: the cost of a split is the area of each side times its triangles
+	unsigned int middle = begin;
+	if (depth < BVH_SAH_MAX_DEPTH)
+	{
+		Vector3 centroid_min = range.centroids.min, bin_scale;
+		for (int a = 0; a < 3; a++)
+			bin_scale.v[a] = extent.v[a] > 0.0f ? BVH_BINS / extent.v[a] * 0.9999f : 0.0f;
+
+		//the small nodes (most of the build time) only try the longest axis
+		int first_axis = count >= BVH_ALL_AXES_SIZE ? 0 : longest;
+		int last_axis = count >= BVH_ALL_AXES_SIZE ? 2 : longest;
+
+		sBVHBins bins;
+		reduceRange(begin, end, bins, [&](sBVHBins& r, unsigned int b, unsigned int e) {
+			for (unsigned int i = b; i < e; ++i)
+			{
+				unsigned int t = build.order[i];
+				for (int a = first_axis; a <= last_axis; a++)
+					r.bins[a][build.binIndex(t, a, centroid_min, bin_scale)].add(build.tri_min[t], build.tri_max[t], 1);
+			}
+		});
+
+		float best_cost = 3.4e+38F;
+		int best_axis = -1, best_bin = 0;
+		for (int a = first_axis; a <= last_axis; a++)
+		{
+			if (extent.v[a] <= 0.0f)
+				continue;
+			float right_cost[BVH_BINS];
+			sBVHBin side;
+			for (int b = BVH_BINS - 1; b > 0; b--)
+			{
+				side.add(bins.bins[a][b]);
+				right_cost[b] = side.count ? halfArea(side.min, side.max) * side.count : 0.0f;
+			}
+			side = sBVHBin();
+			for (int b = 0; b < BVH_BINS - 1; b++)
+			{
+				side.add(bins.bins[a][b]);
+				if (!side.count || side.count == count)
+					continue;
+				float cost = halfArea(side.min, side.max) * side.count + right_cost[b + 1];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = a;
+					best_bin = b;
+				}
+			}
+		}
+
+		if (best_axis != -1)
+			middle = (unsigned int)(std::partition(build.order.begin() + begin, build.order.begin() + end,
+				[&](unsigned int t) { return build.binIndex(t, best_axis, centroid_min, bin_scale) <= best_bin; }) - build.order.begin());
+	}
+
+	//too deep or all the centroids in one bin: median of the longest axis
+	if (middle == begin || middle == end)
+	{
+		middle = (begin + end) / 2;
+		std::nth_element(build.order.begin() + begin, build.order.begin() + middle, build.order.begin() + end,
+			[&](unsigned int a, unsigned int b) { return build.centroids[a].v[longest] < build.centroids[b].v[longest]; });
+	}
+
+	unsigned int second;
+	if (count >= BVH_PARALLEL_SIZE)
+	{
+		//both children in the pool, then they are appended and their inner indices moved
+		std::vector<MeshBVH::sNode> children[2];
+		parallelFor(0, 2, [&](int c0, int c1) {
+			for (int c = c0; c < c1; c++)
+				buildNode(build, c == 0 ? begin : middle, c == 0 ? middle : end, depth + 1, children[c]);
+		});
+		for (int c = 0; c < 2; c++)
+		{
+			unsigned int offset = (unsigned int)nodes.size();
+			if (c == 1)
+				second = offset;
+			for (size_t i = 0; i < children[c].size(); ++i)
+				if (!children[c][i].count)
+					children[c][i].index += offset;
+			nodes.insert(nodes.end(), children[c].begin(), children[c].end());
+		}
+	}
+	else
+	{
+		buildNode(build, begin, middle, depth + 1, nodes);
+		second = buildNode(build, middle, end, depth + 1, nodes);
+	}
+	nodes[node_index].index = second;
+	nodes[node_index].count = 0;
+	return node_index;
+}
+
+//closest point of a triangle by the region of the point (Real-Time Collision Detection, 5.1.5)
+static Vector3 closestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c)
+{
+	Vector3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = dot3(ab, ap), d2 = dot3(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vector3 bp = p - b;
+	float d3 = dot3(ab, bp), d4 = dot3(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vector3 cp = p - c;
+	float d5 = dot3(ab, cp), d6 = dot3(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float sum = va + vb + vc;
+	if (sum <= 0.0f) //degenerated triangle
+		return a;
+	return a + ab * (vb / sum) + ac * (vc / sum);
+}
+
+MeshBVH::MeshBVH()
+{
+	max_leaf_size = 4;
+}
+
+void MeshBVH::clear()
+{
+	nodes.clear();
+	triangles.clear();
+	triangle_ids.clear();
+}
+
+bool MeshBVH::build(Mesh* mesh, unsigned int max_leaf_size)
+{
+	mesh->loadCPUData(); //binary meshes keep their streams in the file mapping
+	std::vector<Vector3> vertices;
+	if (mesh->indices.size()) //indexed
+	{
+		vertices.resize(mesh->indices.size() * 3);
+		for (unsigned int i = 0; i < mesh->indices.size(); ++i)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int index = mesh->indices[i].v[k];
+				vertices[i * 3 + k] = mesh->interleaved.size() ? mesh->interleaved[index].vertex : mesh->vertices[index];
+			}
+	}
+	else if (mesh->interleaved.size()) //is interleaved
+	{
+		vertices.resize(mesh->interleaved.size() - mesh->interleaved.size() % 3);
+		for (unsigned int i = 0; i < vertices.size(); ++i)
+			vertices[i] = mesh->interleaved[i].vertex;
+	}
+	else //non interleaved
+		vertices.assign(mesh->vertices.begin(), mesh->vertices.begin() + (mesh->vertices.size() - mesh->vertices.size() % 3));
+
+	return build(vertices, max_leaf_size);
+}
+
+bool MeshBVH::build(const std::vector<Vector3>& triangle_vertices, unsigned int max_leaf_size)
+{
+	clear();
+	unsigned int num_triangles = (unsigned int)(triangle_vertices.size() / 3);
+	if (!num_triangles)
+		return false;
+
+	long time = getTime();
+	this->max_leaf_size = std::max(max_leaf_size, 1u);
+
+	sBVHBuild build;
+	build.max_leaf_size = this->max_leaf_size;
+	build.order.resize(num_triangles);
+	build.tri_min.resize(num_triangles);
+	build.tri_max.resize(num_triangles);
+	build.centroids.resize(num_triangles);
+	parallelFor(0, (int)num_triangles, [&](int t0, int t1) {
+		for (int i = t0; i < t1; i++) {
+			const Vector3* tri = &triangle_vertices[i * 3];
+			build.order[i] = i;
+			build.tri_min[i] = min3(min3(tri[0], tri[1]), tri[2]);
+			build.tri_max[i] = max3(max3(tri[0], tri[1]), tri[2]);
+			build.centroids[i] = (build.tri_min[i] + build.tri_max[i]) * 0.5f; //of the box, it is what the SAH splits
+		}
+	}, 4096);
+
+	nodes.reserve(2 * num_triangles / this->max_leaf_size + 1);
+	buildNode(build, 0, num_triangles, 0, nodes);
+
+	//leaves point to consecutive triangles
+	triangles.resize(num_triangles * 3);
+	parallelFor(0, (int)num_triangles, [&](int t0, int t1) {
+		for (int i = t0; i < t1; i++)
+			for (int k = 0; k < 3; ++k)
+				triangles[i * 3 + k] = triangle_vertices[build.order[i] * 3 + k];
+	}, 4096);
+	triangle_ids.swap(build.order);
+
+	std::cout << " + BVH: " << num_triangles << " triangles, " << nodes.size() << " nodes in " << (getTime() - time) << "ms" << std::endl;
+	return true;
+}
+
+bool MeshBVH::closestPoint(const Vector3& point, Vector3& closest, float& distance, float max_distance, unsigned int* triangle, Vector3* normal) const
+{
+	if (nodes.empty())
+		return false;
+
+	float best2 = max_distance < 1.8e+19F ? max_distance * max_distance : 3.4e+38F;
+	int best = -1;
+	unsigned int stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size)
+	{
+		const sNode& node = nodes[stack[--stack_size]];
+		if (boxDistance2(point, node.min, node.max) >= best2)
+			continue;
+
+		if (node.count)
+		{
+			for (unsigned int i = node.index; i < node.index + node.count; ++i)
+			{
+				const Vector3* tri = &triangles[i * 3];
+				Vector3 p = closestPointOnTriangle(point, tri[0], tri[1], tri[2]);
+				Vector3 d = p - point;
+				float d2 = dot3(d, d);
+				if (d2 < best2)
+				{
+					best2 = d2;
+					best = i;
+					closest = p;
+				}
+			}
+			continue;
+		}
+
+		//the nearest child is visited first so the farther one is usually culled
+		unsigned int first = (unsigned int)(&node - &nodes[0]) + 1, second = node.index;
+		float d_first = boxDistance2(point, nodes[first].min, nodes[first].max);
+		float d_second = boxDistance2(point, nodes[second].min, nodes[second].max);
+		if (d_first > d_second)
+		{
+			std::swap(first, second);
+			std::swap(d_first, d_second);
+		}
+		if (d_second < best2)
+			stack[stack_size++] = second;
+		if (d_first < best2)
+			stack[stack_size++] = first;
+	}
+
+	if (best == -1)
+		return false;
+	distance = sqrtf(best2);
+	if (triangle)
+		*triangle = triangle_ids[best];
+	if (normal)
+		*normal = triangleNormal(&triangles[best * 3]);
+	return true;
+}
+
+bool MeshBVH::rayCast(const Vector3& origin, const Vector3& direction, float& t, float max_t, unsigned int* triangle, Vector3* normal) const
+{
+	if (nodes.empty())
+		return false;
+
+	sBVHRay ray(origin, direction);
+	float best_t = max_t;
+	int best = -1;
+
+	//nodes with their entry distance, skipped when a nearer hit was found after pushing them
+	struct sEntry { unsigned int node; float t; };
+	sEntry stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	float root_t = rayBox(ray, nodes[0], best_t);
+	if (root_t < 0.0f)
+		return false;
+	stack[stack_size++] = { 0, root_t };
+
+	while (stack_size)
+	{
+		sEntry entry = stack[--stack_size];
+		if (entry.t > best_t)
+			continue;
+		const sNode& node = nodes[entry.node];
+
+		if (node.count)
+		{
+			for (unsigned int i = node.index; i < node.index + node.count; ++i)
+			{
+				float hit = rayTriangle(ray, &triangles[i * 3], best_t);
+				if (hit >= 0.0f)
+				{
+					best_t = hit;
+					best = i;
+				}
+			}
+			continue;
+		}
+
+		//the nearest child is visited first
+		unsigned int first = entry.node + 1, second = node.index;
+		float t_first = rayBox(ray, nodes[first], best_t);
+		float t_second = rayBox(ray, nodes[second], best_t);
+		if (t_second >= 0.0f && (t_first < 0.0f || t_second < t_first))
+		{
+			std::swap(first, second);
+			std::swap(t_first, t_second);
+		}
+		if (t_second >= 0.0f)
+			stack[stack_size++] = { second, t_second };
+		if (t_first >= 0.0f)
+			stack[stack_size++] = { first, t_first };
+	}
+
+	if (best == -1)
+		return false;
+	t = best_t;
+	if (triangle)
+		*triangle = triangle_ids[best];
+	if (normal)
+		*normal = triangleNormal(&triangles[best * 3]);
+	return true;
+}
+
+unsigned int MeshBVH::countRayCrossings(const Vector3& origin, const Vector3& direction) const
+{
+	if (nodes.empty())
+		return 0;
+
+	sBVHRay ray(origin, direction);
+	unsigned int crossings = 0;
+	unsigned int stack[BVH_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size)
+	{
+		const sNode& node = nodes[stack[--stack_size]];
+		if (rayBox(ray, node, 3.4e+38F) < 0.0f)
+			continue;
+
+		if (node.count)
+		{
+			for (unsigned int i = node.index; i < node.index + node.count; ++i)
+				if (rayTriangle(ray, &triangles[i * 3], 3.4e+38F) >= 0.0f)
+					crossings++;
+			continue;
+		}
+
+		stack[stack_size++] = node.index;
+		stack[stack_size++] = (unsigned int)(&node - &nodes[0]) + 1;
+	}
+	return crossings;
+}
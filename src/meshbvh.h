@@ -0,0 +1,46 @@
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include "includes.h"
+#include "framework.h"
+
+#include <vector>
+
+class Mesh;
+
+//Bounding volume hierarchy over the triangles of a mesh (object space) for closest point and ray queries.
+//Nodes are stored depth first in one array: the first child of an inner node is the next node, the second one is at node.index.
+//It is built with the surface area heuristic (binned), the big subtrees in parallel. Ray tests are watertight (no hits lost between triangles).
+class MeshBVH
+{
+public:
+	struct sNode {
+		Vector3 min;
+		Vector3 max;
+		unsigned int index; //leaf: first triangle, inner: second child
+		unsigned int count; //triangles of the leaf, 0 for inner nodes
+	};
+
+	std::vector<sNode> nodes;
+	std::vector<Vector3> triangles;			//3 vertices per triangle, in the order of the leaves
+	std::vector<unsigned int> triangle_ids;	//triangle of the mesh for every triangle of the BVH
+	unsigned int max_leaf_size;
+
+	MeshBVH();
+
+	void clear();
+	bool build(Mesh* mesh, unsigned int max_leaf_size = 4); //indexed, interleaved or plain vertices
+	bool build(const std::vector<Vector3>& triangle_vertices, unsigned int max_leaf_size = 4); //3 vertices per triangle
+
+	bool isBuilt() { return nodes.size() != 0; }
+	unsigned int getNumTriangles() { return (unsigned int)triangle_ids.size(); }
+
+	//point of the surface closest to point, only if it is nearer than max_distance. triangle gets the triangle of the mesh, normal its normalized normal
+	bool closestPoint(const Vector3& point, Vector3& closest, float& distance, float max_distance = 3.4e+38F, unsigned int* triangle = NULL, Vector3* normal = NULL) const;
+	//nearest hit of the ray (any direction length), t in units of direction
+	bool rayCast(const Vector3& origin, const Vector3& direction, float& t, float max_t = 3.4e+38F, unsigned int* triangle = NULL, Vector3* normal = NULL) const;
+	//number of triangles crossed by the ray (t > 0), odd if the origin is inside a closed mesh
+	unsigned int countRayCrossings(const Vector3& origin, const Vector3& direction) const;
+};
+
+#endif
@@ -0,0 +1,907 @@
+//Mesh::optimize: welding, post-transform cache order (Forsyth, "Linear-Speed Vertex Cache Optimisation") and fetch order.
+//Triangles never leave their submesh, so material_range stays valid.
+//Mesh::createLODs: quadric error metrics (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics") with
+//half edge collapses, so every level uses the vertices of the mesh and only has its own triangles.
+//Mesh::buildClusters: greedy growth of neighbour triangles, with bounding spheres and normal cones for culling.
+
+#include "mesh.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+//bytes of every per vertex stream the mesh has
+struct sVertexStream {
+	const Uint8* data;
+	size_t bytes;
+};
+
+template <typename T>
+static void addStream(std::vector<sVertexStream>& streams, const std::vector<T>& stream, size_t num_vertices)
+{
+	if (stream.size() != num_vertices || !num_vertices)
+		return;
+	sVertexStream s;
+	s.data = (const Uint8*)&stream[0];
+	s.bytes = sizeof(T);
+	streams.push_back(s);
+}
+
+template <typename T>
+static void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& new_to_old)
+{
+	if (stream.empty())
+		return;
+	std::vector<T> result(new_to_old.size());
+	for (size_t i = 0; i < new_to_old.size(); ++i)
+		result[i] = stream[new_to_old[i]];
+	stream.swap(result);
+}
+
+static void remapVertices(Mesh* mesh, const std::vector<unsigned int>& new_to_old)
+{
+	remapStream(mesh->interleaved, new_to_old);
+	remapStream(mesh->vertices, new_to_old);
+	remapStream(mesh->normals, new_to_old);
+	remapStream(mesh->uvs, new_to_old);
+	remapStream(mesh->colors, new_to_old);
+	remapStream(mesh->bones, new_to_old);
+	remapStream(mesh->weights, new_to_old);
+	remapStream(mesh->quantized, new_to_old);
+	remapStream(mesh->quantized_weights, new_to_old);
+}
+
+static inline unsigned int hashVertex(const std::vector<sVertexStream>& streams, unsigned int vertex)
+{
+	unsigned int h = 2166136261u; //FNV-1a
+	for (size_t s = 0; s < streams.size(); ++s)
+	{
+		const Uint8* p = streams[s].data + vertex * streams[s].bytes;
+		for (size_t i = 0; i < streams[s].bytes; ++i)
+			h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+static inline bool sameVertex(const std::vector<sVertexStream>& streams, unsigned int a, unsigned int b)
+{
+	for (size_t s = 0; s < streams.size(); ++s)
+		if (memcmp(streams[s].data + a * streams[s].bytes, streams[s].data + b * streams[s].bytes, streams[s].bytes) != 0)
+			return false;
+	return true;
+}
+
+bool Mesh::optimize()
+{
+	if (!weldVertices())
+		return false;
+	optimizeVertexCache();
+	optimizeVertexFetch();
+	return true;
+}
+
+bool Mesh::weldVertices()
+{
+	loadCPUData();
+	unsigned int num_vertices = interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size();
+	if (!num_vertices)
+		return false;
+
+	std::vector<sVertexStream> streams;
+	addStream(streams, interleaved, num_vertices);
+	addStream(streams, vertices, num_vertices);
+	addStream(streams, normals, num_vertices);
+	addStream(streams, uvs, num_vertices);
+	addStream(streams, colors, num_vertices);
+	addStream(streams, bones, num_vertices);
+	addStream(streams, weights, num_vertices);
+
+	//open addressing, the table stores the first vertex found with every content
+	unsigned int table_size = 1;
+	while (table_size < num_vertices * 2)
+		table_size <<= 1;
+	std::vector<unsigned int> table(table_size, 0xFFFFFFFF);
+	std::vector<unsigned int> remap(num_vertices);
+	std::vector<unsigned int> new_to_old;
+	new_to_old.reserve(num_vertices);
+
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		unsigned int slot = hashVertex(streams, i) & (table_size - 1);
+		while (table[slot] != 0xFFFFFFFF && !sameVertex(streams, table[slot], i))
+			slot = (slot + 1) & (table_size - 1);
+		if (table[slot] == 0xFFFFFFFF)
+		{
+			table[slot] = i;
+			remap[i] = (unsigned int)new_to_old.size();
+			new_to_old.push_back(i);
+		}
+		else
+			remap[i] = remap[table[slot]];
+	}
+
+	//triangle soup becomes indexed, existing indices are remapped
+	if (indices.empty())
+	{
+		indices.resize(num_vertices / 3);
+		for (unsigned int i = 0; i < indices.size(); ++i)
+			indices[i] = Vector3u(remap[i * 3], remap[i * 3 + 1], remap[i * 3 + 2]);
+	}
+	else
+		for (unsigned int i = 0; i < indices.size(); ++i)
+			indices[i] = Vector3u(remap[indices[i].x], remap[indices[i].y], remap[indices[i].z]);
+	for (unsigned int i = 0; i < lod_indices.size(); ++i)
+		lod_indices[i] = Vector3u(remap[lod_indices[i].x], remap[lod_indices[i].y], remap[lod_indices[i].z]);
+
+	remapVertices(this, new_to_old);
+	return true;
+}
+
+//score of a vertex from its position in the simulated LRU cache and the triangles that still use it
+static inline float vertexScore(int cache_position, unsigned int active_triangles, unsigned int cache_size)
+{
+	if (active_triangles == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3) //used by the last triangle, fixed so it doesn't get chosen twice in a row
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cache_position - 3) / (float)(cache_size - 3), 1.5f);
+	}
+	//boost the vertices with few triangles left, so lone triangles are not left behind
+	return score + 2.0f / sqrtf((float)active_triangles);
+}
+
+//Forsyth on the triangles [begin, end), appended to result. The per vertex arrays are shared by all the submeshes
+struct sCacheOptimizer {
+	std::vector<unsigned int> active; //triangles not emitted yet of every vertex
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> adjacency; //those triangles, the first active[v] of every vertex
+	std::vector<int> cache_position;
+	std::vector<float> score;
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> next_cache;
+
+	void run(const std::vector<Vector3u>& indices, unsigned int begin, unsigned int end, unsigned int cache_size, std::vector<Vector3u>& result)
+	{
+		unsigned int num_vertices = (unsigned int)active.size();
+		unsigned int num_triangles = end - begin;
+
+		//triangles of every vertex (local triangle index)
+		std::fill(active.begin(), active.end(), 0);
+		for (unsigned int t = begin; t < end; ++t)
+			for (int k = 0; k < 3; ++k)
+				active[indices[t].v[k]]++;
+		offsets[0] = 0;
+		for (unsigned int v = 0; v < num_vertices; ++v)
+			offsets[v + 1] = offsets[v] + active[v];
+		adjacency.resize(num_triangles * 3);
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (unsigned int t = begin; t < end; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[indices[t].v[k]]++] = t - begin;
+
+		for (unsigned int v = 0; v < num_vertices; ++v)
+		{
+			cache_position[v] = -1;
+			score[v] = vertexScore(-1, active[v], cache_size);
+		}
+
+		std::vector<char> emitted(num_triangles, 0);
+		cache.clear();
+		unsigned int next_unemitted = 0;
+		int best = -1;
+		for (unsigned int emitted_count = 0; emitted_count < num_triangles; ++emitted_count)
+		{
+			//no cached vertex has triangles left: take the next one in the original order
+			if (best == -1)
+			{
+				while (emitted[next_unemitted])
+					next_unemitted++;
+				best = next_unemitted;
+			}
+
+			const Vector3u& tri = indices[begin + best];
+			result.push_back(tri);
+			emitted[best] = 1;
+
+			//remove it from the lists of its vertices
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = tri.v[k];
+				unsigned int* list = &adjacency[offsets[v]];
+				unsigned int count = active[v];
+				for (unsigned int i = 0; i < count; ++i)
+					if (list[i] == (unsigned int)best)
+					{
+						list[i] = list[count - 1];
+						break;
+					}
+				active[v]--;
+			}
+
+			//its vertices go to the front of the cache
+			next_cache.clear();
+			for (int k = 0; k < 3; ++k)
+				next_cache.push_back(tri.v[k]);
+			for (size_t i = 0; i < cache.size(); ++i)
+				if (cache[i] != tri.x && cache[i] != tri.y && cache[i] != tri.z)
+					next_cache.push_back(cache[i]);
+
+			//scores change for the vertices in the cache and the ones that just left it
+			for (size_t i = 0; i < next_cache.size(); ++i)
+			{
+				unsigned int v = next_cache[i];
+				cache_position[v] = i < cache_size ? (int)i : -1;
+				score[v] = vertexScore(cache_position[v], active[v], cache_size);
+			}
+			if (next_cache.size() > cache_size)
+				next_cache.resize(cache_size);
+			cache.swap(next_cache);
+
+			//the next triangle is the best one using a cached vertex
+			best = -1;
+			float best_score = -1.0f;
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				unsigned int v = cache[i];
+				for (unsigned int j = 0; j < active[v]; ++j)
+				{
+					unsigned int t = adjacency[offsets[v] + j];
+					const Vector3u& other = indices[begin + t];
+					float s = score[other.x] + score[other.y] + score[other.z];
+					if (s > best_score)
+					{
+						best_score = s;
+						best = t;
+					}
+				}
+			}
+		}
+	}
+};
+
+void Mesh::optimizeVertexCache(unsigned int cache_size)
+{
+	unsigned int num_vertices = getNumVertices();
+	if (indices.empty() || !num_vertices || cache_size < 4)
+		return;
+
+	sCacheOptimizer optimizer;
+	optimizer.active.resize(num_vertices);
+	optimizer.offsets.resize(num_vertices + 1);
+	optimizer.cache_position.resize(num_vertices);
+	optimizer.score.resize(num_vertices);
+
+	//every submesh on its own, the triangles after the last range (if any) too
+	std::vector<unsigned int> ranges = material_range;
+	if (ranges.empty() || ranges.back() < indices.size())
+		ranges.push_back((unsigned int)indices.size());
+
+	std::vector<Vector3u> result;
+	result.reserve(indices.size());
+	unsigned int begin = 0;
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		unsigned int end = std::min(ranges[r], (unsigned int)indices.size());
+		if (end > begin)
+		{
+			optimizer.run(indices, begin, end, cache_size, result);
+			begin = end;
+		}
+	}
+
+	indices.swap(result);
+	clusters.clear(); //they were ranges of the old order
+}
+
+void Mesh::optimizeVertexFetch()
+{
+	unsigned int num_vertices = getNumVertices();
+	if (indices.empty() || !num_vertices)
+		return;
+
+	//first use order
+	std::vector<unsigned int> remap(num_vertices, 0xFFFFFFFF);
+	std::vector<unsigned int> new_to_old;
+	new_to_old.reserve(num_vertices);
+	for (unsigned int i = 0; i < indices.size(); ++i)
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int& index = indices[i].v[k];
+			if (remap[index] == 0xFFFFFFFF)
+			{
+				remap[index] = (unsigned int)new_to_old.size();
+				new_to_old.push_back(index);
+			}
+			index = remap[index];
+		}
+	//the levels only use vertices of the full mesh
+	for (unsigned int i = 0; i < lod_indices.size(); ++i)
+		lod_indices[i] = Vector3u(remap[lod_indices[i].x], remap[lod_indices[i].y], remap[lod_indices[i].z]);
+
+	remapVertices(this, new_to_old);
+}
+
+//sum of squared distances to planes (a,b,c,d), weighted by the area of their triangles
+struct sQuadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double weight;
+
+	void setPlane(const Vector3& p0, const Vector3& p1, const Vector3& p2)
+	{
+		Vector3 n = (p1 - p0).cross(p2 - p0);
+		double area = n.length() * 0.5;
+		memset(this, 0, sizeof(sQuadric));
+		if (area <= 0.0)
+			return;
+		double a = n.x / (area * 2.0), b = n.y / (area * 2.0), c = n.z / (area * 2.0);
+		double d = -(a * p0.x + b * p0.y + c * p0.z);
+		a2 = a * a * area; ab = a * b * area; ac = a * c * area; ad = a * d * area;
+		b2 = b * b * area; bc = b * c * area; bd = b * d * area;
+		c2 = c * c * area; cd = c * d * area;
+		d2 = d * d * area;
+		weight = area;
+	}
+
+	void add(const sQuadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		weight += q.weight;
+	}
+
+	double evaluate(const Vector3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double result = a2 * x * x + b2 * y * y + c2 * z * z + 2.0 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z) + d2;
+		return result > 0.0 ? result : 0.0;
+	}
+};
+
+struct sCollapse {
+	unsigned int from;
+	unsigned int to;
+	double cost;
+	bool operator < (const sCollapse& c) const { return cost < c.cost; }
+};
+
+//Collapses edges of the triangles until there are target of them. The quadrics of the full mesh are kept between calls,
+//so the error of every level is measured against level 0.
+//The vertices in the same position (uv or normal seams, flat shading) are one group and collapses move whole groups: every copy
+//goes to the copy of the target it shares a triangle with, or to the target of another copy with its same uv (the seam was only
+//of normals). So seams collapse along themselves and their corners (where that is not possible) stay
+struct sSimplifier {
+	const std::vector<Vector3>& positions;
+	const std::vector<Vector2>& uvs; //empty if the mesh has none
+	std::vector<unsigned int> group; //first vertex in the position of every vertex, the quadrics and flags below are per group
+	std::vector<unsigned int> group_offsets; //copies of a group are group_copies[group_offsets[g], group_offsets[g + 1])
+	std::vector<unsigned int> group_copies;
+	std::vector<sQuadric> quadrics;
+	std::vector<char> locked;
+	float error; //biggest collapse so far (distance)
+
+	//per pass
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> adjacency; //triangles of every vertex
+	std::vector<unsigned int> remap;
+	std::vector<char> touched;
+	std::vector<unsigned int> stamp;
+	unsigned int current_stamp;
+	std::vector<unsigned int> targets; //per copy of the collapse being checked
+	std::vector<char> adjacent; //the copy has a triangle with the target
+
+	sSimplifier(const std::vector<Vector3>& positions, const std::vector<Vector2>& uvs, const std::vector<Vector3u>& triangles, const std::vector<unsigned char>& submesh) : positions(positions), uvs(uvs)
+	{
+		unsigned int num_vertices = (unsigned int)positions.size();
+		error = 0.0f;
+		current_stamp = 0;
+		quadrics.resize(num_vertices);
+		memset(&quadrics[0], 0, sizeof(sQuadric) * num_vertices);
+		locked.resize(num_vertices, 0);
+		offsets.resize(num_vertices + 1);
+		remap.resize(num_vertices);
+		touched.resize(num_vertices);
+		stamp.resize(num_vertices, 0);
+		targets.resize(num_vertices);
+		adjacent.resize(num_vertices);
+
+		//groups of vertices in the same position
+		std::vector<unsigned int> order(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+			const Vector3& pa = positions[a];
+			const Vector3& pb = positions[b];
+			return pa.x < pb.x || (pa.x == pb.x && (pa.y < pb.y || (pa.y == pb.y && (pa.z < pb.z || (pa.z == pb.z && a < b)))));
+		});
+		group.resize(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+		{
+			const Vector3& pa = positions[order[i > 0 ? i - 1 : 0]];
+			const Vector3& pb = positions[order[i]];
+			group[order[i]] = (i > 0 && pa.x == pb.x && pa.y == pb.y && pa.z == pb.z) ? group[order[i - 1]] : order[i];
+		}
+		group_offsets.assign(num_vertices + 1, 0);
+		for (unsigned int v = 0; v < num_vertices; ++v)
+			group_offsets[group[v] + 1]++;
+		for (unsigned int v = 0; v < num_vertices; ++v)
+			group_offsets[v + 1] += group_offsets[v];
+		group_copies.resize(num_vertices);
+		std::vector<unsigned int> fill(group_offsets.begin(), group_offsets.end() - 1);
+		for (unsigned int v = 0; v < num_vertices; ++v)
+			group_copies[fill[group[v]]++] = v;
+
+		for (size_t t = 0; t < triangles.size(); ++t)
+		{
+			const Vector3u& tri = triangles[t];
+			sQuadric q;
+			q.setPlane(positions[tri.x], positions[tri.y], positions[tri.z]);
+			for (int k = 0; k < 3; ++k)
+				quadrics[group[tri.v[k]]].add(q);
+		}
+
+		//borders and non manifold edges (between positions, seams are not borders): the half edge has no single opposite one
+		std::vector<unsigned long long> edges;
+		edges.reserve(triangles.size() * 3);
+		for (size_t t = 0; t < triangles.size(); ++t)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int a = group[triangles[t].v[k]], b = group[triangles[t].v[(k + 1) % 3]];
+				if (a != b)
+					edges.push_back(((unsigned long long)a << 32) | b);
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)edges[i];
+			unsigned long long opposite = ((unsigned long long)b << 32) | a;
+			std::pair<std::vector<unsigned long long>::iterator, std::vector<unsigned long long>::iterator> range = std::equal_range(edges.begin(), edges.end(), opposite);
+			bool repeated = (i > 0 && edges[i - 1] == edges[i]) || (i + 1 < edges.size() && edges[i + 1] == edges[i]);
+			if (range.second - range.first != 1 || repeated)
+				locked[a] = locked[b] = 1;
+		}
+
+		//positions between submeshes
+		std::vector<int> group_submesh(num_vertices, -1);
+		for (size_t t = 0; t < triangles.size(); ++t)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int g = group[triangles[t].v[k]];
+				if (group_submesh[g] == -1)
+					group_submesh[g] = submesh[t];
+				else if (group_submesh[g] != submesh[t])
+					locked[g] = 1;
+			}
+	}
+
+	bool sameUV(unsigned int a, unsigned int b) const
+	{
+		return uvs.empty() || (uvs[a].x == uvs[b].x && uvs[a].y == uvs[b].y);
+	}
+
+	//finds the target of every copy of from (in targets), the triangles around from don't fold over when it moves to to,
+	//and from-to is not the only link between two parts
+	bool canCollapse(const std::vector<Vector3u>& triangles, unsigned int from, unsigned int to)
+	{
+		const unsigned int none = 0xFFFFFFFF;
+		unsigned int first = group_offsets[from], last = group_offsets[from + 1];
+		for (unsigned int i = first; i < last; ++i)
+		{
+			unsigned int copy = group_copies[i];
+			unsigned int target = none;
+			for (unsigned int j = offsets[copy]; j < offsets[copy + 1]; ++j)
+			{
+				const Vector3u& tri = triangles[adjacency[j]];
+				for (int k = 0; k < 3; ++k)
+					if (group[tri.v[k]] == to)
+					{
+						if (target != none && target != tri.v[k])
+							return false; //it touches two copies of to, no single one keeps its attributes
+						target = tri.v[k];
+					}
+			}
+			targets[i] = target;
+			adjacent[i] = target != none;
+		}
+		for (unsigned int i = first; i < last; ++i)
+		{
+			unsigned int copy = group_copies[i];
+			if (adjacent[i] || offsets[copy] == offsets[copy + 1])
+				continue; //unused copies in this level stay
+			for (unsigned int j = first; j < last && targets[i] == none; ++j)
+				if (adjacent[j] && sameUV(copy, group_copies[j]))
+					targets[i] = targets[j];
+			if (targets[i] == none)
+				return false; //a uv seam leaving the edge, or a seam corner
+		}
+
+		const Vector3& target = positions[to];
+		current_stamp++;
+		for (unsigned int i = first; i < last; ++i)
+		{
+			unsigned int copy = group_copies[i];
+			for (unsigned int j = offsets[copy]; j < offsets[copy + 1]; ++j)
+			{
+				const Vector3u& tri = triangles[adjacency[j]];
+				bool disappears = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					stamp[group[tri.v[k]]] = current_stamp;
+					disappears |= group[tri.v[k]] == to;
+				}
+				if (disappears)
+					continue;
+				Vector3 p[3] = { positions[tri.x], positions[tri.y], positions[tri.z] };
+				Vector3 old_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+				for (int k = 0; k < 3; ++k)
+					if (group[tri.v[k]] == from)
+						p[k] = target;
+				Vector3 new_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+				if (old_normal.dot(new_normal) <= 0.25 * old_normal.length() * new_normal.length())
+					return false;
+			}
+		}
+
+		//link condition: from and to can only share the positions of the two triangles of their edge
+		unsigned int shared = 0;
+		stamp[from] = stamp[to] = 0;
+		for (unsigned int i = group_offsets[to]; i < group_offsets[to + 1]; ++i)
+		{
+			unsigned int copy = group_copies[i];
+			for (unsigned int j = offsets[copy]; j < offsets[copy + 1]; ++j)
+			{
+				const Vector3u& tri = triangles[adjacency[j]];
+				for (int k = 0; k < 3; ++k)
+					if (stamp[group[tri.v[k]]] == current_stamp)
+					{
+						stamp[group[tri.v[k]]] = 0; //counted once
+						shared++;
+					}
+			}
+		}
+		return shared <= 2;
+	}
+
+	//touched gets the groups of the triangles around every copy of g
+	void touchAround(const std::vector<Vector3u>& triangles, unsigned int g)
+	{
+		for (unsigned int i = group_offsets[g]; i < group_offsets[g + 1]; ++i)
+		{
+			unsigned int copy = group_copies[i];
+			for (unsigned int j = offsets[copy]; j < offsets[copy + 1]; ++j)
+				for (int k = 0; k < 3; ++k)
+					touched[group[triangles[adjacency[j]].v[k]]] = 1;
+		}
+	}
+
+	void simplify(std::vector<Vector3u>& triangles, std::vector<unsigned char>& submesh, unsigned int target)
+	{
+		unsigned int num_vertices = (unsigned int)positions.size();
+		std::vector<sCollapse> collapses;
+
+		while (triangles.size() > target)
+		{
+			//triangles of every vertex
+			std::fill(offsets.begin(), offsets.end(), 0);
+			for (size_t t = 0; t < triangles.size(); ++t)
+				for (int k = 0; k < 3; ++k)
+					offsets[triangles[t].v[k] + 1]++;
+			for (unsigned int v = 0; v < num_vertices; ++v)
+				offsets[v + 1] += offsets[v];
+			adjacency.resize(triangles.size() * 3);
+			std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t t = 0; t < triangles.size(); ++t)
+				for (int k = 0; k < 3; ++k)
+					adjacency[fill[triangles[t].v[k]]++] = (unsigned int)t;
+
+			//every half edge is the collapse of the group of its first vertex to the one of the second
+			collapses.clear();
+			for (size_t t = 0; t < triangles.size(); ++t)
+				for (int k = 0; k < 3; ++k)
+				{
+					sCollapse c;
+					c.from = group[triangles[t].v[k]];
+					c.to = group[triangles[t].v[(k + 1) % 3]];
+					if (locked[c.from] || c.from == c.to)
+						continue;
+					c.cost = quadrics[c.from].evaluate(positions[c.to]) + quadrics[c.to].evaluate(positions[c.to]);
+					collapses.push_back(c);
+				}
+			std::sort(collapses.begin(), collapses.end());
+
+			//the cheapest ones that don't share triangles, a collapse removes two triangles
+			unsigned int max_collapses = std::max(1u, (unsigned int)(triangles.size() - target + 1) / 2);
+			unsigned int applied = 0;
+			for (unsigned int v = 0; v < num_vertices; ++v)
+				remap[v] = v;
+			std::fill(touched.begin(), touched.end(), 0);
+			for (size_t i = 0; i < collapses.size() && applied < max_collapses; ++i)
+			{
+				const sCollapse& c = collapses[i];
+				if (touched[c.from] || touched[c.to] || !canCollapse(triangles, c.from, c.to))
+					continue;
+				for (unsigned int j = group_offsets[c.from]; j < group_offsets[c.from + 1]; ++j)
+					if (targets[j] != 0xFFFFFFFF)
+						remap[group_copies[j]] = targets[j];
+				//nothing around both ends changes again in this pass, so the checks above stay valid
+				touchAround(triangles, c.from);
+				touchAround(triangles, c.to);
+				quadrics[c.to].add(quadrics[c.from]);
+				float distance = (float)sqrt(c.cost / std::max(quadrics[c.to].weight, 1e-12));
+				error = std::max(error, distance);
+				applied++;
+			}
+			if (!applied)
+				break;
+
+			//the triangles that lost an edge go away
+			size_t count = 0;
+			for (size_t t = 0; t < triangles.size(); ++t)
+			{
+				Vector3u tri(remap[triangles[t].x], remap[triangles[t].y], remap[triangles[t].z]);
+				if (group[tri.x] == group[tri.y] || group[tri.y] == group[tri.z] || group[tri.x] == group[tri.z])
+					continue;
+				triangles[count] = tri;
+				submesh[count] = submesh[t];
+				count++;
+			}
+			triangles.resize(count);
+			submesh.resize(count);
+		}
+	}
+};
+
+bool Mesh::createLODs(unsigned int max_levels, float ratio)
+{
+	loadCPUData();
+	lods.clear();
+	lod_indices.clear();
+	if (indices.empty() && !weldVertices())
+		return false;
+	if (material_range.size() > 4) //sLOD::material_range has the 4 ranges the MBIN can store
+	{
+		std::cout << "[WARN] LODs: more than 4 submeshes, no LODs: " << name << std::endl;
+		return false;
+	}
+
+	unsigned int num_vertices = getNumVertices();
+	std::vector<Vector3> positions(num_vertices);
+	std::vector<Vector2> vertex_uvs;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+	if (interleaved.size())
+	{
+		vertex_uvs.resize(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			vertex_uvs[i] = interleaved[i].uv;
+	}
+	else if (uvs.size() == num_vertices)
+		vertex_uvs = uvs;
+
+	//submesh of every triangle, the triangles after the last range go to the last one
+	std::vector<unsigned char> submesh(indices.size(), 0);
+	unsigned int num_submeshes = std::max(1u, (unsigned int)material_range.size());
+	for (unsigned int i = 0, s = 0; i < indices.size(); ++i)
+	{
+		while (s + 1 < num_submeshes && i >= material_range[s])
+			s++;
+		submesh[i] = (unsigned char)s;
+	}
+
+	sSimplifier simplifier(positions, vertex_uvs, indices, submesh);
+	sCacheOptimizer optimizer;
+	optimizer.active.resize(num_vertices);
+	optimizer.offsets.resize(num_vertices + 1);
+	optimizer.cache_position.resize(num_vertices);
+	optimizer.score.resize(num_vertices);
+
+	std::vector<Vector3u> triangles = indices;
+	std::vector<Vector3u> sorted;
+	for (unsigned int level = 0; level < max_levels; ++level)
+	{
+		unsigned int previous = (unsigned int)triangles.size();
+		unsigned int target = (unsigned int)(previous * ratio);
+		if (target < 8)
+			break;
+		simplifier.simplify(triangles, submesh, target);
+		//mostly locked vertices, another level would look the same
+		if (triangles.size() > previous - (previous - target) / 2)
+			break;
+
+		//contiguous submeshes, each one ordered for the vertex cache
+		sLOD lod;
+		memset(&lod, 0, sizeof(lod));
+		lod.start = (unsigned int)lod_indices.size();
+		lod.count = (unsigned int)triangles.size();
+		lod.error = simplifier.error;
+		sorted.clear();
+		for (unsigned int s = 0; s < num_submeshes; ++s)
+		{
+			unsigned int begin = (unsigned int)sorted.size();
+			for (size_t t = 0; t < triangles.size(); ++t)
+				if (submesh[t] == s)
+					sorted.push_back(triangles[t]);
+			if (s < material_range.size())
+				lod.material_range[s] = (unsigned int)sorted.size();
+			if (sorted.size() > begin)
+				optimizer.run(sorted, begin, (unsigned int)sorted.size(), 32, lod_indices);
+		}
+		lods.push_back(lod);
+	}
+
+	return lods.size() != 0;
+}
+
+bool Mesh::buildClusters(unsigned int max_triangles)
+{
+	loadCPUData();
+	clusters.clear();
+	if (indices.empty() || max_triangles == 0)
+		return false;
+
+	unsigned int num_vertices = getNumVertices();
+	unsigned int num_triangles = (unsigned int)indices.size();
+	std::vector<Vector3> positions(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+
+	//centroid, unit normal and area of every triangle
+	std::vector<Vector3> centroids(num_triangles);
+	std::vector<Vector3> normals(num_triangles);
+	std::vector<float> areas(num_triangles);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+	{
+		const Vector3u& tri = indices[t];
+		const Vector3& a = positions[tri.x];
+		const Vector3& b = positions[tri.y];
+		const Vector3& c = positions[tri.z];
+		centroids[t] = (a + b + c) * (1.0f / 3.0f);
+		Vector3 n = (b - a).cross(c - a);
+		float length = (float)n.length();
+		areas[t] = length * 0.5f;
+		normals[t] = length > 0.0f ? n * (1.0f / length) : Vector3(0, 0, 0);
+	}
+
+	//triangles of every vertex
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+			offsets[indices[t].v[k] + 1]++;
+	for (unsigned int v = 0; v < num_vertices; ++v)
+		offsets[v + 1] += offsets[v];
+	std::vector<unsigned int> adjacency(num_triangles * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t].v[k]]++] = t;
+
+	sCacheOptimizer optimizer;
+	optimizer.active.resize(num_vertices);
+	optimizer.offsets.resize(num_vertices + 1);
+	optimizer.cache_position.resize(num_vertices);
+	optimizer.score.resize(num_vertices);
+
+	std::vector<unsigned int> ranges = material_range;
+	if (ranges.empty() || ranges.back() < num_triangles)
+		ranges.push_back(num_triangles);
+
+	std::vector<Vector3u> result;
+	result.reserve(num_triangles);
+	std::vector<char> assigned(num_triangles, 0);
+	std::vector<unsigned int> frontier_stamp(num_triangles, 0);
+	std::vector<unsigned int> frontier;
+	std::vector<unsigned int> members;
+	std::vector<Vector3u> cluster_triangles;
+	unsigned int stamp = 0;
+
+	unsigned int begin = 0;
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		unsigned int end = std::min(ranges[r], num_triangles);
+		unsigned int next_seed = begin;
+		while (true)
+		{
+			while (next_seed < end && assigned[next_seed])
+				next_seed++;
+			if (next_seed >= end)
+				break;
+
+			//grow from the seed: the frontier triangle nearest to the cluster and facing like it
+			stamp++;
+			members.clear();
+			frontier.clear();
+			frontier.push_back(next_seed);
+			frontier_stamp[next_seed] = stamp;
+			Vector3 centroid_sum(0, 0, 0);
+			Vector3 normal_sum(0, 0, 0);
+			while (members.size() < max_triangles && frontier.size())
+			{
+				size_t best = 0;
+				if (members.size())
+				{
+					Vector3 center = centroid_sum * (1.0f / members.size());
+					float normal_length = (float)normal_sum.length();
+					Vector3 axis = normal_length > 0.0f ? normal_sum * (1.0f / normal_length) : Vector3(0, 0, 0);
+					float best_score = 3.4e+38F;
+					for (size_t i = 0; i < frontier.size(); ++i)
+					{
+						unsigned int t = frontier[i];
+						float score = (float)(centroids[t] - center).length() * (2.0f - normals[t].dot(axis));
+						if (score < best_score)
+						{
+							best_score = score;
+							best = i;
+						}
+					}
+				}
+				unsigned int t = frontier[best];
+				frontier[best] = frontier.back();
+				frontier.pop_back();
+
+				assigned[t] = 1;
+				members.push_back(t);
+				centroid_sum = centroid_sum + centroids[t];
+				normal_sum = normal_sum + normals[t] * areas[t];
+				for (int k = 0; k < 3; ++k)
+				{
+					unsigned int v = indices[t].v[k];
+					for (unsigned int i = offsets[v]; i < offsets[v + 1]; ++i)
+					{
+						unsigned int n = adjacency[i];
+						if (n >= begin && n < end && !assigned[n] && frontier_stamp[n] != stamp)
+						{
+							frontier_stamp[n] = stamp;
+							frontier.push_back(n);
+						}
+					}
+				}
+			}
+
+			sCluster cluster;
+			cluster.start = (unsigned int)result.size();
+			cluster.count = (unsigned int)members.size();
+
+			//bounding sphere around the box of its vertices
+			Vector3 min_pos = positions[indices[members[0]].x];
+			Vector3 max_pos = min_pos;
+			for (size_t i = 0; i < members.size(); ++i)
+				for (int k = 0; k < 3; ++k)
+				{
+					min_pos.setMin(positions[indices[members[i]].v[k]]);
+					max_pos.setMax(positions[indices[members[i]].v[k]]);
+				}
+			cluster.center = (min_pos + max_pos) * 0.5f;
+			cluster.radius = 0.0f;
+			for (size_t i = 0; i < members.size(); ++i)
+				for (int k = 0; k < 3; ++k)
+					cluster.radius = std::max(cluster.radius, (float)(positions[indices[members[i]].v[k]] - cluster.center).length());
+
+			//normal cone, only usable when all the triangles face the same side
+			float normal_length = (float)normal_sum.length();
+			cluster.cone_axis = normal_length > 0.0f ? normal_sum * (1.0f / normal_length) : Vector3(0, 0, 0);
+			float min_dot = normal_length > 0.0f ? 1.0f : -1.0f;
+			for (size_t i = 0; i < members.size(); ++i)
+				if (areas[members[i]] > 0.0f)
+					min_dot = std::min(min_dot, normals[members[i]].dot(cluster.cone_axis));
+			cluster.cone_cutoff = min_dot <= 0.1f ? 1.0f : sqrtf(1.0f - min_dot * min_dot);
+			clusters.push_back(cluster);
+
+			//its triangles, ordered for the vertex cache
+			cluster_triangles.clear();
+			for (size_t i = 0; i < members.size(); ++i)
+				cluster_triangles.push_back(indices[members[i]]);
+			optimizer.run(cluster_triangles, 0, (unsigned int)cluster_triangles.size(), 32, result);
+		}
+		begin = end;
+	}
+
+	indices.swap(result);
+	optimizeVertexFetch();
+	return true;
+}
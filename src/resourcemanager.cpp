@@ -0,0 +1,206 @@
+#include "resourcemanager.h"
+#include "threadpool.h"
+#include "mesh.h"
+#include "texture.h"
+#include "utils.h"
+#include "extra/hdre.h"
+
+#include <chrono>
+#include <thread>
+
+ResourceManager::ResourceManager(unsigned int num_threads)
+{
+	upload_budget_ms = 4.0f;
+	num_pending = 0;
+	pool = new ThreadPool(num_threads);
+}
+
+ResourceManager::~ResourceManager()
+{
+	delete pool; //joins the workers, the uploads left are discarded
+}
+
+ResourceManager* ResourceManager::getInstance()
+{
+	static ResourceManager* instance = NULL;
+	if (!instance)
+		instance = new ResourceManager();
+	return instance;
+}
+
+void ResourceManager::addUpload(const std::function<void()>& upload)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uploads.push_back(upload);
+}
+
+Texture* ResourceManager::createPlaceholder(bool cubemap)
+{
+	//every handle has its own, the real content replaces it in the same texture id
+	Uint8 white[3] = { 255,255,255 };
+	Texture* texture = new Texture();
+	if (cubemap)
+	{
+		Uint8* faces[6] = { white, white, white, white, white, white };
+		texture->createCubemap(1, 1, faces, GL_RGB, GL_UNSIGNED_BYTE, false);
+	}
+	else
+		texture->create(1, 1, GL_RGB, GL_UNSIGNED_BYTE, false, white);
+	return texture;
+}
+
+Mesh* ResourceManager::getMesh(const char* filename)
+{
+	assert(filename);
+	std::map<std::string, Mesh*>::iterator it = Mesh::sMeshesLoaded.find(filename);
+	if (it != Mesh::sMeshesLoaded.end())
+		return it->second;
+
+	Mesh* mesh = new Mesh();
+	mesh->loading = true;
+	mesh->registerMesh(filename);
+	num_pending++;
+
+	std::string name = filename;
+	long time = getTime();
+	pool->enqueue([this, mesh, name, time]() {
+		bool loaded = mesh->load(name.c_str());
+		addUpload([this, mesh, name, time, loaded]() {
+			if (!loaded)
+			{
+				std::cout << "[ERROR]: Mesh not loaded: " << name << std::endl;
+				mesh->load_failed = true;
+			}
+			else
+			{
+				if (Mesh::auto_upload_to_vram)
+					mesh->uploadToVRAM();
+				std::cout << " + Mesh loaded: " << name << " [OK]  Faces: " << (mesh->getNumIndices() ? mesh->getNumIndices() : mesh->getNumVertices() / 3) << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+			}
+			mesh->loading = false;
+			num_pending--;
+		});
+	});
+	return mesh;
+}
+
+Texture* ResourceManager::getTexture(const char* filename, bool mipmaps, unsigned int wrap)
+{
+	assert(filename);
+	auto it = Texture::sTexturesLoaded.find(filename);
+	if (it != Texture::sTexturesLoaded.end())
+		return it->second;
+
+	Texture* texture = createPlaceholder(false);
+	texture->filename = filename;
+	texture->setName(filename);
+	num_pending++;
+
+	std::string name = filename;
+	long time = getTime();
+	pool->enqueue([this, texture, name, mipmaps, wrap, time]() {
+		std::string ext = name.size() > 4 ? name.substr(name.size() - 4, 4) : "";
+		Image* image = new Image();
+		bool found = false;
+		if (ext == ".tga" || ext == ".TGA")
+			found = image->loadTGA(name.c_str());
+		else if (ext == ".png" || ext == ".PNG")
+			found = image->loadPNG(name.c_str(), true);
+
+		addUpload([this, texture, name, mipmaps, wrap, time, image, found]() {
+			if (!found)
+				std::cout << "[ERROR]: Texture not loaded: " << name << std::endl; //the placeholder stays
+			else
+			{
+				texture->create(image->width, image->height, (image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA), GL_UNSIGNED_BYTE, mipmaps, image->data, 0, wrap);
+				if (mipmaps)
+					texture->generateMipmaps();
+				std::cout << " + Texture loaded: " << name << " [OK] Size: " << texture->width << "x" << texture->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+			}
+			delete image;
+			num_pending--;
+		});
+	});
+	return texture;
+}
+
+std::vector<Texture*> ResourceManager::getHDRECubemaps(const char* filename, unsigned int num_levels)
+{
+	assert(filename);
+	std::vector<Texture*> textures;
+	for (unsigned int i = 0; i < num_levels; ++i)
+		textures.push_back(createPlaceholder(true));
+
+	//one upload per level, so a frame does not upload the whole environment
+	num_pending += num_levels;
+	std::string name = filename;
+	auto uploadLevels = [this, textures, name](HDRE* hdre) {
+		for (unsigned int i = 0; i < textures.size(); ++i)
+			addUpload([this, textures, name, hdre, i]() {
+				if (!hdre)
+				{
+					if (i == 0)
+						std::cout << "[ERROR]: HDRE not loaded: " << name << std::endl; //the placeholders stay
+				}
+				else
+				{
+					if (i == 0)
+						hdre->setName(name.c_str());
+					textures[i]->cubemapFromHDRE(hdre, i);
+				}
+				num_pending--;
+			});
+	};
+
+	auto it = HDRE::sHDRELoaded.find(filename);
+	if (it != HDRE::sHDRELoaded.end())
+	{
+		uploadLevels(it->second);
+		return textures;
+	}
+
+	pool->enqueue([name, uploadLevels]() {
+		HDRE* hdre = new HDRE();
+		if (!hdre->load(name.c_str()))
+		{
+			delete hdre;
+			hdre = NULL;
+		}
+		uploadLevels(hdre);
+	});
+	return textures;
+}
+
+void ResourceManager::update()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	while (true)
+	{
+		std::function<void()> upload;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (uploads.empty())
+				return;
+			upload = uploads.front();
+			uploads.pop_front();
+		}
+		upload();
+
+		float elapsed = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		if (elapsed >= upload_budget_ms)
+			return;
+	}
+}
+
+void ResourceManager::waitAll()
+{
+	float budget = upload_budget_ms;
+	upload_budget_ms = 3.4e+38F;
+	while (num_pending)
+	{
+		update();
+		if (num_pending && !pool->runPendingTask()) //help with the decoding instead of only waiting
+			std::this_thread::yield();
+	}
+	upload_budget_ms = budget;
+}
@@ -0,0 +1,52 @@
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#include "includes.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+class Mesh;
+class Texture;
+class ThreadPool;
+
+//Loads meshes, textures and HDRE environments without stalling the main thread.
+//The getters return a handle right away: files are read and decoded in a pool of worker threads and
+//the GL uploads run in update(), from the main thread, until the time budget of the frame is spent.
+//Meanwhile the textures are 1x1 white (like Texture::getWhiteTexture) and the meshes have loading = true, so they are not rendered.
+//A mesh that cannot be loaded ends with load_failed = true (and an error in the log), a texture keeps the placeholder.
+//The handles are the ones the synchronous Get would return later (they are registered with the same name) and they are never replaced.
+class ResourceManager
+{
+public:
+	float upload_budget_ms; //time spent uploading per frame (at least one upload per frame)
+
+	ResourceManager(unsigned int num_threads = 2); //the global pool stays free for parallelFor
+	~ResourceManager(); //waits for the workers
+
+	static ResourceManager* getInstance();
+
+	Mesh* getMesh(const char* filename);
+	Texture* getTexture(const char* filename, bool mipmaps = true, unsigned int wrap = GL_REPEAT);
+	std::vector<Texture*> getHDRECubemaps(const char* filename, unsigned int num_levels = 6); //one cubemap per blurred level
+
+	void update(); //call it once per frame from the thread with the GL context
+	void waitAll(); //blocks until everything requested is uploaded
+
+	unsigned int getNumPending() { return num_pending; } //requested but not uploaded yet
+
+private:
+	ThreadPool* pool;
+	std::mutex mutex;
+	std::deque< std::function<void()> > uploads; //filled by the workers, run in update
+	std::atomic<unsigned int> num_pending;
+
+	void addUpload(const std::function<void()>& upload);
+	Texture* createPlaceholder(bool cubemap);
+};
+
+#endif
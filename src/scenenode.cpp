@@ -4,6 +4,11 @@
 #include "utils.h"
 
 unsigned int SceneNode::lastNameId = 0;
+bool SceneNode::use_lods = true;
+float SceneNode::lod_pixel_error = 1.0f;
+float SceneNode::lod_hysteresis = 0.25f;
+bool SceneNode::use_cluster_culling = true;
+bool SceneNode::cluster_backface_culling = true;
 unsigned int mesh_selected = 0;
 
 SceneNode::SceneNode()
@@ -22,16 +27,58 @@ SceneNode::~SceneNode()
 
 }
 
+int SceneNode::selectLOD(Camera* camera)
+{
+	if (!use_lods || !mesh || mesh->lods.empty())
+		return lod = 0;
+
+	//bounding sphere on screen, the errors of the levels are scaled like its radius
+	float radius = (float)mesh->box.halfsize.length();
+	if (radius <= 0.0f)
+		return lod = 0;
+	float scale = (float)std::max(model.rightVector().length(), std::max(model.topVector().length(), model.frontVector().length()));
+	float projected_radius = camera->getProjectedScale(model * mesh->box.center, radius * scale);
+	float pixels_per_unit = projected_radius / radius;
+
+	//finer while the current level is clearly wrong, coarser while the next one is clearly right
+	int num_lods = (int)mesh->lods.size();
+	int level = std::min(lod, num_lods);
+	while (level > 0 && mesh->lods[level - 1].error * pixels_per_unit > lod_pixel_error * (1.0f + lod_hysteresis))
+		level--;
+	while (level < num_lods && mesh->lods[level].error * pixels_per_unit < lod_pixel_error * (1.0f - lod_hysteresis))
+		level++;
+	return lod = level;
+}
+
 void SceneNode::render(Camera* camera)
 {
-	if (material)
-		material->render(mesh, model, camera);
+	if (!material || (mesh && (mesh->loading || mesh->load_failed)))
+		return;
+	if (mesh)
+	{
+		mesh->render_lod = selectLOD(camera);
+		mesh->render_clusters = use_cluster_culling && mesh->render_lod == 0 && mesh->clusters.size();
+		if (mesh->render_clusters)
+			mesh->cullClusters(camera, model, cluster_backface_culling);
+	}
+	material->render(mesh, model, camera);
+	if (mesh)
+	{
+		mesh->render_lod = 0;
+		mesh->render_clusters = false;
+	}
 }
 
 void SceneNode::renderWireframe(Camera* camera)
 {
+	if (mesh && (mesh->loading || mesh->load_failed))
+		return;
 	WireframeMaterial mat = WireframeMaterial();
+	if (mesh)
+		mesh->render_lod = lod; //the one of the last render
 	mat.render(mesh, model, camera);
+	if (mesh)
+		mesh->render_lod = 0;
 }
 
 void SceneNode::renderInMenu()
@@ -57,10 +104,23 @@ void SceneNode::renderInMenu()
 	}
 
 	//Geometry
-	if (mesh && ImGui::TreeNode("Geometry"))
+	if (mesh && mesh->loading)
+		ImGui::Text("Geometry: loading...");
+	else if (mesh && mesh->load_failed)
+		ImGui::Text("Geometry: not loaded: %s", mesh->name.c_str());
+	else if (mesh && ImGui::TreeNode("Geometry"))
 	{
 		bool changed = false;
 		changed |= ImGui::Combo("Mesh", (int*)&mesh_selected, "SPHERE\0HELMET\0");
+		ImGui::Text("LOD: %d / %d", lod, (int)mesh->lods.size());
+		ImGui::Checkbox("Use LODs", &SceneNode::use_lods);
+		ImGui::DragFloat("LOD pixel error", &SceneNode::lod_pixel_error, 0.1f, 0.1f, 32.0f);
+		if (mesh->clusters.size())
+		{
+			ImGui::Text("Clusters: %d", (int)mesh->clusters.size());
+			ImGui::Checkbox("Cluster culling", &SceneNode::use_cluster_culling);
+			ImGui::Checkbox("Cluster backface culling", &SceneNode::cluster_backface_culling);
+		}
 
 		ImGui::TreePop();
 	}
@@ -32,6 +32,17 @@ public:
 	Mesh* mesh = NULL;
 	Matrix44 model;
 
+	//level of detail of the mesh (see Mesh::createLODs), chosen from the projected radius
+	static bool use_lods;
+	static float lod_pixel_error; //error allowed on screen, in pixels
+	static float lod_hysteresis; //fraction of lod_pixel_error the error must cross to change the level, avoids popping back and forth
+	int lod = 0; //level of the last frame
+	int selectLOD(Camera* camera);
+
+	//level 0 of meshes with clusters (see Mesh::buildClusters) only draws the visible ones
+	static bool use_cluster_culling;
+	static bool cluster_backface_culling; //disable it for scenes rendered without GL_CULL_FACE
+
 	virtual void render(Camera* camera);
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
@@ -0,0 +1,100 @@
+//Volume::bakeSDF: distance to the closest triangle of a BVH, sign by ray parity.
+//Rows of voxels are baked in parallel, along a row the previous distance plus one voxel bounds the search of the next one
+//and the rays are only cast near the surface, where the sign can change.
+
+#include "volume.h"
+#include "volumeview.h"
+#include "mesh.h"
+#include "meshbvh.h"
+#include "utils.h"
+#include "threadpool.h"
+
+#include <algorithm>
+
+//skewed directions so the rays don't run along edges or faces of axis aligned geometry
+static const Vector3 parity_directions[3] = {
+	Vector3(0.5773f, 0.5774f, 0.5775f),
+	Vector3(-0.6891f, 0.2315f, 0.6866f),
+	Vector3(0.1879f, -0.8412f, -0.5070f)
+};
+
+template <typename T>
+static void bakeRows(VolumeView<T, 1> volume, const MeshBVH& bvh, const Vector3& origin, float voxel_size)
+{
+	parallelFor(0, volume.height * volume.depth, [&](int r0, int r1) {
+		for (int r = r0; r < r1; r++) {
+			int y = r % volume.height, z = r / volume.height;
+			T* row = volume.getRow(y, z);
+			float previous = 3.4e+38F;
+			bool inside = false;
+			for (int x = 0; x < volume.width; x++) {
+				Vector3 p = origin + Vector3(x + 0.5f, y + 0.5f, z + 0.5f) * voxel_size;
+				Vector3 closest;
+				float distance;
+				//the true distance is at most the previous one plus a voxel, the bound only fails on rounding
+				if (!bvh.closestPoint(p, closest, distance, previous + voxel_size * 1.001f) && !bvh.closestPoint(p, closest, distance))
+					distance = 0.0f;
+
+				//the surface can only be crossed between two voxels if both are nearer than a voxel to it, otherwise the sign is the previous one.
+				//Majority of three rays, a ray through a crack or along an edge only flips its own vote
+				if (x == 0 || (previous <= voxel_size && distance <= voxel_size)) {
+					int votes = 0;
+					for (int i = 0; i < 3; i++)
+						votes += bvh.countRayCrossings(p, parity_directions[i]) & 1;
+					inside = votes >= 2;
+				}
+				previous = distance;
+				row[x] = VoxelTraits<T>::fromFloat(inside ? -distance : distance);
+			}
+		}
+	});
+}
+
+bool Volume::bakeSDF(Mesh* mesh, unsigned int resolution, bool use_half, float padding, BoundingBox* box)
+{
+	long time = getTime();
+	MeshBVH bvh;
+	if (!mesh || !resolution || !bvh.build(mesh))
+	{
+		std::cout << "[ERROR]: SDF: no triangles" << std::endl;
+		return false;
+	}
+
+	//the root of the BVH is the aabb of the triangles
+	Vector3 min = bvh.nodes[0].min, max = bvh.nodes[0].max;
+	Vector3 size = max - min;
+	float border = std::max(size.x, std::max(size.y, size.z)) * padding;
+	min = min - Vector3(border, border, border);
+	size = size + Vector3(border, border, border) * 2.0f;
+	float voxel_size = std::max(size.x, std::max(size.y, size.z)) / resolution;
+	if (voxel_size <= 0.0f)
+	{
+		std::cout << "[ERROR]: SDF: the mesh has no volume" << std::endl;
+		return false;
+	}
+
+	//whole voxels, centered on the mesh
+	unsigned int w = std::max((unsigned int)ceilf(size.x / voxel_size - 0.001f), 1u);
+	unsigned int h = std::max((unsigned int)ceilf(size.y / voxel_size - 0.001f), 1u);
+	unsigned int d = std::max((unsigned int)ceilf(size.z / voxel_size - 0.001f), 1u);
+	Vector3 extent = Vector3((float)w, (float)h, (float)d) * voxel_size;
+	min = min - (extent - size) * 0.5f;
+
+	resize(w, h, d, 1, use_half ? 2 : 4);
+	voxelType = 2;
+	widthSpacing = heightSpacing = depthSpacing = voxel_size;
+
+	if (use_half)
+		bakeRows(VolumeView<sHalf, 1>(this), bvh, min, voxel_size);
+	else
+		bakeRows(VolumeView<float, 1>(this), bvh, min, voxel_size);
+
+	if (box)
+	{
+		box->halfsize = extent * 0.5f;
+		box->center = min + box->halfsize;
+	}
+
+	std::cout << " + SDF: " << mesh->name << " " << w << "x" << h << "x" << d << " in " << (getTime() - time) << "ms" << std::endl;
+	return true;
+}
@@ -799,6 +799,8 @@ Shader* Shader::getDefaultShader(std::string name)
 	vs = "attribute vec3 a_vertex; attribute vec3 a_normal; attribute vec2 a_uv; attribute vec4 a_color; \
 	uniform mat4 u_model;\n\
 	uniform mat4 u_viewprojection;\n\
+	uniform vec3 u_vertex_offset;\n\
+	uniform vec3 u_vertex_scale;\n\
 	varying vec3 v_position;\n\
 	varying vec3 v_world_position;\n\
 	varying vec4 v_color;\n\
@@ -807,9 +809,9 @@ Shader* Shader::getDefaultShader(std::string name)
 	void main()\n\
 	{\n\
 		v_normal = (u_model * vec4(a_normal, 0.0)).xyz;\n\
-		v_position = a_vertex;\n\
+		v_position = u_vertex_offset + a_vertex * u_vertex_scale;\n\
 		v_color = a_color;\n\
-		v_world_position = (u_model * vec4(a_vertex, 1.0)).xyz;\n\
+		v_world_position = (u_model * vec4(v_position, 1.0)).xyz;\n\
 		v_uv = a_uv;\n\
 		gl_Position = u_viewprojection * vec4(v_world_position, 1.0);\n\
 	}";
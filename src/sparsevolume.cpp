@@ -0,0 +1,265 @@
+#include "sparsevolume.h"
+#include "volume.h"
+#include "texture.h"
+#include "utils.h"
+#include "threadpool.h"
+#include "extra/mappedfile.h"
+
+#include <algorithm>
+#include <cmath>
+
+static inline unsigned int clampIndex(int v, unsigned int size) { return (unsigned int)std::min(std::max(v, 0), (int)size - 1); }
+
+SparseVolume::SparseVolume()
+{
+	atlas = NULL;
+	indirection = NULL;
+	clear();
+}
+
+SparseVolume::~SparseVolume()
+{
+	if (atlas)
+		delete atlas;
+	if (indirection)
+		delete indirection;
+}
+
+void SparseVolume::clear()
+{
+	width = height = depth = 0;
+	widthSpacing = heightSpacing = depthSpacing = 1.0f;
+	voxelBytes = 1;
+	voxelChannels = 1;
+	voxelType = 0;
+	tileSize = 0;
+	tilesX = tilesY = tilesZ = 0;
+	memset(background, 0, sizeof(background));
+	std::vector<int>().swap(tileIndex);
+	std::vector<unsigned int>().swap(activeTiles);
+	std::vector<Uint8>().swap(tileData);
+	atlasSlots = Vector3u(0, 0, 0);
+}
+
+bool SparseVolume::fromVolume(Volume* volume, unsigned int tile_size, const Uint8* background)
+{
+	if (!volume || !volume->data || tile_size == 0)
+		return false;
+
+	long time = getTime();
+	clear();
+	width = volume->width;
+	height = volume->height;
+	depth = volume->depth;
+	widthSpacing = volume->widthSpacing;
+	heightSpacing = volume->heightSpacing;
+	depthSpacing = volume->depthSpacing;
+	voxelBytes = volume->voxelBytes;
+	voxelChannels = volume->voxelChannels;
+	voxelType = volume->voxelType;
+	tileSize = tile_size;
+	tilesX = (width + tile_size - 1) / tile_size;
+	tilesY = (height + tile_size - 1) / tile_size;
+	tilesZ = (depth + tile_size - 1) / tile_size;
+
+	const size_t voxel_bytes = getVoxelBytes();
+	const size_t tile_bytes = getTileBytes();
+	if (background)
+		memcpy(this->background, background, voxel_bytes);
+
+	std::vector<Uint8> empty_tile(tile_bytes);
+	for (size_t i = 0; i < tile_bytes; i += voxel_bytes)
+		memcpy(&empty_tile[i], this->background, voxel_bytes);
+
+	tileIndex.assign((size_t)tilesX * tilesY * tilesZ, -1);
+
+	//one slab of tiles at a time: the tiles of the slab are cut in parallel and the active ones appended,
+	//so a mapped volume is read front to back and its pages can be dropped after every slab
+	const size_t row_bytes = (size_t)width * voxel_bytes;
+	const size_t slice_bytes = row_bytes * height;
+	const unsigned int tiles_per_slab = tilesX * tilesY;
+	std::vector<Uint8> slab(tiles_per_slab * tile_bytes);
+	std::vector<char> active(tiles_per_slab);
+
+	for (unsigned int tz = 0; tz < tilesZ; tz++)
+	{
+		parallelFor(0, tiles_per_slab, [&](int t0, int t1) {
+			for (int t = t0; t < t1; t++) {
+				unsigned int tx = t % tilesX, ty = t / tilesX;
+				unsigned int x0 = tx * tileSize, y0 = ty * tileSize, z0 = tz * tileSize;
+				unsigned int count = std::min(tileSize, width - x0);
+				Uint8* tile = &slab[t * tile_bytes];
+				memcpy(tile, &empty_tile[0], tile_bytes);
+				for (unsigned int z = z0; z < std::min(z0 + tileSize, depth); z++)
+					for (unsigned int y = y0; y < std::min(y0 + tileSize, height); y++)
+						memcpy(tile + ((size_t)(z - z0) * tileSize + (y - y0)) * tileSize * voxel_bytes,
+							volume->data + z * slice_bytes + y * row_bytes + x0 * voxel_bytes, count * voxel_bytes);
+				active[t] = memcmp(tile, &empty_tile[0], tile_bytes) != 0;
+			}
+		});
+
+		for (unsigned int t = 0; t < tiles_per_slab; t++)
+		{
+			if (!active[t])
+				continue;
+			unsigned int index = t + tz * tiles_per_slab;
+			tileIndex[index] = (int)activeTiles.size();
+			activeTiles.push_back(index);
+			tileData.insert(tileData.end(), slab.begin() + t * tile_bytes, slab.begin() + (t + 1) * tile_bytes);
+		}
+
+		if (volume->mapping)
+		{
+			size_t offset = (volume->data - volume->mapping->data) + (size_t)tz * tileSize * slice_bytes;
+			volume->mapping->adviseDontNeed(offset, (size_t)std::min(tileSize, depth - tz * tileSize) * slice_bytes);
+		}
+	}
+	tileData.shrink_to_fit();
+
+	std::cout << " + Sparse volume: " << activeTiles.size() << "/" << tileIndex.size() << " tiles active, " << (getMemoryUsage() >> 10) << "KB instead of "
+		<< (((size_t)width * height * depth * voxel_bytes) >> 10) << "KB in " << (getTime() - time) << "ms" << std::endl;
+	return true;
+}
+
+bool SparseVolume::loadVL(const char* filename, unsigned int tile_size, const Uint8* background)
+{
+	Volume volume;
+	if (!volume.loadVL(filename, true))
+		return false;
+	if (!volume.mapping)
+		std::cout << "[WARN] Sparse volume: " << filename << " could not be mapped, it was read whole" << std::endl;
+	return fromVolume(&volume, tile_size, background);
+}
+
+Volume* SparseVolume::toVolume()
+{
+	if (!tileSize)
+		return NULL;
+
+	Volume* volume = new Volume(width, height, depth, voxelChannels, voxelBytes, voxelType);
+	volume->widthSpacing = widthSpacing;
+	volume->heightSpacing = heightSpacing;
+	volume->depthSpacing = depthSpacing;
+
+	const size_t voxel_bytes = getVoxelBytes();
+	const size_t total = (size_t)width * height * depth * voxel_bytes;
+	for (size_t i = 0; i < total; i += voxel_bytes)
+		memcpy(volume->data + i, background, voxel_bytes);
+
+	const size_t row_bytes = (size_t)width * voxel_bytes;
+	const size_t slice_bytes = row_bytes * height;
+	const size_t tile_bytes = getTileBytes();
+	parallelFor(0, (int)activeTiles.size(), [&](int t0, int t1) {
+		for (int t = t0; t < t1; t++) {
+			unsigned int index = activeTiles[t];
+			unsigned int x0 = (index % tilesX) * tileSize, y0 = ((index / tilesX) % tilesY) * tileSize, z0 = (index / (tilesX * tilesY)) * tileSize;
+			unsigned int count = std::min(tileSize, width - x0);
+			const Uint8* tile = &tileData[t * tile_bytes];
+			for (unsigned int z = z0; z < std::min(z0 + tileSize, depth); z++)
+				for (unsigned int y = y0; y < std::min(y0 + tileSize, height); y++)
+					memcpy(volume->data + z * slice_bytes + y * row_bytes + x0 * voxel_bytes,
+						tile + ((size_t)(z - z0) * tileSize + (y - y0)) * tileSize * voxel_bytes, count * voxel_bytes);
+		}
+	});
+	return volume;
+}
+
+size_t SparseVolume::getMemoryUsage()
+{
+	return tileIndex.size() * sizeof(int) + activeTiles.size() * sizeof(unsigned int) + tileData.size();
+}
+
+const Uint8* SparseVolume::getVoxel(unsigned int x, unsigned int y, unsigned int z)
+{
+	assert(x < width && y < height && z < depth);
+	int index = tileIndex[(x / tileSize) + ((y / tileSize) + (z / tileSize) * tilesY) * tilesX];
+	if (index == -1)
+		return background;
+	x %= tileSize;
+	y %= tileSize;
+	z %= tileSize;
+	return &tileData[index * getTileBytes() + ((z * tileSize + y) * tileSize + x) * getVoxelBytes()];
+}
+
+void SparseVolume::forEachActiveVoxel(const std::function<void(unsigned int, unsigned int, unsigned int, const Uint8*)>& func)
+{
+	const size_t voxel_bytes = getVoxelBytes();
+	const size_t tile_bytes = getTileBytes();
+	parallelFor(0, (int)activeTiles.size(), [&](int t0, int t1) {
+		for (int t = t0; t < t1; t++) {
+			unsigned int index = activeTiles[t];
+			unsigned int x0 = (index % tilesX) * tileSize, y0 = ((index / tilesX) % tilesY) * tileSize, z0 = (index / (tilesX * tilesY)) * tileSize;
+			unsigned int x1 = std::min(x0 + tileSize, width), y1 = std::min(y0 + tileSize, height), z1 = std::min(z0 + tileSize, depth);
+			const Uint8* tile = &tileData[t * tile_bytes];
+			for (unsigned int z = z0; z < z1; z++)
+				for (unsigned int y = y0; y < y1; y++) {
+					const Uint8* voxel = tile + ((size_t)(z - z0) * tileSize + (y - y0)) * tileSize * voxel_bytes;
+					for (unsigned int x = x0; x < x1; x++, voxel += voxel_bytes)
+						func(x, y, z, voxel);
+				}
+		}
+	});
+}
+
+void SparseVolume::createTextures()
+{
+	assert(tileSize && "create the sparse volume first");
+
+	//slots as close to a cube as possible, at least one so the atlas is never empty
+	unsigned int num_tiles = std::max((unsigned int)activeTiles.size(), 1u);
+	unsigned int sx = (unsigned int)ceil(cbrt((double)num_tiles));
+	while (sx * sx * sx < num_tiles) //cbrt rounding
+		sx++;
+	unsigned int sz = (num_tiles + sx * sx - 1) / (sx * sx);
+	atlasSlots = Vector3u(sx, sx, sz);
+
+	const unsigned int side = tileSize + 2; //border of 1 voxel
+	const unsigned int atlas_width = sx * side, atlas_height = sx * side, atlas_depth = sz * side;
+	const size_t voxel_bytes = getVoxelBytes();
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	if (max_size && (int)std::max(atlas_width, atlas_depth) > max_size)
+		std::cout << "[WARN] Sparse volume: atlas of " << atlas_width << "x" << atlas_height << "x" << atlas_depth << " is larger than the max 3D texture size (" << max_size << ")" << std::endl;
+
+	//the border comes from the neighbour tiles (background if they are not stored), clamped at the volume borders
+	std::vector<Uint8> atlas_data((size_t)atlas_width * atlas_height * atlas_depth * voxel_bytes, 0);
+	std::vector<Uint8> table((size_t)tilesX * tilesY * tilesZ * 4, 0);
+	parallelFor(0, (int)activeTiles.size(), [&](int t0, int t1) {
+		for (int t = t0; t < t1; t++) {
+			unsigned int index = activeTiles[t];
+			int x0 = (index % tilesX) * tileSize - 1, y0 = ((index / tilesX) % tilesY) * tileSize - 1, z0 = (index / (tilesX * tilesY)) * tileSize - 1;
+			unsigned int ax = (t % sx) * side, ay = ((t / sx) % sx) * side, az = (t / (sx * sx)) * side;
+			for (unsigned int k = 0; k < side; k++)
+				for (unsigned int j = 0; j < side; j++) {
+					Uint8* dst = &atlas_data[(((size_t)(az + k) * atlas_height + ay + j) * atlas_width + ax) * voxel_bytes];
+					unsigned int z = clampIndex(z0 + (int)k, depth), y = clampIndex(y0 + (int)j, height);
+					for (unsigned int i = 0; i < side; i++, dst += voxel_bytes)
+						memcpy(dst, getVoxel(clampIndex(x0 + (int)i, width), y, z), voxel_bytes);
+				}
+			table[index * 4 + 0] = t % sx;
+			table[index * 4 + 1] = (t / sx) % sx;
+			table[index * 4 + 2] = t / (sx * sx);
+			table[index * 4 + 3] = 255;
+		}
+	});
+
+	//empty volume just to know the texture formats
+	Volume format;
+	format.voxelChannels = voxelChannels;
+	format.voxelBytes = voxelBytes;
+	format.voxelType = voxelType;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (!atlas)
+		atlas = new Texture();
+	atlas->create3D(atlas_width, atlas_height, atlas_depth, format.getTextureFormat(), format.getTextureType(), false, &atlas_data[0], format.getTextureInternalFormat());
+
+	if (!indirection)
+		indirection = new Texture();
+	indirection->create3D(tilesX, tilesY, tilesZ, GL_RGBA, GL_UNSIGNED_BYTE, false, &table[0]);
+	glBindTexture(GL_TEXTURE_3D, indirection->texture_id);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
@@ -0,0 +1,71 @@
+#ifndef SPARSEVOLUME_H
+#define SPARSEVOLUME_H
+
+#include "includes.h"
+#include "framework.h"
+
+#include <vector>
+#include <functional>
+
+class Volume;
+class Texture;
+
+//Volume made of tiles of tileSize^3 voxels where only the tiles with some voxel different from the background are stored,
+//so the memory depends on the occupied space and not on the bounding box (mostly empty simulations, segmentations...).
+//Two levels: a grid with the index of every tile (-1 for background ones) and the voxels of the active tiles packed one after the other.
+class SparseVolume
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+
+	float widthSpacing;
+	float heightSpacing;
+	float depthSpacing;
+
+	unsigned int voxelBytes;
+	unsigned int voxelChannels;
+	unsigned int voxelType;
+
+	unsigned int tileSize;
+	unsigned int tilesX;
+	unsigned int tilesY;
+	unsigned int tilesZ;
+
+	Uint8 background[16];					//value of the voxels of the missing tiles (voxelChannels * voxelBytes)
+	std::vector<int> tileIndex;				//tilesX * tilesY * tilesZ, position in activeTiles or -1
+	std::vector<unsigned int> activeTiles;	//grid index of every stored tile
+	std::vector<Uint8> tileData;			//voxels of the stored tiles, getTileBytes() each (x fastest), voxels outside the volume have the background
+
+	//GPU: atlas with the active tiles (with a border of 1 voxel so they interpolate on their own)
+	//and an indirection texture with one texel per tile: xyz slot in the atlas, w 255 if the tile is active (0: background)
+	Texture* atlas;
+	Texture* indirection;
+	Vector3u atlasSlots; //tiles per axis in the atlas
+
+	SparseVolume();
+	~SparseVolume();
+
+	void clear();
+
+	//background NULL is all zeros
+	bool fromVolume(Volume* volume, unsigned int tile_size = 8, const Uint8* background = NULL);
+	//the file is mapped and read tile by tile, the dense volume is never allocated
+	bool loadVL(const char* filename, unsigned int tile_size = 8, const Uint8* background = NULL);
+	Volume* toVolume(); //dense copy
+
+	size_t getVoxelBytes() { return voxelChannels * voxelBytes; }
+	size_t getTileBytes() { return (size_t)tileSize * tileSize * tileSize * getVoxelBytes(); }
+	unsigned int getNumActiveTiles() { return (unsigned int)activeTiles.size(); }
+	size_t getMemoryUsage(); //bytes used by the index and the tiles
+
+	const Uint8* getVoxel(unsigned int x, unsigned int y, unsigned int z); //background if the tile is not stored
+
+	//calls func(x, y, z, voxel) for every voxel of the active tiles inside the volume, tiles are processed in parallel
+	void forEachActiveVoxel(const std::function<void(unsigned int, unsigned int, unsigned int, const Uint8*)>& func);
+
+	void createTextures(); //uploads atlas and indirection
+};
+
+#endif
@@ -225,7 +225,10 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 
 void Texture::create3DFromVolume(Volume* volume, unsigned int wrap)
 {
+	//volume rows are tightly packed (and may point straight into a mapped file), so no row padding
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	create3D(volume->width, volume->height, volume->depth, volume->getTextureFormat(), volume->getTextureType(), false, volume->data, volume->getTextureInternalFormat(), wrap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 Texture* Texture::Get(const char* filename, bool mipmaps, unsigned int wrap)
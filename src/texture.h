@@ -30,7 +30,10 @@ enum class TextureSlots {
 	HDRE_L4 = 9,
 	BRDF_LUT = 10,
 	AO = 11,
-	OPPACITY = 12
+	OPPACITY = 12,
+	VOLUME = 13,
+	MACROCELLS = 14,
+	GRADIENTS = 15
 };
 
 //Simple class to handle images (stores RGBA always)
@@ -0,0 +1,136 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	stopping = false;
+	if (num_threads == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		num_threads = cores > 1 ? cores - 1 : 1; //the main thread also works in parallelFor
+	}
+
+	for (unsigned int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+void ThreadPool::enqueue(const std::function<void()>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(task);
+	}
+	condition.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tasks.empty())
+			return false;
+		task = tasks.front();
+		tasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+ThreadPool* ThreadPool::getGlobal()
+{
+	static ThreadPool pool;
+	return &pool;
+}
+
+struct sParallelJob {
+	std::atomic<int> next_range;
+	std::atomic<int> ranges_done;
+	std::mutex mutex;
+	std::condition_variable finished;
+};
+
+void parallelFor(int begin, int end, const std::function<void(int, int)>& func, int min_range)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+
+	ThreadPool* pool = ThreadPool::getGlobal();
+	int workers = pool->getNumThreads() + 1;
+	min_range = std::max(min_range, 1);
+
+	//some ranges per worker so uneven ranges get balanced
+	int num_ranges = std::min(workers * 4, (count + min_range - 1) / min_range);
+	if (num_ranges <= 1)
+	{
+		func(begin, end);
+		return;
+	}
+
+	std::shared_ptr<sParallelJob> job = std::make_shared<sParallelJob>();
+	job->next_range = 0;
+	job->ranges_done = 0;
+	const std::function<void(int, int)>* f = &func; //only used while there are ranges left, so it outlives them
+
+	auto work = [job, f, begin, count, num_ranges]() {
+		int range;
+		while ((range = job->next_range.fetch_add(1)) < num_ranges)
+		{
+			int start = begin + (int)((long long)count * range / num_ranges);
+			int stop = begin + (int)((long long)count * (range + 1) / num_ranges);
+			(*f)(start, stop);
+			if (job->ranges_done.fetch_add(1) + 1 == num_ranges)
+			{
+				std::lock_guard<std::mutex> lock(job->mutex);
+				job->finished.notify_all();
+			}
+		}
+	};
+
+	int helpers = std::min(workers - 1, num_ranges - 1);
+	for (int i = 0; i < helpers; ++i)
+		pool->enqueue(work);
+	work();
+
+	//wait for the ranges taken by the workers, running other queued tasks meanwhile (nested calls)
+	while (job->ranges_done.load() < num_ranges)
+	{
+		if (pool->runPendingTask())
+			continue;
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->finished.wait_for(lock, std::chrono::milliseconds(1), [&job, num_ranges] { return job->ranges_done.load() >= num_ranges; });
+	}
+}
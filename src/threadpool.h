@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Fixed set of worker threads consuming a queue of tasks
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int num_threads = 0); //0 uses all the cores but one
+	~ThreadPool();
+
+	unsigned int getNumThreads() { return (unsigned int)threads.size(); }
+
+	void enqueue(const std::function<void()>& task);
+	bool runPendingTask(); //runs one queued task in the calling thread, false if the queue was empty
+
+	static ThreadPool* getGlobal(); //shared pool used by parallelFor
+
+private:
+	std::vector<std::thread> threads;
+	std::deque< std::function<void()> > tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+
+	void workerLoop();
+};
+
+//Calls func(range_start, range_end) for consecutive ranges covering [begin, end) using the global pool.
+//The calling thread also processes ranges and it returns when all of them are done (it is safe to nest calls).
+//min_range avoids splitting small jobs in too many pieces.
+void parallelFor(int begin, int end, const std::function<void(int, int)>& func, int min_range = 1);
+
+#endif
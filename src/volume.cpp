@@ -1,32 +1,105 @@
 #include "volume.h"
+#include "volumeview.h"
 #include "utils.h"
+#include "threadpool.h"
 
 #include "extra/pvmparser.h"
+#include "extra/mappedfile.h"
 #include "extra/PerlinNoise.hpp"
+#include "extra/lzcodec.h"
+
+#include <random>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <sys/stat.h>
+
+#ifdef WIN32
+	#define fseek64 _fseeki64
+#else
+	#define fseek64 fseeko
+#endif
+
+#define VOLUME_STATS_VERSION 1
+
+#define CVOL_VERSION 1
+#define CVOL_DELTA_SLICES 1 //flag: every slice of a chunk stores the difference with the previous one
+
+typedef struct
+{
+	char magic[4]; //CVOL
+	int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	float spacing[3];
+	unsigned int voxelChannels;
+	unsigned int voxelBytes;
+	unsigned int voxelType;
+	unsigned int chunkSize;
+	unsigned int flags;
+	unsigned int numChunks;
+} sCVOLHeader;
+
+//chunk index entry, chunks stored uncompressed have compressedSize == rawSize
+typedef struct
+{
+	unsigned long long offset;
+	unsigned int compressedSize;
+	unsigned int rawSize;
+} sCVOLChunk;
 
 Volume::Volume() {
 	width = height = depth = 0;
 	widthSpacing = heightSpacing = depthSpacing = 1.0; 
 	data = NULL;
+	mapping = NULL;
+	statistics = NULL;
 	voxelChannels = 1; 
 	voxelBytes = 1;
 	voxelType = 0;
+	resetQuantization();
 }
 
 Volume::Volume(unsigned int w, unsigned int h, unsigned int d, unsigned int channels, unsigned int bytes, unsigned int type) {
 	widthSpacing = heightSpacing = depthSpacing = 1.0;
 	voxelType = type;
 	data = NULL;
+	mapping = NULL;
+	statistics = NULL;
 	resize(w, h, d, channels, bytes);
 }
 
 Volume::~Volume() {
-	if (data) delete[]data;
+	freeData();
+}
+
+void Volume::freeData() {
+	if (mapping)
+		delete mapping; //unmaps the file, data was pointing inside it
+	else if (data)
+		delete[] data;
+	mapping = NULL;
 	data = NULL;
+	invalidateStatistics(); //also clears the filename
+	resetQuantization();
+}
+
+void Volume::resetQuantization() {
+	for (int c = 0; c < 4; c++) {
+		quantizationScale[c] = 1.0f;
+		quantizationBias[c] = 0.0f;
+	}
+}
+
+void Volume::copyQuantization(const Volume* source) {
+	memcpy(quantizationScale, source->quantizationScale, sizeof(quantizationScale));
+	memcpy(quantizationBias, source->quantizationBias, sizeof(quantizationBias));
 }
 
 void Volume::resize(int w, int h, int d, unsigned int channels, unsigned int bytes) {
-	if (data) delete[] data;
+	freeData();
 	width = w;
 	height = h;
 	depth = d;
@@ -37,12 +110,18 @@ void Volume::resize(int w, int h, int d, unsigned int channels, unsigned int byt
 }
 
 void Volume::clear() {
-	if (data) delete[]data;
-	data = NULL;
+	freeData();
 	width = height = depth = 0;
 }
 
-bool Volume::loadVL(const char* filename){
+void Volume::releasePages() {
+	if (!mapping)
+		return;
+	size_t offset = data - mapping->data;
+	mapping->adviseDontNeed(offset, (size_t)width * height * depth * voxelChannels * voxelBytes);
+}
+
+bool Volume::loadVL(const char* filename, bool use_mapping){
 	long time = getTime();
 	std::cout << " + Volume loading: " << filename << " ... ";
 	FILE * file = fopen(filename, "rb");
@@ -66,7 +145,7 @@ bool Volume::loadVL(const char* filename){
 		fread(&voxelBytes, 1, 4, file) / 8;
 		voxelType = 0; //This version does not contain this value, we assume it's unsigned
 	}
-	if (version == 2)
+	else if (version == 2)
 	{
 		fread(&width, 1, 4, file);
 		fread(&height, 1, 4, file);
@@ -85,11 +164,44 @@ bool Volume::loadVL(const char* filename){
 		return false;
 	}
 
-	resize(width, height, depth, voxelChannels, voxelBytes);
-	fread(data, voxelBytes, width*height*depth*voxelChannels*voxelBytes, file);
+	size_t header_size = (size_t)ftell(file);
+	size_t data_size = (size_t)width * height * depth * voxelChannels * voxelBytes;
 
-	fclose(file);
-	std::cout << "[OK] Size: " << width << "x" << height << "x" << depth << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	freeData();
+
+	if (use_mapping)
+	{
+		fclose(file);
+		file = NULL;
+
+		//voxels are used straight from the file pages, no allocation nor copy
+		MappedFile* mapped = new MappedFile();
+		if (!mapped->open(filename) || mapped->size < header_size + data_size)
+		{
+			std::cout << "[ERROR]: Volume cannot be mapped or is truncated" << std::endl;
+			delete mapped;
+			return false;
+		}
+		mapped->adviseSequential(header_size, data_size);
+		mapping = mapped;
+		data = mapped->data + header_size;
+	}
+	else
+	{
+		//no memset needed, the whole buffer is overwritten
+		data = new Uint8[data_size];
+		if (fread(data, 1, data_size, file) != data_size)
+		{
+			std::cout << "[ERROR]: Volume is truncated" << std::endl;
+			fclose(file);
+			freeData();
+			return false;
+		}
+		fclose(file);
+	}
+
+	this->filename = filename;
+	std::cout << "[OK] Size: " << width << "x" << height << "x" << depth << (use_mapping ? " [MAPPED]" : "") << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	return true;
 }
 
@@ -98,18 +210,71 @@ bool Volume::loadVL(const char* filename){
 bool Volume::loadPVM(const char* filename){
 	long time = getTime();
 	std::cout << " + Volume loading: " << filename << " ... ";
-	data = parsePVM(filename, &width, &height, &depth, &voxelChannels, &widthSpacing, &heightSpacing, &depthSpacing);
-	voxelBytes = sizeof(data) / (width * height * depth * voxelChannels);
 
-	if (data == NULL) {
+	long long size = 0;
+	sPVMVolume pvm;
+	unsigned char* file_data = readPVMFile(filename, &size);
+	if (!decodePVM(file_data, size, &pvm)) {
 		std::cout << " [ERROR]: Volume not found / Problem on parsing" << std::endl;
 		return false;
 	}
+	setFromPVM(pvm);
+	this->filename = filename;
+
 	std::cout << "[OK] Size: " << width << "x" << height << "x" << depth << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	return true;
 }
 
+std::vector<Volume*> Volume::loadPVMs(const std::vector<std::string>& filenames) {
+	long time = getTime();
+	std::vector<sPVMVolume> pvms;
+	parsePVMs(filenames, pvms);
+
+	std::vector<Volume*> volumes(filenames.size(), (Volume*)NULL);
+	for (size_t i = 0; i < pvms.size(); i++) {
+		if (!pvms[i].data) {
+			std::cout << " [ERROR]: Volume not found / Problem on parsing: " << filenames[i] << std::endl;
+			continue;
+		}
+		volumes[i] = new Volume();
+		volumes[i]->setFromPVM(pvms[i]);
+		volumes[i]->filename = filenames[i];
+	}
+
+	std::cout << " + " << filenames.size() << " PVM volumes loaded in " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return volumes;
+}
+
+void Volume::setFromPVM(sPVMVolume& pvm) {
+	freeData();
+	width = pvm.width;
+	height = pvm.height;
+	depth = pvm.depth;
+	widthSpacing = pvm.scalex;
+	heightSpacing = pvm.scaley;
+	depthSpacing = pvm.scalez;
+	data = pvm.data; //allocated with new[], now owned by the volume
+	voxelType = 0;
+
+	//PVM components are bytes per voxel, 16 bits are stored MSB first
+	if (pvm.components == 2) {
+		voxelChannels = 1;
+		voxelBytes = 2;
+		parallelFor(0, depth, [this](int z0, int z1) {
+			size_t slice = (size_t)width * height;
+			for (size_t i = z0 * slice; i < z1 * slice; i++)
+				std::swap(data[2 * i], data[2 * i + 1]);
+		});
+	}
+	else {
+		voxelChannels = pvm.components;
+		voxelBytes = 1;
+	}
+}
+
 unsigned int Volume::getTextureFormat(){
+	if (voxelType == 3 && voxelBytes == 4)
+		return GL_RGBA; //packed RGB10A2
 	unsigned int format = GL_RED;
 	switch (voxelChannels) {
 	case 1:
@@ -151,124 +316,1083 @@ unsigned int Volume::getTextureType(){
 		case 4: type = GL_FLOAT; break;
 		}
 		break;
+	case 3: //packed
+		if (voxelBytes == 4)
+			type = GL_UNSIGNED_INT_2_10_10_10_REV;
+		break;
 	}
 	return type;
 }
 
 unsigned int Volume::getTextureInternalFormat(){
+	if (voxelType == 3 && voxelBytes == 4)
+		return GL_RGB10_A2;
+
+	//sized formats, so the GPU keeps the precision of the data (unsized ones may be stored as 8 bits)
+	static const unsigned int unsigned_formats[2][4] = {
+		{ GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 },
+		{ GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 } };
+	static const unsigned int signed_formats[2][4] = {
+		{ GL_R8_SNORM, GL_RG8_SNORM, GL_RGB8_SNORM, GL_RGBA8_SNORM },
+		{ GL_R16_SNORM, GL_RG16_SNORM, GL_RGB16_SNORM, GL_RGBA16_SNORM } };
+	static const unsigned int float_formats[2][4] = {
+		{ GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F },
+		{ GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F } };
+
+	if (voxelChannels < 1 || voxelChannels > 4)
+		return getTextureFormat();
+	int size = voxelBytes == 1 ? 0 : (voxelBytes == 2 ? 1 : 2);
+	switch (voxelType) {
+	case 0: //unsigned, there are no normalized 32 bits formats
+		if (size < 2) return unsigned_formats[size][voxelChannels - 1];
+		break;
+	case 1: //signed
+		if (size < 2) return signed_formats[size][voxelChannels - 1];
+		break;
+	case 2: //float
+		if (size > 0) return float_formats[size - 1][voxelChannels - 1];
+		break;
+	}
 	return getTextureFormat();
 }
 
+//(y, z, values, scratch) gives the width values of a row, scratch has width doubles for the generator and is reused in the whole parallel chunk
+typedef std::function<void(int, int, float*, double*)> tRowGenerator;
+
+//writes one channel row by row in parallel, generated values are normalized ([0,1] is the whole range of the texture)
+template <typename T, int Channels>
+struct FillChannelKernel {
+	static void run(VolumeView<T, Channels> volume, unsigned int channel, const tRowGenerator& generator) {
+		const float scale = VoxelTraits<T>::normalizedMax();
+		parallelFor(0, volume.depth, [&](int z0, int z1) {
+			std::vector<float> values(volume.width);
+			std::vector<double> scratch(volume.width);
+			for (int z = z0; z < z1; z++)
+				for (int y = 0; y < volume.height; y++) {
+					generator(y, z, &values[0], &scratch[0]);
+					T* row = volume.getRow(y, z) + channel;
+					for (int x = 0; x < volume.width; x++)
+						row[x * Channels] = VoxelTraits<T>::fromFloat(values[x] * scale);
+				}
+		});
+	}
+};
+
+template <typename T, int Channels>
+struct SampleKernel {
+	static void run(VolumeView<T, Channels> volume, float x, float y, float z, unsigned int channel, float* result) {
+		*result = volume.sample(x, y, z, channel);
+	}
+};
+
+float Volume::sample(float x, float y, float z, unsigned int channel) {
+	float result = 0.0f;
+	if (channel < voxelChannels)
+		dispatchVolume<SampleKernel>(this, x, y, z, channel, &result);
+	return result;
+}
+
 void Volume::fillSphere() {
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			for (int k = 0; k < depth; k++) {
-				float f = 0;
-				float x = 2.0*(((float)i / width) - 0.5);
-				float y = 2.0*(((float)j / height) - 0.5);
-				float z = 2.0*(((float)k / depth) - 0.5);
-
-				f = (1.0 - (x*x + y * y + z * z) / 3.0);
-				f = f < 0.5 ? 0.0 : f;
-
-				data[i + width * j + width * height*k] = (Uint8)(f* 255.0);
-			}
+	invalidateStatistics();
+	tRowGenerator sphere = [this](int j, int k, float* values, double*) {
+		float y = 2.0*(((float)j / height) - 0.5);
+		float z = 2.0*(((float)k / depth) - 0.5);
+		for (unsigned int i = 0; i < width; i++) {
+			float x = 2.0*(((float)i / width) - 0.5);
+			float f = (1.0 - (x*x + y * y + z * z) / 3.0);
+			values[i] = f < 0.5 ? 0.0 : f;
 		}
-	}
+	};
+	if (!dispatchVolume<FillChannelKernel>(this, 0u, sphere))
+		std::cout << "[ERROR]: Could not fill volume with a sphere: unsupported voxel format" << std::endl;
 }
 
 void Volume::fillNoise(float frequency, int octaves, unsigned int seed, unsigned int channel) {
+	if (channel < 1 || channel > voxelChannels) {
+		std::cout << "Could not fill volume with noise: The volume doesn't have that numer of channels.\n";
+		return;
+	}
+
+	invalidateStatistics();
 	float f = frequency > 0.1 ? frequency < 64.0 ? frequency : 64.0 : 0.1;
 	int o = octaves > 1 ? octaves < 16 ? octaves : 16 : 1;
 
 	const siv::PerlinNoise perlin(seed);
-	const float fx = (float)width / f;
-	const float fy = (float)height / f;
-	const float fz = (float)depth / f;
+	const double fx = (double)width / f;
+	const double fy = (double)height / f;
+	const double fz = (double)depth / f;
+
+	std::vector<double> xs(width);
+	for (unsigned int i = 0; i < width; i++)
+		xs[i] = i / fx;
+
+	//every row is evaluated in a single batched call
+	tRowGenerator noise = [&](int j, int k, float* values, double* row) {
+		perlin.octaveNoise0_1(&xs[0], width, j / fy, k / fz, o, row);
+		for (unsigned int i = 0; i < width; i++)
+			values[i] = (float)row[i];
+	};
+	if (!dispatchVolume<FillChannelKernel>(this, channel - 1, noise))
+		std::cout << "[ERROR]: Could not fill volume with noise: unsupported voxel format" << std::endl;
+}
 
+void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
+	std::vector<sWorleyChannel> channels;
+	channels.push_back(sWorleyChannel(channel, cellsPerSide));
+	fillWorleyNoise(channels, rand());
+}
+
+//Feature points of a tileable Worley noise, one per cell, stored as the offset inside its cell
+struct sWorleyGrid {
+	int cells[3];
+	float scale[3]; //cells per voxel in every axis
+	std::vector<Vector3> points;
+};
+
+//distances (F1 or F2) of a row of voxels to the feature points
+static void computeWorleyRow(const sWorleyGrid& grid, unsigned int width, unsigned int j, unsigned int k, bool f2, float* out)
+{
+	const float py = (j + 0.5f) * grid.scale[1];
+	const float pz = (k + 0.5f) * grid.scale[2];
+	const int cy = (int)py;
+	const int cz = (int)pz;
+
+	//the 27 neighbour points only change when the row enters a new cell
+	Vector3 neighbours[27];
+	int current_cx = -1;
 
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			for (int k = 0; k < depth; k++) {
-				float v = perlin.octaveNoise0_1(i / fx, j / fy, k / fz, o);
-				unsigned int index = i + j * width + k * width*height;
-				data[(index * voxelChannels) + (channel - 1)] = (Uint8)(255 * v);
+	for (unsigned int i = 0; i < width; i++) {
+		const float px = (i + 0.5f) * grid.scale[0];
+		const int cx = (int)px;
+
+		if (cx != current_cx) {
+			current_cx = cx;
+			int n = 0;
+			for (int dz = -1; dz <= 1; dz++) {
+				int z = cz + dz;
+				int wz = (z + grid.cells[2]) % grid.cells[2];
+				for (int dy = -1; dy <= 1; dy++) {
+					int y = cy + dy;
+					int wy = (y + grid.cells[1]) % grid.cells[1];
+					for (int dx = -1; dx <= 1; dx++, n++) {
+						int x = cx + dx;
+						int wx = (x + grid.cells[0]) % grid.cells[0];
+						const Vector3& offset = grid.points[wx + wy * grid.cells[0] + wz * grid.cells[0] * grid.cells[1]];
+						neighbours[n].set(x + offset.x, y + offset.y, z + offset.z);
+					}
+				}
 			}
 		}
+
+		//squared distances, only the winners need the sqrt
+		float d1 = 1e30f, d2 = 1e30f;
+		for (int n = 0; n < 27; n++) {
+			float dx = neighbours[n].x - px;
+			float dy = neighbours[n].y - py;
+			float dz = neighbours[n].z - pz;
+			float d = dx * dx + dy * dy + dz * dz;
+			if (d < d1) { d2 = d1; d1 = d; }
+			else if (d < d2) d2 = d;
+		}
+		out[i] = sqrtf(f2 ? d2 : d1);
 	}
 }
 
-void Volume::fillWorleyNoise(unsigned int cellsPerSide, unsigned int channel) {
-	if (width != height || width != depth || width % cellsPerSide != 0) {
-		std::cout << "Could not fill volume with Worley noise: All dimensions should be the same and divisible by cellsPerSide.\n";
-		return;
+void Volume::fillWorleyNoise(const std::vector<sWorleyChannel>& channels, unsigned int seed) {
+	for (size_t c = 0; c < channels.size(); c++) {
+		if (channels[c].channel < 1 || channels[c].channel > voxelChannels) {
+			std::cout << "Could not fill volume with Worley noise: The volume doesn't have that numer of channels.\n";
+			return;
+		}
 	}
-	if (channel > voxelChannels) {
-		std::cout << "Could not fill volume with Worley noise: The volume doesn't have that numer of channels.\n";
+	if (channels.empty() || !data)
 		return;
+	invalidateStatistics();
+
+	//cells keep the same size in every axis, so non cubic volumes get less cells in the short sides
+	std::mt19937 random_engine(seed);
+	std::uniform_real_distribution<float> random01(0.0f, 0.999f);
+	const unsigned int dims[3] = { width, height, depth };
+	const float max_side = (float)std::max(width, std::max(height, depth));
+	std::vector<sWorleyGrid> grids(channels.size());
+
+	for (size_t c = 0; c < channels.size(); c++) {
+		sWorleyGrid& grid = grids[c];
+		for (int a = 0; a < 3; a++) {
+			grid.cells[a] = std::max(1, (int)std::round(channels[c].cells * dims[a] / max_side));
+			grid.scale[a] = grid.cells[a] / (float)dims[a];
+		}
+		grid.points.resize(grid.cells[0] * grid.cells[1] * grid.cells[2]);
+		for (size_t n = 0; n < grid.points.size(); n++)
+			grid.points[n].set(random01(random_engine), random01(random_engine), random01(random_engine));
+	}
+
+	//first pass: only the max distance of every channel, no scratch buffer
+	std::vector<float> max_distance(channels.size(), 0.0f);
+	std::mutex max_mutex;
+	parallelFor(0, depth, [&](int k0, int k1) {
+		std::vector<float> row(width);
+		std::vector<float> local_max(channels.size(), 0.0f);
+		for (int k = k0; k < k1; k++)
+			for (unsigned int j = 0; j < height; j++)
+				for (size_t c = 0; c < channels.size(); c++) {
+					computeWorleyRow(grids[c], width, j, k, channels[c].f2, &row[0]);
+					for (unsigned int i = 0; i < width; i++)
+						local_max[c] = std::max(local_max[c], row[i]);
+				}
+		std::lock_guard<std::mutex> lock(max_mutex);
+		for (size_t c = 0; c < channels.size(); c++)
+			max_distance[c] = std::max(max_distance[c], local_max[c]);
+	});
+
+	//second pass: recompute the rows and store them normalized
+	for (size_t c = 0; c < channels.size(); c++) {
+		const float inv_max = max_distance[c] > 0.0f ? 1.0f / max_distance[c] : 0.0f;
+		tRowGenerator worley = [&](int j, int k, float* values, double*) {
+			computeWorleyRow(grids[c], width, j, k, channels[c].f2, values);
+			for (unsigned int i = 0; i < width; i++) {
+				float v = values[i] * inv_max;
+				values[i] = channels[c].invert ? 1.0f - v : v;
+			}
+		};
+		if (!dispatchVolume<FillChannelKernel>(this, channels[c].channel - 1, worley)) {
+			std::cout << "[ERROR]: Could not fill volume with Worley noise: unsupported voxel format" << std::endl;
+			return;
+		}
+	}
+}
+
+//min/max of every macrocell, in the voxel type so the texture is normalized like the volume one
+template <typename T, int Channels>
+struct MacrocellsKernel {
+	static void run(VolumeView<T, Channels> volume, Volume* cells_volume, int cell_size) {
+		VolumeView<T, 2> cells(cells_volume);
+		parallelFor(0, cells.depth, [&](int cz0, int cz1) {
+			for (int cz = cz0; cz < cz1; cz++)
+				for (int cy = 0; cy < cells.height; cy++)
+					for (int cx = 0; cx < cells.width; cx++) {
+						//cells include the first voxel of the next one
+						int x0 = cx * cell_size, x1 = std::min(x0 + cell_size, volume.width - 1);
+						int y0 = cy * cell_size, y1 = std::min(y0 + cell_size, volume.height - 1);
+						int z0 = cz * cell_size, z1 = std::min(z0 + cell_size, volume.depth - 1);
+
+						T min_value = *volume.voxel(x0, y0, z0);
+						T max_value = min_value;
+						for (int z = z0; z <= z1; z++)
+							for (int y = y0; y <= y1; y++) {
+								const T* row = volume.getRow(y, z);
+								for (int x = x0; x <= x1; x++) {
+									T v = row[x * Channels];
+									if (VoxelTraits<T>::less(v, min_value)) min_value = v;
+									if (VoxelTraits<T>::less(max_value, v)) max_value = v;
+								}
+							}
+
+						T* cell = cells.voxel(cx, cy, cz);
+						cell[0] = min_value;
+						cell[1] = max_value;
+					}
+		});
 	}
-	
-	unsigned int side = width;
+};
 
-	unsigned int cells = cellsPerSide;
-	unsigned int subside = side / cells;
+Volume* Volume::createMacrocells(unsigned int cell_size) {
+	if (!data || !width || !height || !depth || cell_size == 0)
+		return NULL;
 
-	unsigned int pointsCount = pow(cells, 3);
-	vec3 *points = new vec3[pointsCount];
+	long time = getTime();
+	unsigned int cells_x = std::max(1u, (width - 1 + cell_size - 1) / cell_size);
+	unsigned int cells_y = std::max(1u, (height - 1 + cell_size - 1) / cell_size);
+	unsigned int cells_z = std::max(1u, (depth - 1 + cell_size - 1) / cell_size);
+	Volume* cells = new Volume(cells_x, cells_y, cells_z, 2, voxelBytes, voxelType);
+	cells->copyQuantization(this);
 
-	float* _distances = new float[side*side*side];
+	if (!dispatchVolume<MacrocellsKernel>(this, cells, (int)cell_size)) {
+		std::cout << "[ERROR]: Macrocells: unsupported voxel format" << std::endl;
+		delete cells;
+		return NULL;
+	}
+
+	std::cout << " + Macrocells: " << cells_x << "x" << cells_y << "x" << cells_z << " in " << (getTime() - time) << "ms" << std::endl;
+	return cells;
+}
 
-	//Compute a relative point for each cell
-	for (unsigned int i = 0; i < cells; i++) {
-		for (unsigned int j = 0; j < cells; j++) {
-			for (unsigned int k = 0; k < cells; k++) {
-				unsigned int index = i + j * cells + k * cells * cells;
-				points[index].random(0.5);
-				points[index] = points[index] + vec3(0.5, 0.5, 0.5); //Random between 0 and 1
+//averages or max of the 2x2x2 voxels of every voxel of half, the last voxel is repeated in odd sizes
+template <typename T, int Channels>
+struct HalfResolutionKernel {
+	static void run(VolumeView<T, Channels> volume, Volume* half_volume, bool use_max) {
+		VolumeView<T, Channels> half(half_volume);
+		parallelFor(0, half.depth, [&](int z0, int z1) {
+			for (int z = z0; z < z1; z++) {
+				size_t zs[2] = { (size_t)(2 * z) * volume.slice, (size_t)std::min(2 * z + 1, volume.depth - 1) * volume.slice };
+				for (int y = 0; y < half.height; y++) {
+					size_t ys[2] = { (size_t)(2 * y) * volume.row, (size_t)std::min(2 * y + 1, volume.height - 1) * volume.row };
+					T* out = half.getRow(y, z);
+					for (int x = 0; x < half.width; x++) {
+						size_t xs[2] = { (size_t)(2 * x) * Channels, (size_t)std::min(2 * x + 1, volume.width - 1) * Channels };
+						for (int c = 0; c < Channels; c++) {
+							const T* src = volume.data + c;
+							if (use_max) {
+								T v = src[zs[0] + ys[0] + xs[0]];
+								for (int n = 1; n < 8; n++) {
+									T s = src[zs[n >> 2] + ys[(n >> 1) & 1] + xs[n & 1]];
+									if (VoxelTraits<T>::less(v, s))
+										v = s;
+								}
+								*out++ = v;
+							}
+							else {
+								//integers are rounded to the nearest value
+								double sum = 0.0;
+								for (int n = 0; n < 8; n++)
+									sum += VoxelTraits<T>::toFloat(src[zs[n >> 2] + ys[(n >> 1) & 1] + xs[n & 1]]);
+								*out++ = VoxelTraits<T>::fromFloat((float)(sum * 0.125));
+							}
+						}
+					}
+				}
+			}
+		});
+	}
+};
+
+Volume* Volume::createHalfResolution(bool use_max) {
+	if (!data || !width || !height || !depth)
+		return NULL;
+
+	Volume* half = new Volume(std::max(1u, (width + 1) / 2), std::max(1u, (height + 1) / 2), std::max(1u, (depth + 1) / 2), voxelChannels, voxelBytes, voxelType);
+	half->widthSpacing = widthSpacing * width / (float)half->width;
+	half->heightSpacing = heightSpacing * height / (float)half->height;
+	half->depthSpacing = depthSpacing * depth / (float)half->depth;
+	half->copyQuantization(this);
+
+	if (!dispatchVolume<HalfResolutionKernel>(this, half, use_max)) {
+		std::cout << "[ERROR]: Half resolution: unsupported voxel format" << std::endl;
+		delete half;
+		return NULL;
+	}
+	return half;
+}
+
+std::vector<Volume*> Volume::createPyramid(unsigned int num_levels, bool use_max) {
+	std::vector<Volume*> levels;
+	long time = getTime();
+
+	Volume* current = this;
+	while ((num_levels == 0 || levels.size() < num_levels) && (current->width > 1 || current->height > 1 || current->depth > 1)) {
+		Volume* half = current->createHalfResolution(use_max);
+		if (!half)
+			break;
+		levels.push_back(half);
+		current = half;
+	}
+
+	std::cout << " + Volume pyramid: " << levels.size() << " levels in " << (getTime() - time) << "ms" << std::endl;
+	return levels;
+}
+
+//tiles of rows processed through all the slices of a slab, so the 3 slices of the stencil stay in cache
+#define GRADIENT_BLOCK_X 64
+#define GRADIENT_BLOCK_Y 16
+
+static void encodeGradient(Vector3 n, GradientEncoding encoding, Uint8* out)
+{
+	switch (encoding) {
+	case GradientEncoding::RGB8:
+		out[0] = (Uint8)((n.x * 0.5f + 0.5f) * 255.0f + 0.5f);
+		out[1] = (Uint8)((n.y * 0.5f + 0.5f) * 255.0f + 0.5f);
+		out[2] = (Uint8)((n.z * 0.5f + 0.5f) * 255.0f + 0.5f);
+		break;
+	case GradientEncoding::RGB10A2: {
+		Uint32 r = (Uint32)((n.x * 0.5f + 0.5f) * 1023.0f + 0.5f);
+		Uint32 g = (Uint32)((n.y * 0.5f + 0.5f) * 1023.0f + 0.5f);
+		Uint32 b = (Uint32)((n.z * 0.5f + 0.5f) * 1023.0f + 0.5f);
+		Uint32 packed = r | (g << 10) | (b << 20) | (3u << 30);
+		memcpy(out, &packed, 4);
+		break;
+	}
+	case GradientEncoding::OCTAHEDRAL: {
+		//project on the octahedron and unfold the lower half
+		float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		float u = 0.0f, v = 0.0f;
+		if (l1 > 0.0f) {
+			u = n.x / l1;
+			v = n.y / l1;
+			if (n.z < 0.0f) {
+				float fu = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+				float fv = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+				u = fu;
+				v = fv;
 			}
 		}
+		out[0] = (Uint8)((u * 0.5f + 0.5f) * 255.0f + 0.5f);
+		out[1] = (Uint8)((v * 0.5f + 0.5f) * 255.0f + 0.5f);
+		break;
 	}
+	}
+}
+
+template <typename T, int Channels>
+struct GradientsKernel {
+	static void run(VolumeView<T, Channels> volume, Volume* gradients, const Vector3& spacing, GradientMethod method, GradientEncoding encoding) {
+		const int w = volume.width, h = volume.height, d = volume.depth;
+		const size_t out_bytes = gradients->voxelChannels * gradients->voxelBytes;
+		const Vector3 inv_spacing(0.5f / spacing.x, 0.5f / spacing.y, 0.5f / spacing.z);
+		const float sobel_weights[3] = { 1.0f, 2.0f, 1.0f };
 
-	//Compute min distance to point and store the max on for normalization
-	float maxdist = -1;
-	for (unsigned int i = 0; i < side; i++) {
-		for (unsigned int j = 0; j < side; j++) {
-			for (unsigned int k = 0; k < side; k++) {
-				vec3 point((float)i/subside, (float)j/subside, (float)k/subside);
-				vec3 basep2(std::floor(point.x), std::floor(point.y), std::floor(point.z));
-				float mindist = 10000;
-
-				for (unsigned int dx = 0; dx < 3; dx++) {
-					for (unsigned int dy = 0; dy < 3; dy++) {
-						for (unsigned int dz = 0; dz < 3; dz++) {
-							vec3 p2(basep2.x + dx - 1, basep2.y + dy - 1, basep2.z + dz - 1);
-							vec3 wrappedp2(p2.x == -1 ? cells - 1 : p2.x == cells ? 0 : p2.x,
-											p2.y == -1 ? cells - 1 : p2.y == cells ? 0 : p2.y,
-											p2.z == -1 ? cells - 1 : p2.z == cells ? 0 : p2.z);
-							unsigned int wrappedindex2 = wrappedp2.x + wrappedp2.y * cells + wrappedp2.z * cells * cells;
-							vec3 point2 = points[wrappedindex2] + p2;
-
-							float dist = point.distance(point2);
-							if (dist < mindist) mindist = dist;
+		parallelFor(0, d, [&](int z0, int z1) {
+			for (int by = 0; by < h; by += GRADIENT_BLOCK_Y)
+				for (int bx = 0; bx < w; bx += GRADIENT_BLOCK_X)
+					for (int z = z0; z < z1; z++)
+						for (int y = by; y < std::min(by + GRADIENT_BLOCK_Y, h); y++) {
+							Uint8* out = gradients->data + (bx + y * (size_t)w + z * (size_t)w * h) * out_bytes;
+							for (int x = bx; x < std::min(bx + GRADIENT_BLOCK_X, w); x++, out += out_bytes) {
+								Vector3 g;
+								if (method == GradientMethod::SOBEL) {
+									g.set(0.0f, 0.0f, 0.0f);
+									for (int j = -1; j <= 1; j++)
+										for (int i = -1; i <= 1; i++) {
+											float weight = sobel_weights[i + 1] * sobel_weights[j + 1] / 16.0f;
+											g.x += weight * (volume.getClamped(x + 1, y + i, z + j) - volume.getClamped(x - 1, y + i, z + j));
+											g.y += weight * (volume.getClamped(x + i, y + 1, z + j) - volume.getClamped(x + i, y - 1, z + j));
+											g.z += weight * (volume.getClamped(x + i, y + j, z + 1) - volume.getClamped(x + i, y + j, z - 1));
+										}
+								}
+								else {
+									g.set(volume.getClamped(x + 1, y, z) - volume.getClamped(x - 1, y, z),
+										volume.getClamped(x, y + 1, z) - volume.getClamped(x, y - 1, z),
+										volume.getClamped(x, y, z + 1) - volume.getClamped(x, y, z - 1));
+								}
+								g = g * inv_spacing;
+
+								float length = g.length();
+								if (length > 0.0f)
+									g = g * (1.0f / length);
+								encodeGradient(g, encoding, out);
+							}
 						}
+		});
+	}
+};
+
+Volume* Volume::createGradients(GradientMethod method, GradientEncoding encoding) {
+	if (!data || !width || !height || !depth)
+		return NULL;
+
+	long time = getTime();
+	Volume* gradients = NULL;
+	switch (encoding) {
+	case GradientEncoding::RGB8: gradients = new Volume(width, height, depth, 3, 1, 0); break;
+	case GradientEncoding::RGB10A2: gradients = new Volume(width, height, depth, 1, 4, 3); break;
+	case GradientEncoding::OCTAHEDRAL: gradients = new Volume(width, height, depth, 2, 1, 0); break;
+	}
+	gradients->widthSpacing = widthSpacing;
+	gradients->heightSpacing = heightSpacing;
+	gradients->depthSpacing = depthSpacing;
+
+	if (!dispatchVolume<GradientsKernel>(this, gradients, Vector3(widthSpacing, heightSpacing, depthSpacing), method, encoding)) {
+		std::cout << "[ERROR]: Gradients: unsupported voxel format" << std::endl;
+		delete gradients;
+		return NULL;
+	}
+
+	std::cout << " + Volume gradients in " << (getTime() - time) << "ms" << std::endl;
+	return gradients;
+}
+
+//chunks in the grid of the header (in 64 bits, the header can be anything)
+static unsigned long long getNumChunks(const sCVOLHeader& header)
+{
+	unsigned long long size = header.chunkSize;
+	return ((header.width + size - 1) / size) * ((header.height + size - 1) / size) * ((header.depth + size - 1) / size);
+}
+
+//box of voxels covered by a chunk
+static void getChunkBox(const sCVOLHeader& header, unsigned int index, unsigned int* start, unsigned int* size)
+{
+	unsigned int chunks_x = (header.width + header.chunkSize - 1) / header.chunkSize;
+	unsigned int chunks_y = (header.height + header.chunkSize - 1) / header.chunkSize;
+	unsigned int coords[3] = { index % chunks_x, (index / chunks_x) % chunks_y, index / (chunks_x * chunks_y) };
+	unsigned int dims[3] = { header.width, header.height, header.depth };
+	for (int a = 0; a < 3; a++) {
+		start[a] = coords[a] * header.chunkSize;
+		size[a] = std::min(header.chunkSize, dims[a] - start[a]);
+	}
+}
+
+bool Volume::saveCVOL(const char* filename, unsigned int chunk_size, bool delta_slices) {
+	if (!data || chunk_size == 0)
+		return false;
+
+	long time = getTime();
+	std::cout << " + Volume saving: " << filename << " ... ";
+
+	sCVOLHeader header;
+	memcpy(header.magic, "CVOL", 4);
+	header.version = CVOL_VERSION;
+	header.width = width;
+	header.height = height;
+	header.depth = depth;
+	header.spacing[0] = widthSpacing;
+	header.spacing[1] = heightSpacing;
+	header.spacing[2] = depthSpacing;
+	header.voxelChannels = voxelChannels;
+	header.voxelBytes = voxelBytes;
+	header.voxelType = voxelType;
+	header.chunkSize = chunk_size;
+	header.flags = delta_slices ? CVOL_DELTA_SLICES : 0;
+	header.numChunks = (unsigned int)getNumChunks(header);
+
+	const size_t voxel_size = voxelChannels * voxelBytes;
+	std::vector<sCVOLChunk> index(header.numChunks);
+	std::vector< std::vector<Uint8> > chunks(header.numChunks);
+
+	//chunks are compressed in parallel and written in order
+	parallelFor(0, header.numChunks, [&](int c0, int c1) {
+		std::vector<Uint8> raw;
+		for (int c = c0; c < c1; c++) {
+			unsigned int start[3], size[3];
+			getChunkBox(header, c, start, size);
+			size_t row_bytes = size[0] * voxel_size;
+			size_t slice_bytes = row_bytes * size[1];
+			raw.resize(slice_bytes * size[2]);
+
+			for (unsigned int z = 0; z < size[2]; z++)
+				for (unsigned int y = 0; y < size[1]; y++)
+					memcpy(&raw[z * slice_bytes + y * row_bytes], data + ((size_t)start[0] + (size_t)(start[1] + y) * width + (size_t)(start[2] + z) * width * height) * voxel_size, row_bytes);
+
+			//backwards, so every slice is subtracted the original previous one
+			if (delta_slices)
+				for (unsigned int z = size[2] - 1; z > 0; z--) {
+					Uint8* slice = &raw[z * slice_bytes];
+					const Uint8* previous = slice - slice_bytes;
+					for (size_t i = 0; i < slice_bytes; i++)
+						slice[i] -= previous[i];
+				}
+
+			std::vector<Uint8>& compressed = chunks[c];
+			compressed.resize(lzCompressBound(raw.size()));
+			size_t compressed_size = lzCompress(&raw[0], raw.size(), &compressed[0], compressed.size());
+			if (compressed_size == 0 || compressed_size >= raw.size())
+				compressed = raw; //incompressible, stored as is
+			else
+				compressed.resize(compressed_size);
+
+			index[c].rawSize = (unsigned int)raw.size();
+			index[c].compressedSize = (unsigned int)compressed.size();
+		}
+	});
+
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL) {
+		std::cout << "[ERROR]: cannot write the file" << std::endl;
+		return false;
+	}
+
+	unsigned long long offset = sizeof(sCVOLHeader) + sizeof(sCVOLChunk) * (unsigned long long)header.numChunks;
+	size_t total = 0;
+	for (unsigned int c = 0; c < header.numChunks; c++) {
+		index[c].offset = offset;
+		offset += index[c].compressedSize;
+		total += index[c].compressedSize;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(&index[0], sizeof(sCVOLChunk), index.size(), file) == index.size();
+	for (unsigned int c = 0; ok && c < header.numChunks; c++)
+		ok = fwrite(&chunks[c][0], 1, chunks[c].size(), file) == chunks[c].size();
+	fclose(file);
+
+	if (!ok) {
+		std::cout << "[ERROR]: cannot write the file" << std::endl;
+		return false;
+	}
+	std::cout << "[OK] Ratio: " << (total ? (double)width * height * depth * voxel_size / total : 0.0) << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+bool Volume::loadCVOL(const char* filename) {
+	if (!loadCVOLRegion(filename, 0, 0, 0, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF))
+		return false;
+	this->filename = filename; //regions don't keep it, their statistics are not the file ones
+	return true;
+}
+
+bool Volume::loadCVOLRegion(const char* filename, unsigned int x, unsigned int y, unsigned int z, unsigned int w, unsigned int h, unsigned int d) {
+	long time = getTime();
+	std::cout << " + Volume loading: " << filename << " ... ";
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		std::cout << " [ERROR]: Volume not found " << std::endl;
+		return false;
+	}
+
+	sCVOLHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "CVOL", 4) != 0 || header.version != CVOL_VERSION || header.chunkSize == 0) {
+		std::cout << "[ERROR]: unsupported CVOL file" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	//every voxel must come from a chunk, the index is not trusted before allocating it
+	if (header.voxelChannels * header.voxelBytes == 0 || header.numChunks != getNumChunks(header)) {
+		std::cout << "[ERROR]: CVOL header does not match its chunks" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	std::vector<sCVOLChunk> index(header.numChunks);
+	if (header.numChunks == 0 || fread(&index[0], sizeof(sCVOLChunk), index.size(), file) != index.size()) {
+		std::cout << "[ERROR]: CVOL index is truncated" << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	//clamp the region to the volume
+	if (x >= header.width || y >= header.height || z >= header.depth) {
+		std::cout << "[ERROR]: region outside of the volume" << std::endl;
+		fclose(file);
+		return false;
+	}
+	unsigned int region_start[3] = { x, y, z };
+	unsigned int region_size[3] = { std::min(w, header.width - x), std::min(h, header.height - y), std::min(d, header.depth - z) };
+
+	//only the chunks touching the region are read
+	std::vector<unsigned int> needed;
+	for (unsigned int c = 0; c < header.numChunks; c++) {
+		unsigned int start[3], size[3];
+		getChunkBox(header, c, start, size);
+		bool overlaps = true;
+		for (int a = 0; a < 3; a++)
+			overlaps = overlaps && start[a] < region_start[a] + region_size[a] && region_start[a] < start[a] + size[a];
+		if (overlaps)
+			needed.push_back(c);
+	}
+
+	freeData();
+	width = region_size[0];
+	height = region_size[1];
+	depth = region_size[2];
+	widthSpacing = header.spacing[0];
+	heightSpacing = header.spacing[1];
+	depthSpacing = header.spacing[2];
+	voxelChannels = header.voxelChannels;
+	voxelBytes = header.voxelBytes;
+	voxelType = header.voxelType;
+	const size_t voxel_size = voxelChannels * voxelBytes;
+	data = new Uint8[(size_t)width * height * depth * voxel_size];
+
+	//reads are serialized (one file), decompression of a chunk overlaps with the reads of the others
+	std::mutex file_mutex;
+	std::atomic<bool> failed(false);
+	parallelFor(0, (int)needed.size(), [&](int n0, int n1) {
+		std::vector<Uint8> compressed, raw;
+		for (int n = n0; n < n1 && !failed; n++) {
+			const sCVOLChunk& chunk = index[needed[n]];
+			unsigned int start[3], size[3];
+			getChunkBox(header, needed[n], start, size);
+			size_t row_bytes = size[0] * voxel_size;
+			size_t slice_bytes = row_bytes * size[1];
+			if (chunk.rawSize != slice_bytes * size[2]) {
+				failed = true;
+				break;
+			}
+
+			compressed.resize(chunk.compressedSize);
+			{
+				std::lock_guard<std::mutex> lock(file_mutex);
+				fseek64(file, chunk.offset, SEEK_SET);
+				if (fread(&compressed[0], 1, chunk.compressedSize, file) != chunk.compressedSize) {
+					failed = true;
+					break;
+				}
+			}
+
+			if (chunk.compressedSize == chunk.rawSize)
+				raw.swap(compressed);
+			else {
+				raw.resize(chunk.rawSize);
+				if (lzDecompress(&compressed[0], compressed.size(), &raw[0], raw.size()) != raw.size()) {
+					failed = true;
+					break;
+				}
+			}
+
+			if (header.flags & CVOL_DELTA_SLICES)
+				for (unsigned int sz = 1; sz < size[2]; sz++) {
+					Uint8* slice = &raw[sz * slice_bytes];
+					const Uint8* previous = slice - slice_bytes;
+					for (size_t i = 0; i < slice_bytes; i++)
+						slice[i] += previous[i];
+				}
+
+			//copy the rows of the chunk inside the region
+			unsigned int from[3], to[3];
+			for (int a = 0; a < 3; a++) {
+				from[a] = std::max(start[a], region_start[a]);
+				to[a] = std::min(start[a] + size[a], region_start[a] + region_size[a]);
+			}
+			size_t copy_bytes = (to[0] - from[0]) * voxel_size;
+			for (unsigned int vz = from[2]; vz < to[2]; vz++)
+				for (unsigned int vy = from[1]; vy < to[1]; vy++) {
+					const Uint8* src = &raw[(vz - start[2]) * slice_bytes + (vy - start[1]) * row_bytes + (from[0] - start[0]) * voxel_size];
+					Uint8* dst = data + ((size_t)(from[0] - region_start[0]) + (size_t)(vy - region_start[1]) * width + (size_t)(vz - region_start[2]) * width * height) * voxel_size;
+					memcpy(dst, src, copy_bytes);
+				}
+		}
+	});
+	fclose(file);
+
+	if (failed) {
+		std::cout << "[ERROR]: CVOL chunks are corrupted or truncated" << std::endl;
+		clear();
+		return false;
+	}
+	std::cout << "[OK] Size: " << width << "x" << height << "x" << depth << " Chunks: " << needed.size() << "/" << header.numChunks << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+template <typename T, int Channels>
+struct StatisticsKernel {
+	static void run(VolumeView<T, Channels> volume, sVolumeStatistics* stats);
+};
+
+template <typename T, int Channels>
+void StatisticsKernel<T, Channels>::run(VolumeView<T, Channels> volume, sVolumeStatistics* stats)
+{
+	const T* src = volume.data;
+	const unsigned int channels = Channels;
+	const size_t stride = Channels;
+	const int w = volume.width, h = volume.height, d = volume.depth;
+	const size_t row = volume.row;
+	const size_t slice = volume.slice;
+	std::mutex mutex;
+
+	//gradient magnitudes of the first channel along a row, clamping only at the borders
+	auto gradientRow = [&](int y, int z, float* out) {
+		const T* p = src + y * row + z * slice;
+		const T* py0 = src + std::max(y - 1, 0) * row + z * slice;
+		const T* py1 = src + std::min(y + 1, h - 1) * row + z * slice;
+		const T* pz0 = src + y * row + std::max(z - 1, 0) * slice;
+		const T* pz1 = src + y * row + std::min(z + 1, d - 1) * slice;
+		for (int x = 0; x < w; x++) {
+			size_t x0 = (x > 0 ? x - 1 : 0) * stride, x1 = (x < w - 1 ? x + 1 : w - 1) * stride, xc = x * stride;
+			float gx = VoxelTraits<T>::toFloat(p[x1]) - VoxelTraits<T>::toFloat(p[x0]);
+			float gy = VoxelTraits<T>::toFloat(py1[xc]) - VoxelTraits<T>::toFloat(py0[xc]);
+			float gz = VoxelTraits<T>::toFloat(pz1[xc]) - VoxelTraits<T>::toFloat(pz0[xc]);
+			out[x] = 0.5f * sqrtf(gx * gx + gy * gy + gz * gz);
+		}
+	};
+
+	//1: ranges and moments, every thread reduces its slabs and then they are merged
+	for (unsigned int c = 0; c < channels; c++) {
+		stats->min[c] = 3.4e38f;
+		stats->max[c] = -3.4e38f;
+		stats->mean[c] = 0.0;
+		stats->variance[c] = 0.0;
+	}
+	stats->max_gradient = 0.0f;
+
+	parallelFor(0, d, [&](int z0, int z1) {
+		float local_min[4], local_max[4], local_gradient = 0.0f;
+		double local_sum[4], local_sum2[4];
+		std::vector<float> gradients(w);
+		for (unsigned int c = 0; c < channels; c++) {
+			local_min[c] = 3.4e38f;
+			local_max[c] = -3.4e38f;
+			local_sum[c] = local_sum2[c] = 0.0;
+		}
+
+		for (int z = z0; z < z1; z++)
+			for (int y = 0; y < h; y++) {
+				const T* p = src + y * row + z * slice;
+				for (unsigned int c = 0; c < channels; c++) {
+					//simple loops over a row so the compiler can vectorize the reductions
+					float row_min = local_min[c], row_max = local_max[c];
+					double row_sum = 0.0, row_sum2 = 0.0;
+					for (int x = 0; x < w; x++) {
+						float v = VoxelTraits<T>::toFloat(p[x * stride + c]);
+						row_min = v < row_min ? v : row_min;
+						row_max = v > row_max ? v : row_max;
+						row_sum += v;
+						row_sum2 += (double)v * v;
 					}
+					local_min[c] = row_min;
+					local_max[c] = row_max;
+					local_sum[c] += row_sum;
+					local_sum2[c] += row_sum2;
 				}
-				_distances[i + j*side + k*side*side] = mindist;
-				if (mindist > maxdist) maxdist = mindist;
+				gradientRow(y, z, &gradients[0]);
+				for (int x = 0; x < w; x++)
+					local_gradient = std::max(local_gradient, gradients[x]);
 			}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (unsigned int c = 0; c < channels; c++) {
+			stats->min[c] = std::min(stats->min[c], local_min[c]);
+			stats->max[c] = std::max(stats->max[c], local_max[c]);
+			stats->mean[c] += local_sum[c];
+			stats->variance[c] += local_sum2[c];
 		}
+		stats->max_gradient = std::max(stats->max_gradient, local_gradient);
+	});
+
+	double count = (double)w * h * d;
+	for (unsigned int c = 0; c < channels; c++) {
+		stats->mean[c] /= count;
+		stats->variance[c] = std::max(0.0, stats->variance[c] / count - stats->mean[c] * stats->mean[c]);
 	}
 
-	//Normalize and store
-	for (unsigned int i = 0; i < side; i++) {
-		for (unsigned int j = 0; j < side; j++) {
-			for (unsigned int k = 0; k < side; k++) {
-				unsigned int index = i + j*side + k * side*side;
-				Uint8 v = std::floor( (_distances[index] / maxdist) * 256 );
-				data[(index * voxelChannels) + (channel - 1)] = 256 - v;
+	//2: histograms, per thread and then added
+	for (unsigned int c = 0; c < channels; c++)
+		stats->fine_histogram[c].assign(VOLUME_FINE_HISTOGRAM_BINS, 0);
+	stats->gradient_histogram.assign(VOLUME_GRADIENT_HISTOGRAM_BINS * VOLUME_GRADIENT_HISTOGRAM_BINS, 0);
+
+	float bin_scale[4];
+	for (unsigned int c = 0; c < channels; c++)
+		bin_scale[c] = stats->max[c] > stats->min[c] ? VOLUME_FINE_HISTOGRAM_BINS / (stats->max[c] - stats->min[c]) : 0.0f;
+	float gradient_scale = stats->max_gradient > 0.0f ? VOLUME_GRADIENT_HISTOGRAM_BINS / stats->max_gradient : 0.0f;
+
+	parallelFor(0, d, [&](int z0, int z1) {
+		std::vector<unsigned int> fine(VOLUME_FINE_HISTOGRAM_BINS * channels, 0);
+		std::vector<unsigned int> gradient(VOLUME_GRADIENT_HISTOGRAM_BINS * VOLUME_GRADIENT_HISTOGRAM_BINS, 0);
+		std::vector<float> gradients(w);
+
+		for (int z = z0; z < z1; z++)
+			for (int y = 0; y < h; y++) {
+				const T* p = src + y * row + z * slice;
+				gradientRow(y, z, &gradients[0]);
+				for (int x = 0; x < w; x++)
+					for (unsigned int c = 0; c < channels; c++) {
+						int bin = (int)((VoxelTraits<T>::toFloat(p[x * stride + c]) - stats->min[c]) * bin_scale[c]);
+						bin = std::min(std::max(bin, 0), VOLUME_FINE_HISTOGRAM_BINS - 1);
+						fine[c * VOLUME_FINE_HISTOGRAM_BINS + bin]++;
+						if (c == 0) {
+							int gradient_bin = std::min((int)(gradients[x] * gradient_scale), VOLUME_GRADIENT_HISTOGRAM_BINS - 1);
+							gradient[gradient_bin * VOLUME_GRADIENT_HISTOGRAM_BINS + bin * VOLUME_GRADIENT_HISTOGRAM_BINS / VOLUME_FINE_HISTOGRAM_BINS]++;
+						}
+					}
 			}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (unsigned int c = 0; c < channels; c++)
+			for (int i = 0; i < VOLUME_FINE_HISTOGRAM_BINS; i++)
+				stats->fine_histogram[c][i] += fine[c * VOLUME_FINE_HISTOGRAM_BINS + i];
+		for (size_t i = 0; i < gradient.size(); i++)
+			stats->gradient_histogram[i] += gradient[i];
+	});
+
+	//the coarse histogram groups fine bins (same range, so it is exact)
+	for (unsigned int c = 0; c < channels; c++) {
+		stats->histogram[c].assign(VOLUME_HISTOGRAM_BINS, 0);
+		for (int i = 0; i < VOLUME_FINE_HISTOGRAM_BINS; i++)
+			stats->histogram[c][i * VOLUME_HISTOGRAM_BINS / VOLUME_FINE_HISTOGRAM_BINS] += stats->fine_histogram[c][i];
+	}
+}
+
+//cache file: header, then the arrays. It is only valid for the same size and date of the volume file
+typedef struct
+{
+	char magic[4]; //VSTA
+	int version;
+	unsigned long long file_size;
+	long long file_time;
+	unsigned int channels;
+} sVolumeStatsHeader;
+
+static bool getFileStamp(const std::string& filename, unsigned long long* size, long long* time)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return false;
+	*size = (unsigned long long)info.st_size;
+	*time = (long long)info.st_mtime;
+	return true;
+}
+
+static bool readStatisticsCache(const std::string& filename, sVolumeStatistics* stats)
+{
+	sVolumeStatsHeader header, expected;
+	if (!getFileStamp(filename, &expected.file_size, &expected.file_time))
+		return false;
+	FILE* file = fopen((filename + ".stats").c_str(), "rb");
+	if (!file)
+		return false;
+
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "VSTA", 4) == 0 && header.version == VOLUME_STATS_VERSION &&
+		header.file_size == expected.file_size && header.file_time == expected.file_time && header.channels >= 1 && header.channels <= 4;
+	if (ok) {
+		stats->channels = header.channels;
+		ok = fread(stats->min, sizeof(float), 4, file) == 4 && fread(stats->max, sizeof(float), 4, file) == 4 &&
+			fread(stats->mean, sizeof(double), 4, file) == 4 && fread(stats->variance, sizeof(double), 4, file) == 4 &&
+			fread(&stats->max_gradient, sizeof(float), 1, file) == 1;
+		for (unsigned int c = 0; ok && c < stats->channels; c++) {
+			stats->histogram[c].resize(VOLUME_HISTOGRAM_BINS);
+			stats->fine_histogram[c].resize(VOLUME_FINE_HISTOGRAM_BINS);
+			ok = fread(&stats->histogram[c][0], sizeof(unsigned int), VOLUME_HISTOGRAM_BINS, file) == VOLUME_HISTOGRAM_BINS &&
+				fread(&stats->fine_histogram[c][0], sizeof(unsigned int), VOLUME_FINE_HISTOGRAM_BINS, file) == VOLUME_FINE_HISTOGRAM_BINS;
 		}
+		stats->gradient_histogram.resize(VOLUME_GRADIENT_HISTOGRAM_BINS * VOLUME_GRADIENT_HISTOGRAM_BINS);
+		ok = ok && fread(&stats->gradient_histogram[0], sizeof(unsigned int), stats->gradient_histogram.size(), file) == stats->gradient_histogram.size();
 	}
+	fclose(file);
+	return ok;
+}
 
-	delete _distances;
-}
\ No newline at end of file
+static void writeStatisticsCache(const std::string& filename, const sVolumeStatistics* stats)
+{
+	sVolumeStatsHeader header;
+	memset(&header, 0, sizeof(header)); //no garbage in the padding written to disk
+	memcpy(header.magic, "VSTA", 4);
+	header.version = VOLUME_STATS_VERSION;
+	header.channels = stats->channels;
+	if (!getFileStamp(filename, &header.file_size, &header.file_time))
+		return;
+	FILE* file = fopen((filename + ".stats").c_str(), "wb");
+	if (!file)
+		return; //read only folder, they will be computed again next time
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(stats->min, sizeof(float), 4, file);
+	fwrite(stats->max, sizeof(float), 4, file);
+	fwrite(stats->mean, sizeof(double), 4, file);
+	fwrite(stats->variance, sizeof(double), 4, file);
+	fwrite(&stats->max_gradient, sizeof(float), 1, file);
+	for (unsigned int c = 0; c < stats->channels; c++) {
+		fwrite(&stats->histogram[c][0], sizeof(unsigned int), VOLUME_HISTOGRAM_BINS, file);
+		fwrite(&stats->fine_histogram[c][0], sizeof(unsigned int), VOLUME_FINE_HISTOGRAM_BINS, file);
+	}
+	fwrite(&stats->gradient_histogram[0], sizeof(unsigned int), stats->gradient_histogram.size(), file);
+	fclose(file);
+}
+
+const sVolumeStatistics* Volume::getStatistics(bool use_cache_file) {
+	if (statistics)
+		return statistics;
+	if (!data || !width || !height || !depth)
+		return NULL;
+
+	sVolumeStatistics* stats = new sVolumeStatistics();
+	stats->channels = std::min(voxelChannels, 4u);
+	for (int c = 0; c < 4; c++) {
+		stats->min[c] = stats->max[c] = 0.0f;
+		stats->mean[c] = stats->variance[c] = 0.0;
+	}
+
+	bool cacheable = use_cache_file && !filename.empty();
+	if (cacheable && readStatisticsCache(filename, stats) && stats->channels == std::min(voxelChannels, 4u)) {
+		statistics = stats;
+		return statistics;
+	}
+
+	long time = getTime();
+	if (!dispatchVolume<StatisticsKernel>(this, stats)) {
+		std::cout << "[ERROR]: Statistics: unsupported voxel format" << std::endl;
+		delete stats;
+		return NULL;
+	}
+	std::cout << " + Volume statistics in " << (getTime() - time) << "ms" << std::endl;
+
+	if (cacheable)
+		writeStatisticsCache(filename, stats);
+	statistics = stats;
+	return statistics;
+}
+
+void Volume::invalidateStatistics() {
+	if (statistics)
+		delete statistics;
+	statistics = NULL;
+	filename.clear(); //the data is not the file one anymore, its .stats must not be read nor written
+}
+
+template <typename T, int Channels>
+struct QuantizeKernel {
+	static void run(VolumeView<T, Channels> volume, Volume* quantized, const float* low, const float* high) {
+		if (quantized->voxelBytes == 1)
+			write<Uint8>(volume, quantized, low, high);
+		else
+			write<Uint16>(volume, quantized, low, high);
+	}
+
+	//[low, high] of every channel to the whole range of Q, values outside are clamped
+	template <typename Q>
+	static void write(VolumeView<T, Channels> volume, Volume* quantized, const float* low, const float* high) {
+		VolumeView<Q, Channels> dst(quantized);
+		float scale[Channels];
+		for (int c = 0; c < Channels; c++)
+			scale[c] = VoxelTraits<Q>::normalizedMax() / std::max(high[c] - low[c], 1e-20f);
+
+		parallelFor(0, volume.depth, [&](int z0, int z1) {
+			for (int z = z0; z < z1; z++)
+				for (int y = 0; y < volume.height; y++) {
+					const T* src = volume.getRow(y, z);
+					Q* out = dst.getRow(y, z);
+					for (int x = 0; x < volume.width; x++)
+						for (int c = 0; c < Channels; c++)
+							out[x * Channels + c] = VoxelTraits<Q>::fromFloat((VoxelTraits<T>::toFloat(src[x * Channels + c]) - low[c]) * scale[c]);
+				}
+		});
+	}
+};
+
+template <typename T, int Channels>
+struct NormalizedMaxKernel {
+	static void run(VolumeView<T, Channels>, float* result) { *result = VoxelTraits<T>::normalizedMax(); }
+};
+
+Volume* Volume::createQuantized(unsigned int bytes, float low_percentile, float high_percentile) {
+	//packed formats (RGB10A2) are bit fields, not values that can be windowed
+	if (!data || !width || !height || !depth || (bytes != 1 && bytes != 2) || voxelChannels > 4 || voxelType == 3)
+		return NULL;
+
+	const sVolumeStatistics* stats = getStatistics();
+	if (!stats)
+		return NULL;
+
+	//window of every channel from the percentiles of its fine histogram (in the units of the data)
+	float low[4], high[4];
+	for (unsigned int c = 0; c < voxelChannels; c++) {
+		const std::vector<unsigned int>& histogram = stats->fine_histogram[c];
+		double total = 0.0;
+		for (size_t i = 0; i < histogram.size(); i++)
+			total += histogram[i];
+		int low_bin = 0, high_bin = VOLUME_FINE_HISTOGRAM_BINS - 1;
+		double accumulated = 0.0;
+		for (int i = 0; i < VOLUME_FINE_HISTOGRAM_BINS; i++) {
+			accumulated += histogram[i];
+			if (accumulated <= total * low_percentile)
+				low_bin = i + 1;
+			if (accumulated < total * high_percentile)
+				high_bin = i + 1;
+		}
+		low_bin = std::min(low_bin, VOLUME_FINE_HISTOGRAM_BINS - 1);
+		high_bin = std::max(std::min(high_bin, VOLUME_FINE_HISTOGRAM_BINS - 1), low_bin);
+		float bin_size = (stats->max[c] - stats->min[c]) / VOLUME_FINE_HISTOGRAM_BINS;
+		low[c] = stats->min[c] + low_bin * bin_size;
+		high[c] = stats->min[c] + (high_bin + 1) * bin_size;
+	}
+
+	Volume* quantized = new Volume(width, height, depth, voxelChannels, bytes, 0);
+	quantized->widthSpacing = widthSpacing;
+	quantized->heightSpacing = heightSpacing;
+	quantized->depthSpacing = depthSpacing;
+
+	float normalized_max = 1.0f;
+	if (!dispatchVolume<QuantizeKernel>(this, quantized, (const float*)low, (const float*)high) || !dispatchVolume<NormalizedMaxKernel>(this, &normalized_max)) {
+		std::cout << "[ERROR]: Quantization: unsupported voxel format" << std::endl;
+		delete quantized;
+		return NULL;
+	}
+
+	//back to the normalized values of this volume (and to the original ones if this was already quantized)
+	for (unsigned int c = 0; c < voxelChannels; c++) {
+		float scale = (high[c] - low[c]) / normalized_max;
+		float bias = low[c] / normalized_max;
+		quantized->quantizationScale[c] = scale * quantizationScale[c];
+		quantized->quantizationBias[c] = bias * quantizationScale[c] + quantizationBias[c];
+	}
+
+	std::cout << " + Volume quantized to " << bytes * 8 << " bits, window [" << low[0] << ", " << high[0] << "]" << std::endl;
+	return quantized;
+}
@@ -5,6 +5,51 @@
 #include "includes.h"
 #include "framework.h"
 
+class MappedFile;
+class Mesh;
+struct sPVMVolume;
+
+//Settings of one channel generated by Volume::fillWorleyNoise
+struct sWorleyChannel {
+	unsigned int channel;	//1 for R to 4 for A
+	unsigned int cells;		//cells along the largest side of the volume (the frequency)
+	bool f2;				//distance to the second closest point instead of the closest one
+	bool invert;			//bright near the points (cloud look)
+
+	sWorleyChannel(unsigned int channel = 1, unsigned int cells = 4, bool f2 = false, bool invert = true) { this->channel = channel; this->cells = cells; this->f2 = f2; this->invert = invert; }
+};
+
+//Volume::createGradients options
+enum class GradientMethod {
+	CENTRAL_DIFFERENCES,
+	SOBEL				//3x3x3 smoothed differences, less noisy
+};
+
+enum class GradientEncoding {
+	RGB8,				//3 channels, direction * 0.5 + 0.5
+	RGB10A2,			//1 packed channel of 4 bytes (voxelType 3), GL_RGB10_A2 texture
+	OCTAHEDRAL			//2 channels (RG8), decode with the octahedral mapping
+};
+
+#define VOLUME_HISTOGRAM_BINS 256
+#define VOLUME_FINE_HISTOGRAM_BINS 4096
+#define VOLUME_GRADIENT_HISTOGRAM_BINS 256
+
+//Value distribution of a volume (to set up transfer functions), histograms go from min to max of every channel
+struct sVolumeStatistics {
+	unsigned int channels;
+	float min[4];
+	float max[4];
+	double mean[4];
+	double variance[4];
+	std::vector<unsigned int> histogram[4];			//VOLUME_HISTOGRAM_BINS
+	std::vector<unsigned int> fine_histogram[4];	//VOLUME_FINE_HISTOGRAM_BINS
+
+	//first channel: value (x) against gradient magnitude (y, from 0 to max_gradient), row major
+	float max_gradient;
+	std::vector<unsigned int> gradient_histogram;
+};
+
 //Class to represent a volume
 class Volume
 {
@@ -19,9 +64,17 @@ public:
 
 	unsigned int voxelBytes;	//1, 2 or 4
 	unsigned int voxelChannels;	//1, 2, 3 or 4
-	unsigned int voxelType;		//0: unsigned int, 1: int, 2: float, 3: other
+	unsigned int voxelType;		//0: unsigned int, 1: int, 2: float, 3: other (4 bytes: packed RGB10A2)
 
 	Uint8* data; //bytes with the pixel information
+	MappedFile* mapping; //if not NULL, data points inside this file mapping (do not delete[] it)
+	std::string filename; //file the volume was loaded from, its statistics are cached next to it
+	sVolumeStatistics* statistics; //NULL until getStatistics is called
+
+	//normalized value of the original data = normalized value of this volume * scale + bias (per channel).
+	//Identity unless it comes from createQuantized, shaders use it to get the original densities back (not saved in the files)
+	float quantizationScale[4];
+	float quantizationBias[4];
 
 	Volume();
 	Volume(unsigned int w, unsigned int h, unsigned int d, unsigned int channels = 1, unsigned int bytes = 1, unsigned int type = 0);
@@ -29,19 +82,63 @@ public:
 
 	unsigned int getTextureFormat();
 	unsigned int getTextureType();
-	unsigned int getTextureInternalFormat();
+	unsigned int getTextureInternalFormat(); //sized: R8, R16, R16F, R32F... (RG, RGB and RGBA for more channels)
 
 	void resize(int w, int h, int d, unsigned int channels = 1, unsigned int bytes = 1);
 	void clear();
+	bool isMapped() { return mapping != NULL; }
+	void releasePages(); //tell the OS it can drop the pages of a mapped volume (i.e. after uploading it to VRAM), changes made to data are lost
+
+	//trilinear sample of a channel (0 is R) in voxel coordinates, as stored (not normalized). Use a VolumeView (volumeview.h) in loops
+	float sample(float x, float y, float z, unsigned int channel = 0);
 
-	//Carefull using too large files as it may crash the app
-	bool loadVL(const char* filename);
+	//use_mapping maps the file in memory instead of reading it, data is paged in when accessed
+	//Carefull using too large files without mapping as it may crash the app
+	bool loadVL(const char* filename, bool use_mapping = true);
 	bool loadPVM(const char* filename);
+	//several PVMs at once, the next file is read while the previous ones are decoded (NULL for the ones that fail)
+	static std::vector<Volume*> loadPVMs(const std::vector<std::string>& filenames);
 
-	//Slow methods
-	void fillSphere();
+	//Chunked container (.cvol): chunks of chunk_size^3 voxels compressed on their own, so they decode in parallel and regions can be read alone
+	bool saveCVOL(const char* filename, unsigned int chunk_size = 64, bool delta_slices = true);
+	bool loadCVOL(const char* filename);
+	bool loadCVOLRegion(const char* filename, unsigned int x, unsigned int y, unsigned int z, unsigned int w, unsigned int h, unsigned int d); //the volume becomes that box
+
+	//Fills write normalized values in any voxel format (0..255 in 8 bits, 0..65535 in 16 bits, 0..1 in floats)
+	void fillSphere(); //first channel
 	void fillNoise(float frequency, int octaves, unsigned int seed, unsigned int channel = 1); //Channel 1 for R to 4 for A
 	void fillWorleyNoise(unsigned int cellsPerSide = 4, unsigned int channel = 1); //Channel 1 for R to 4 for A
+	void fillWorleyNoise(const std::vector<sWorleyChannel>& channels, unsigned int seed = 0); //several channels in one pass, tileable
+
+	//Empty space skipping: coarse volume with the min (R) and max (G) of the first channel in every block of cell_size^3 voxels.
+	//Neighbour cells share their border voxels so any trilinear sample inside a cell stays in its range.
+	Volume* createMacrocells(unsigned int cell_size = 8);
+
+	//Multiresolution: 2x downsampled copy (2x2x2 box, the trilinear sample between the voxels) or the max of the 8 voxels (keeps thin bright features)
+	Volume* createHalfResolution(bool use_max = false);
+	//levels 1..num_levels, every one half the previous (0 goes down to a single voxel), the caller owns them
+	std::vector<Volume*> createPyramid(unsigned int num_levels = 0, bool use_max = false);
+
+	//Statistics of the whole volume, computed once in parallel and cached in <filename>.stats (if the volume has a file)
+	const sVolumeStatistics* getStatistics(bool use_cache_file = true);
+	void invalidateStatistics(); //call it after modifying data, it also forgets the filename so the cache of the file is not used
+
+	//Remaps the data to 1 or 2 bytes unsigned normalized voxels (2-4x less VRAM). The window of every channel goes from the low to the
+	//high percentile of its histogram (values outside are clamped) and it is kept in quantizationScale/Bias
+	Volume* createQuantized(unsigned int bytes = 1, float low_percentile = 0.001f, float high_percentile = 0.999f);
+	void resetQuantization();
+	void copyQuantization(const Volume* source);
+
+	//Lighting: normalized gradient of the first channel (scaled by the spacing), so shaders don't need 6 extra fetches per sample
+	Volume* createGradients(GradientMethod method = GradientMethod::CENTRAL_DIFFERENCES, GradientEncoding encoding = GradientEncoding::RGB8);
+
+	//Signed distance to the surface of a mesh (mesh units, negative inside) in a float or half volume. It covers the aabb of the mesh grown by padding
+	//(fraction of its longest side, the box is returned) with resolution voxels along the longest side. Inside comes from ray parity, the mesh should be closed
+	bool bakeSDF(Mesh* mesh, unsigned int resolution = 64, bool use_half = false, float padding = 0.05f, BoundingBox* box = NULL);
+
+private:
+	void freeData();
+	void setFromPVM(sPVMVolume& pvm);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "volumeloader.h"
+#include "volume.h"
+#include "texture.h"
+#include "utils.h"
+
+#include <algorithm>
+
+VolumeLoader::VolumeLoader()
+{
+	volume = NULL;
+	preview = NULL;
+	texture = NULL;
+	preview_texture = NULL;
+	preview_size = 64;
+	upload_budget = 16 * 1024 * 1024;
+	state = IDLE;
+	next_slice = 0;
+	slices_per_frame = 1;
+	pbos[0] = pbos[1] = 0;
+	current_pbo = 0;
+}
+
+VolumeLoader::~VolumeLoader()
+{
+	if (worker.joinable())
+		worker.join();
+	if (pbos[0])
+		glDeleteBuffers(2, pbos);
+	if (texture)
+		delete texture;
+	if (preview_texture)
+		delete preview_texture;
+	if (volume)
+		delete volume;
+	if (preview)
+		delete preview;
+}
+
+bool VolumeLoader::load(const char* filename)
+{
+	int current = state;
+	if (current == LOADING || current == LOADED || current == UPLOADING)
+		return false;
+
+	//previous results
+	if (worker.joinable())
+		worker.join();
+	if (texture)
+		delete texture;
+	if (preview_texture)
+		delete preview_texture;
+	if (volume)
+		delete volume;
+	if (preview)
+		delete preview;
+	texture = preview_texture = NULL;
+	volume = preview = NULL;
+
+	this->filename = filename;
+	state = LOADING;
+	worker = std::thread(&VolumeLoader::loadInWorker, this);
+	return true;
+}
+
+void VolumeLoader::loadInWorker()
+{
+	std::string ext = filename.substr(filename.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	Volume* loaded = new Volume();
+	bool ok;
+	if (ext == "pvm")
+		ok = loaded->loadPVM(filename.c_str());
+	else if (ext == "cvol")
+		ok = loaded->loadCVOL(filename.c_str());
+	else
+		ok = loaded->loadVL(filename.c_str(), false); //read now, not paged in by the main thread while uploading
+
+	if (!ok) {
+		delete loaded;
+		state = FAILED;
+		return;
+	}
+
+	//halve it until it fits in the preview size
+	Volume* coarse = loaded;
+	while (std::max(coarse->width, std::max(coarse->height, coarse->depth)) > preview_size) {
+		Volume* half = coarse->createHalfResolution();
+		if (!half)
+			break;
+		if (coarse != loaded)
+			delete coarse;
+		coarse = half;
+	}
+
+	preview = coarse != loaded ? coarse : NULL;
+	volume = loaded;
+	state = LOADED; //publishes volume and preview to the main thread
+}
+
+void VolumeLoader::update()
+{
+	int current = state;
+	if (current == LOADED) {
+		worker.join();
+		if (preview) {
+			preview_texture = new Texture();
+			preview_texture->create3DFromVolume(preview);
+		}
+		startUpload();
+		state = UPLOADING; //slices start next frame, the preview can be shown in this one
+	}
+	else if (current == UPLOADING)
+		uploadSlices();
+}
+
+void VolumeLoader::startUpload()
+{
+	//storage only, the slices are copied later
+	texture = new Texture();
+	texture->create3D(volume->width, volume->height, volume->depth, volume->getTextureFormat(), volume->getTextureType(), false, NULL, volume->getTextureInternalFormat());
+	texture->upload3D(volume->getTextureFormat(), volume->getTextureType(), false, NULL, volume->getTextureInternalFormat());
+
+	size_t slice_bytes = (size_t)volume->width * volume->height * volume->voxelChannels * volume->voxelBytes;
+	slices_per_frame = (unsigned int)std::min((size_t)volume->depth, std::max((size_t)1, upload_budget / slice_bytes));
+	next_slice = 0;
+	current_pbo = 0;
+
+	glGenBuffers(2, pbos);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slices_per_frame * slice_bytes, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void VolumeLoader::uploadSlices()
+{
+	size_t slice_bytes = (size_t)volume->width * volume->height * volume->voxelChannels * volume->voxelBytes;
+	unsigned int slices = std::min(slices_per_frame, volume->depth - next_slice);
+	size_t bytes = slices * slice_bytes;
+	const Uint8* src = volume->data + next_slice * slice_bytes;
+
+	//the PBOs alternate, so writing this one does not wait for the transfer of the previous frame
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[current_pbo]);
+	void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	const void* pixels = (const void*)0; //offset in the PBO
+	if (dst) {
+		memcpy(dst, src, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); //mapping failed, upload from memory
+		pixels = src;
+	}
+
+	glBindTexture(GL_TEXTURE_3D, texture->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, next_slice, volume->width, volume->height, slices, volume->getTextureFormat(), volume->getTextureType(), pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	next_slice += slices;
+	current_pbo ^= 1;
+
+	if (next_slice >= volume->depth) {
+		glDeleteBuffers(2, pbos);
+		pbos[0] = pbos[1] = 0;
+		state = READY;
+		std::cout << " + Volume uploaded: " << filename << std::endl;
+	}
+}
+
+float VolumeLoader::getProgress()
+{
+	int current = state;
+	if (current == READY)
+		return 1.0f;
+	if (current == UPLOADING && volume)
+		return next_slice / (float)volume->depth;
+	return 0.0f;
+}
+
+Texture* VolumeLoader::getTexture()
+{
+	if (state == READY)
+		return texture;
+	if (state == UPLOADING)
+		return preview_texture;
+	return NULL;
+}
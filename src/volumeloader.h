@@ -0,0 +1,55 @@
+#ifndef VOLUMELOADER_H
+#define VOLUMELOADER_H
+
+#include "includes.h"
+#include "framework.h"
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+class Volume;
+class Texture;
+
+//Loads a volume (.vl, .pvm or .cvol) in a worker thread and uploads it to a 3D texture over several frames,
+//some slices per frame through two pixel buffer objects, so the main thread never waits for the disk nor for a big upload.
+//A coarse copy is uploaded as soon as the volume is decoded, so there is something to render meanwhile.
+class VolumeLoader
+{
+public:
+	enum eState { IDLE, LOADING, LOADED, UPLOADING, READY, FAILED };
+
+	std::string filename;
+	Volume* volume;				//full resolution, available once LOADED
+	Volume* preview;			//coarse copy, NULL if the volume is already small
+	Texture* texture;			//full resolution, complete when READY
+	Texture* preview_texture;
+	unsigned int preview_size;	//max voxels per side of the preview
+	size_t upload_budget;		//bytes uploaded per frame (at least one slice)
+
+	//all of them are owned by the loader
+	VolumeLoader();
+	~VolumeLoader(); //waits for the worker if it is still reading
+
+	bool load(const char* filename); //starts loading in the background, false if it is busy
+	void update(); //call it once per frame from the thread with the GL context
+
+	eState getState() { return (eState)state.load(); }
+	bool isReady() { return state == READY; }
+	float getProgress(); //0 while reading, then the fraction of slices uploaded
+	Texture* getTexture(); //the best texture available, NULL until the preview is uploaded
+
+private:
+	std::thread worker;
+	std::atomic<int> state;
+	unsigned int next_slice;
+	unsigned int slices_per_frame;
+	unsigned int pbos[2];
+	unsigned int current_pbo;
+
+	void loadInWorker();
+	void startUpload();
+	void uploadSlices();
+};
+
+#endif
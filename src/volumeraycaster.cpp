@@ -0,0 +1,218 @@
+#include "volumeraycaster.h"
+#include "volume.h"
+#include "volumeview.h"
+#include "material.h"
+#include "camera.h"
+#include "texture.h"
+#include "utils.h"
+#include "threadpool.h"
+
+#include <algorithm>
+
+//values shared by all the tiles of a frame
+struct sRaycastFrame {
+	Image* image;
+	Vector3 origin; //camera in the local space of the cube
+	Matrix44 inv_viewprojection;
+	Matrix44 inv_model;
+	int tiles_x;
+	int tiles_y;
+};
+
+template <typename T, int Channels>
+struct RaycastKernel {
+	static void run(VolumeView<T, Channels> volume, const VolumeRaycaster* raycaster, const sRaycastFrame& frame) {
+		//textures normalize integers (and quantized volumes keep their mapping), densities are compared like in the shader
+		const Volume* source = raycaster->volume;
+		const float value_scale = source->quantizationScale[0] / VoxelTraits<T>::normalizedMax();
+		const float value_bias = source->quantizationBias[0];
+		const float cells_threshold = (raycaster->density_threshold - value_bias) / value_scale; //macrocells store raw values
+		const Vector3 dims((float)volume.width, (float)volume.height, (float)volume.depth);
+		const float step = raycaster->step_length;
+		const float cell_size = (float)raycaster->macrocell_size;
+		const int tile = (int)raycaster->tile_size;
+		const int width = frame.image->width, height = frame.image->height;
+		const Vector3 gradient_scale(0.5f / source->widthSpacing, 0.5f / source->heightSpacing, 0.5f / source->depthSpacing);
+
+		VolumeView<T, 2> cells;
+		Vector3 cells_dims;
+		if (raycaster->use_macrocells && raycaster->macrocells) {
+			cells = VolumeView<T, 2>(raycaster->macrocells);
+			cells_dims.set((float)cells.width, (float)cells.height, (float)cells.depth);
+		}
+
+		auto density = [&](const Vector3& voxel) {
+			return volume.sample(voxel.x, voxel.y, voxel.z) * value_scale + value_bias;
+		};
+
+		//distance along the ray (texture space) to leave the current macrocell, -1 if the cell is not empty
+		auto emptyCellExit = [&](const Vector3& voxel, const Vector3& dir) -> float {
+			int c[3];
+			float cell_min[3], cell_max[3];
+			const float v[3] = { voxel.x, voxel.y, voxel.z };
+			const float d[3] = { dims.x, dims.y, dims.z };
+			const float cd[3] = { cells_dims.x, cells_dims.y, cells_dims.z };
+			for (int a = 0; a < 3; a++) {
+				c[a] = std::min(std::max((int)floorf(v[a] / cell_size), 0), (int)cd[a] - 1);
+				//the first and last cells extend to the border of the texture
+				cell_min[a] = c[a] == 0 ? -1.0f : c[a] * cell_size;
+				cell_max[a] = c[a] == (int)cd[a] - 1 ? d[a] + 1.0f : (c[a] + 1) * cell_size;
+			}
+			if (VoxelTraits<T>::toFloat(cells.voxel(c[0], c[1], c[2])[1]) >= cells_threshold)
+				return -1.0f;
+
+			const float voxel_dir[3] = { dir.x * d[0], dir.y * d[1], dir.z * d[2] };
+			float exit = 1e30f;
+			for (int a = 0; a < 3; a++)
+				if (voxel_dir[a] != 0.0f)
+					exit = std::min(exit, ((voxel_dir[a] >= 0.0f ? cell_max[a] : cell_min[a]) - v[a]) / voxel_dir[a]);
+			return exit;
+		};
+
+		parallelFor(0, frame.tiles_x * frame.tiles_y, [&](int t0, int t1) {
+			for (int t = t0; t < t1; t++) {
+				int x0 = (t % frame.tiles_x) * tile, y0 = (t / frame.tiles_x) * tile;
+				int x1 = std::min(x0 + tile, width), y1 = std::min(y0 + tile, height);
+				for (int py = y0; py < y1; py++) {
+					Uint8* pixel = frame.image->data + ((size_t)py * width + x0) * 4;
+					for (int px = x0; px < x1; px++, pixel += 4) {
+						//point of the far plane under the pixel center, in local space
+						Vector4 ndc((px + 0.5f) * 2.0f / width - 1.0f, (py + 0.5f) * 2.0f / height - 1.0f, 1.0f, 1.0f);
+						Vector4 far_point = frame.inv_viewprojection * ndc;
+						Vector3 target = frame.inv_model * Vector3(far_point.x / far_point.w, far_point.y / far_point.w, far_point.z / far_point.w);
+						Vector3 dir = target - frame.origin;
+						dir = dir * (1.0f / (float)dir.length());
+						Vector4 result(0.0f, 0.0f, 0.0f, 0.0f);
+
+						//ray in the [-1,1] cube, intersected with its faces
+						float t_near = 0.0f, t_far = 1e30f;
+						const float o[3] = { frame.origin.x, frame.origin.y, frame.origin.z };
+						const float d[3] = { dir.x, dir.y, dir.z };
+						for (int a = 0; a < 3; a++) {
+							float ta = (-1.0f - o[a]) / d[a], tb = (1.0f - o[a]) / d[a];
+							t_near = std::max(t_near, std::min(ta, tb));
+							t_far = std::min(t_far, std::max(ta, tb));
+						}
+
+						//march in texture space, where the cube is [0,1]
+						Vector3 start = (frame.origin + dir * t_near) * 0.5f + Vector3(0.5f, 0.5f, 0.5f);
+						float ray_length = (t_far - t_near) * 0.5f;
+						float ray_t = 0.0f;
+						while (ray_t < ray_length && result.w <= 0.99f) {
+							Vector3 voxel = (start + dir * ray_t) * dims - Vector3(0.5f, 0.5f, 0.5f);
+
+							if (cells.data) {
+								float cell_exit = emptyCellExit(voxel, dir);
+								if (cell_exit >= 0.0f) {
+									//land on the step grid past the cell so the sampling pattern does not change
+									ray_t += std::max(ceilf(cell_exit / step), 1.0f) * step;
+									continue;
+								}
+							}
+
+							float value = density(voxel);
+							if (value >= raycaster->density_threshold) {
+								//emission-absorption, front to back with premultiplied alpha
+								float alpha = clamp(value * raycaster->brightness * step * 100.0f, 0.0f, 1.0f);
+								Vector3 rgb = Vector3(raycaster->color.x, raycaster->color.y, raycaster->color.z) * (value * raycaster->brightness);
+								if (raycaster->use_lighting) {
+									//two sided headlight, the gradient points to higher densities
+									Vector3 n = Vector3(density(voxel + Vector3(1, 0, 0)) - density(voxel - Vector3(1, 0, 0)),
+										density(voxel + Vector3(0, 1, 0)) - density(voxel - Vector3(0, 1, 0)),
+										density(voxel + Vector3(0, 0, 1)) - density(voxel - Vector3(0, 0, 1))) * gradient_scale;
+									float n_length = (float)n.length();
+									float diffuse = n_length > 0.0001f ? fabsf(n.dot(dir)) / n_length : 1.0f;
+									rgb = rgb * (0.3f + 0.7f * diffuse);
+								}
+								float weight = (1.0f - result.w) * alpha;
+								result = result + Vector4(rgb.x * weight, rgb.y * weight, rgb.z * weight, weight);
+							}
+							ray_t += step;
+						}
+
+						result = result + raycaster->background * (1.0f - result.w);
+						pixel[0] = (Uint8)(clamp(result.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+						pixel[1] = (Uint8)(clamp(result.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+						pixel[2] = (Uint8)(clamp(result.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+						pixel[3] = (Uint8)(clamp(result.w, 0.0f, 1.0f) * 255.0f + 0.5f);
+					}
+				}
+			}
+		});
+	}
+};
+
+VolumeRaycaster::VolumeRaycaster(Volume* volume, unsigned int macrocell_size)
+{
+	this->volume = NULL;
+	macrocells = NULL;
+	this->macrocell_size = macrocell_size;
+	color.set(1.0f, 1.0f, 1.0f, 1.0f);
+	step_length = 0.005f;
+	brightness = 1.0f;
+	density_threshold = 0.1f;
+	use_macrocells = true;
+	use_lighting = false;
+	background.set(0.0f, 0.0f, 0.0f, 1.0f);
+	tile_size = 16;
+
+	if (volume)
+		setVolume(volume, macrocell_size);
+}
+
+VolumeRaycaster::~VolumeRaycaster()
+{
+	if (macrocells)
+		delete macrocells;
+}
+
+void VolumeRaycaster::setVolume(Volume* volume, unsigned int macrocell_size)
+{
+	if (macrocells)
+		delete macrocells;
+	macrocells = NULL;
+	this->volume = volume;
+	this->macrocell_size = macrocell_size;
+	if (volume && macrocell_size)
+		macrocells = volume->createMacrocells(macrocell_size);
+}
+
+void VolumeRaycaster::setFromMaterial(VolumeMaterial* material)
+{
+	if (material->volume != volume || material->macrocell_size != macrocell_size)
+		setVolume(material->volume, material->macrocell_size);
+	color = material->color;
+	step_length = material->step_length;
+	brightness = material->brightness;
+	density_threshold = material->density_threshold;
+	use_macrocells = material->use_macrocells;
+	use_lighting = material->use_lighting && material->gradients_texture;
+}
+
+bool VolumeRaycaster::render(Image* image, int width, int height, Matrix44 model, Camera* camera)
+{
+	if (!volume || !volume->data || width <= 0 || height <= 0 || step_length <= 0.0f || tile_size == 0)
+		return false;
+
+	long time = getTime();
+	if (!image->data || image->width != (unsigned int)width || image->height != (unsigned int)height || image->bytes_per_pixel != 4)
+		image->resize(width, height, 4);
+
+	sRaycastFrame frame;
+	frame.image = image;
+	frame.inv_model = model;
+	frame.inv_model.inverse();
+	frame.inv_viewprojection = camera->viewprojection_matrix;
+	frame.inv_viewprojection.inverse();
+	frame.origin = frame.inv_model * camera->eye;
+	frame.tiles_x = (width + tile_size - 1) / tile_size;
+	frame.tiles_y = (height + tile_size - 1) / tile_size;
+
+	if (!dispatchVolume<RaycastKernel>(volume, (const VolumeRaycaster*)this, frame)) {
+		std::cout << "[ERROR]: CPU raycast: unsupported voxel format" << std::endl;
+		return false;
+	}
+
+	std::cout << " + CPU raycast: " << width << "x" << height << " in " << (getTime() - time) << "ms" << std::endl;
+	return true;
+}
@@ -0,0 +1,42 @@
+#ifndef VOLUMERAYCASTER_H
+#define VOLUMERAYCASTER_H
+
+#include "includes.h"
+#include "framework.h"
+
+class Volume;
+class Image;
+class Camera;
+class VolumeMaterial;
+
+//Software version of volume.fs: same ray setup, sampling and compositing, so volumes can be rendered
+//without a GPU (thumbnails, batch jobs) and the images can be compared with the shader ones.
+//Tiles of the image are traced in parallel in the global thread pool.
+class VolumeRaycaster
+{
+public:
+	Volume* volume;
+	Volume* macrocells; //computed from the volume, owned
+	unsigned int macrocell_size;
+
+	Vector4 color;
+	float step_length;			//in texture coordinates
+	float brightness;
+	float density_threshold;	//transfer function: densities below it are transparent
+	bool use_macrocells;
+	bool use_lighting;			//headlight with gradients computed from the volume
+	Vector4 background;			//composited behind the volume
+	unsigned int tile_size;		//pixels per side of a tile (work unit of a thread)
+
+	VolumeRaycaster(Volume* volume = NULL, unsigned int macrocell_size = 8);
+	~VolumeRaycaster();
+
+	void setVolume(Volume* volume, unsigned int macrocell_size = 8);
+	void setFromMaterial(VolumeMaterial* material); //same settings as the GPU path (full resolution level)
+
+	//image becomes width x height RGBA, bottom row first like Image::fromScreen (saveTGA flips it).
+	//The camera aspect should match width / height
+	bool render(Image* image, int width, int height, Matrix44 model, Camera* camera);
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef VOLUMEVIEW_H
+#define VOLUMEVIEW_H
+
+//Typed access to the voxels of a Volume.
+//Kernels are written once as templates on the channel type and the number of channels, dispatchVolume
+//instantiates them for every format, so the inner loops have no per voxel switch on voxelType/voxelBytes.
+
+#include "volume.h"
+
+#include <limits>
+#include <cmath>
+#include <utility>
+
+//16 bits float channel (voxelType 2, voxelBytes 2)
+struct sHalf { Uint16 bits; };
+
+inline float halfToFloat(Uint16 h)
+{
+	Uint32 sign = (Uint32)(h & 0x8000) << 16;
+	Uint32 exponent = (h >> 10) & 0x1F;
+	Uint32 mantissa = h & 0x3FF;
+	Uint32 bits;
+	if (exponent == 0) {
+		float f = ldexpf((float)mantissa, -24); //zero and subnormals
+		return sign ? -f : f;
+	}
+	else if (exponent == 31)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &bits, 4);
+	return f;
+}
+
+//round to nearest, out of range values become infinity
+inline Uint16 floatToHalf(float f)
+{
+	Uint32 bits;
+	memcpy(&bits, &f, 4);
+	Uint16 sign = (Uint16)((bits >> 16) & 0x8000);
+	Uint32 exponent = (bits >> 23) & 0xFF;
+	Uint32 mantissa = bits & 0x7FFFFF;
+
+	if (exponent == 255) //inf or nan
+		return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+	int e = (int)exponent - 112;
+	if (e >= 31)
+		return sign | 0x7C00;
+	if (e <= 0) {
+		if (e < -10)
+			return sign; //too small, zero
+		mantissa |= 0x800000;
+		Uint32 shift = 14 - e;
+		Uint32 half_mantissa = mantissa >> shift;
+		Uint32 rest = mantissa & ((1u << shift) - 1);
+		Uint32 halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half_mantissa & 1)))
+			half_mantissa++;
+		return sign | (Uint16)half_mantissa;
+	}
+	Uint16 h = sign | (Uint16)(e << 10) | (Uint16)(mantissa >> 13);
+	Uint32 rest = mantissa & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++; //the carry goes to the exponent, which is the right result
+	return h;
+}
+
+//Conversions of a channel type. Values are kept as they are stored (a Uint16 of 1000 is 1000.0),
+//the normalized ones are the [0,1] range of the texture (unsigned integers are divided by their max when sampled)
+template <typename T>
+struct VoxelTraits {
+	static inline float toFloat(T v) { return (float)v; }
+	static inline T fromFloat(float v) {
+		//saturate and round, as the GPU does when converting to normalized integers
+		if (!(v > (float)std::numeric_limits<T>::min()))
+			return std::numeric_limits<T>::min();
+		if (v >= (float)std::numeric_limits<T>::max())
+			return std::numeric_limits<T>::max();
+		return (T)floorf(v + 0.5f);
+	}
+	static inline float normalizedMax() { return (float)std::numeric_limits<T>::max(); }
+	static inline bool less(T a, T b) { return a < b; }
+};
+
+template <>
+struct VoxelTraits<float> {
+	static inline float toFloat(float v) { return v; }
+	static inline float fromFloat(float v) { return v; }
+	static inline float normalizedMax() { return 1.0f; }
+	static inline bool less(float a, float b) { return a < b; }
+};
+
+template <>
+struct VoxelTraits<sHalf> {
+	static inline float toFloat(sHalf v) { return halfToFloat(v.bits); }
+	static inline sHalf fromFloat(float v) { sHalf h; h.bits = floatToHalf(v); return h; }
+	static inline float normalizedMax() { return 1.0f; }
+	static inline bool less(sHalf a, sHalf b) { return toFloat(a) < toFloat(b); }
+};
+
+//Voxels of a volume with T channels interleaved Channels times. It does not own the data, copy it by value.
+template <typename T, int Channels>
+class VolumeView
+{
+public:
+	typedef T Type;
+	static const int channels = Channels;
+
+	T* data;
+	int width;
+	int height;
+	int depth;
+	size_t row;		//channel values between consecutive rows
+	size_t slice;	//channel values between consecutive slices
+
+	VolumeView() { data = NULL; width = height = depth = 0; row = slice = 0; }
+	VolumeView(Volume* volume) {
+		data = (T*)volume->data;
+		width = volume->width;
+		height = volume->height;
+		depth = volume->depth;
+		row = (size_t)width * Channels;
+		slice = row * height;
+	}
+
+	inline T* voxel(int x, int y, int z) const { return data + x * (size_t)Channels + y * row + z * slice; }
+	inline T* getRow(int y, int z) const { return data + y * row + z * slice; }
+
+	inline float get(int x, int y, int z, int c = 0) const { return VoxelTraits<T>::toFloat(voxel(x, y, z)[c]); }
+	inline void set(int x, int y, int z, int c, float v) const { voxel(x, y, z)[c] = VoxelTraits<T>::fromFloat(v); }
+
+	//coordinates out of the volume read the closest border voxel
+	inline float getClamped(int x, int y, int z, int c = 0) const {
+		x = x < 0 ? 0 : (x >= width ? width - 1 : x);
+		y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+		z = z < 0 ? 0 : (z >= depth ? depth - 1 : z);
+		return get(x, y, z, c);
+	}
+
+	//trilinear interpolation in voxel coordinates (voxel centers at integers), clamped to the borders
+	float sample(float x, float y, float z, int c = 0) const {
+		x = x < 0.0f ? 0.0f : (x > width - 1.0f ? width - 1.0f : x);
+		y = y < 0.0f ? 0.0f : (y > height - 1.0f ? height - 1.0f : y);
+		z = z < 0.0f ? 0.0f : (z > depth - 1.0f ? depth - 1.0f : z);
+		int x0 = (int)x, y0 = (int)y, z0 = (int)z;
+		float fx = x - x0, fy = y - y0, fz = z - z0;
+
+		//offsets to the next voxel, 0 on the last one
+		size_t dx = x0 < width - 1 ? Channels : 0;
+		size_t dy = y0 < height - 1 ? row : 0;
+		size_t dz = z0 < depth - 1 ? slice : 0;
+		const T* p = voxel(x0, y0, z0) + c;
+		#define VIEW_VALUE(offset) VoxelTraits<T>::toFloat(p[offset])
+		float c00 = VIEW_VALUE(0) + (VIEW_VALUE(dx) - VIEW_VALUE(0)) * fx;
+		float c10 = VIEW_VALUE(dy) + (VIEW_VALUE(dy + dx) - VIEW_VALUE(dy)) * fx;
+		float c01 = VIEW_VALUE(dz) + (VIEW_VALUE(dz + dx) - VIEW_VALUE(dz)) * fx;
+		float c11 = VIEW_VALUE(dz + dy) + (VIEW_VALUE(dz + dy + dx) - VIEW_VALUE(dz + dy)) * fx;
+		#undef VIEW_VALUE
+		float c0 = c00 + (c10 - c00) * fy;
+		float c1 = c01 + (c11 - c01) * fy;
+		return c0 + (c1 - c0) * fz;
+	}
+};
+
+template <template <typename, int> class Kernel, typename T, typename... Args>
+inline bool dispatchVolumeChannels(Volume* volume, Args&&... args)
+{
+	switch (volume->voxelChannels) {
+	case 1: Kernel<T, 1>::run(VolumeView<T, 1>(volume), std::forward<Args>(args)...); return true;
+	case 2: Kernel<T, 2>::run(VolumeView<T, 2>(volume), std::forward<Args>(args)...); return true;
+	case 3: Kernel<T, 3>::run(VolumeView<T, 3>(volume), std::forward<Args>(args)...); return true;
+	case 4: Kernel<T, 4>::run(VolumeView<T, 4>(volume), std::forward<Args>(args)...); return true;
+	}
+	return false;
+}
+
+//Calls Kernel<T, Channels>::run(VolumeView<T, Channels>(volume), args...) with the types of the volume format.
+//Packed voxels (voxelType 3) are seen as unsigned integers of voxelBytes. False if the format is not valid.
+template <template <typename, int> class Kernel, typename... Args>
+bool dispatchVolume(Volume* volume, Args&&... args)
+{
+	if (!volume || !volume->data)
+		return false;
+	switch (volume->voxelType) {
+	case 0: //unsigned
+	case 3: //packed
+		switch (volume->voxelBytes) {
+		case 1: return dispatchVolumeChannels<Kernel, Uint8>(volume, std::forward<Args>(args)...);
+		case 2: return dispatchVolumeChannels<Kernel, Uint16>(volume, std::forward<Args>(args)...);
+		case 4: return dispatchVolumeChannels<Kernel, Uint32>(volume, std::forward<Args>(args)...);
+		}
+		break;
+	case 1: //signed
+		switch (volume->voxelBytes) {
+		case 1: return dispatchVolumeChannels<Kernel, Sint8>(volume, std::forward<Args>(args)...);
+		case 2: return dispatchVolumeChannels<Kernel, Sint16>(volume, std::forward<Args>(args)...);
+		case 4: return dispatchVolumeChannels<Kernel, Sint32>(volume, std::forward<Args>(args)...);
+		}
+		break;
+	case 2: //float
+		switch (volume->voxelBytes) {
+		case 2: return dispatchVolumeChannels<Kernel, sHalf>(volume, std::forward<Args>(args)...);
+		case 4: return dispatchVolumeChannels<Kernel, float>(volume, std::forward<Args>(args)...);
+		}
+		break;
+	}
+	return false;
+}
+
+#endif